@@ -0,0 +1,34 @@
+#ifndef ETCDARENA_H
+#define ETCDARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief The ETCDArena class hands out memory from large blocks that are all freed with the arena. The
+ * memory never moves, so views into it stay valid as long as the arena lives.
+ */
+class ETCDArena
+{
+    static constexpr std::size_t MaxBlockSize = 1 << 20;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::size_t                          nextBlockSize;
+    char*                                current   = nullptr;
+    std::size_t                          remaining = 0;
+
+public:
+    explicit ETCDArena(std::size_t firstBlockSize = 4096);
+    ETCDArena(const ETCDArena&) = delete;
+    ETCDArena& operator=(const ETCDArena&) = delete;
+
+    char* allocate(std::size_t size);
+    /**
+     * @brief shrinkLast gives back the unused end of the last allocation, so that the next allocation
+     * starts right after the used bytes
+     */
+    void shrinkLast(char* p, std::size_t allocated, std::size_t used);
+};
+
+#endif // ETCDARENA_H
@@ -0,0 +1,99 @@
+#ifndef ETCDAWAITABLE_H
+#define ETCDAWAITABLE_H
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define ETCD_HAS_COROUTINES 1
+#endif
+
+#ifdef ETCD_HAS_COROUTINES
+
+#include "ETCDError.h"
+#include "ETCDParsedResponse.h"
+#include <boost/asio/async_result.hpp>
+#include <boost/system/error_code.hpp>
+#include <coroutine>
+#include <functional>
+#include <tuple>
+#include <utility>
+
+/**
+ * @brief The ETCDAwaitable class is what the ETCDClient operations return when they're given the
+ * ETCDUseAwaitable completion token, as in
+ *
+ *     ETCDParsedResponse r = co_await client.get("/key", ETCDUseAwaitable);
+ *
+ * The request is sent when the awaitable is co_awaited, and the coroutine is resumed on the io thread of
+ * the client that received the response, so no thread is blocked while the request is in flight. Any
+ * coroutine type can await it. Errors are thrown from co_await as ETCDError.
+ */
+class ETCDAwaitable
+{
+public:
+    using Handler = std::function<void(boost::system::error_code, ETCDParsedResponse)>;
+
+private:
+    std::function<void(Handler)> start;
+    boost::system::error_code    ec;
+    ETCDParsedResponse           response;
+
+public:
+    explicit ETCDAwaitable(std::function<void(Handler)> Start) : start(std::move(Start)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> coroutine)
+    {
+        // the coroutine, and this object with it, may be resumed and destroyed before start returns
+        auto startOperation = std::move(start);
+        startOperation([this, coroutine](boost::system::error_code Ec, ETCDParsedResponse Response) {
+            ec       = Ec;
+            response = std::move(Response);
+            coroutine.resume();
+        });
+    }
+
+    ETCDParsedResponse await_resume()
+    {
+        if (ec) {
+            throw ETCDError(ec.value(), ec.message());
+        }
+        return std::move(response);
+    }
+};
+
+struct ETCDUseAwaitableToken
+{
+};
+
+constexpr ETCDUseAwaitableToken ETCDUseAwaitable;
+
+namespace boost {
+namespace asio {
+
+template <>
+class async_result<ETCDUseAwaitableToken, void(boost::system::error_code, ETCDParsedResponse)>
+{
+public:
+    using return_type = ETCDAwaitable;
+
+    template <typename Initiation, typename... Args>
+    static return_type initiate(Initiation&& initiation, ETCDUseAwaitableToken, Args&&... args)
+    {
+        // the operation starts on co_await, so its arguments are copied until then
+        return ETCDAwaitable(
+            [initiation = std::forward<Initiation>(initiation),
+             arguments  = std::make_tuple(typename std::decay<Args>::type(std::forward<Args>(args))...)](
+                ETCDAwaitable::Handler handler) mutable {
+                std::apply(
+                    [&](auto&... a) { std::move(initiation)(std::move(handler), std::move(a)...); },
+                    arguments);
+            });
+    }
+};
+
+} // namespace asio
+} // namespace boost
+
+#endif // ETCD_HAS_COROUTINES
+
+#endif // ETCDAWAITABLE_H
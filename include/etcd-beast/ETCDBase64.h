@@ -0,0 +1,53 @@
+#ifndef ETCDBASE64_H
+#define ETCDBASE64_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+/**
+ * @brief The ETCDBase64 class encodes and decodes the base64 of etcd keys and values. The fastest
+ * implementation the CPU supports is picked at runtime (AVX2, SSE4.1 or scalar); all of them give the
+ * same results as boost::beast::detail::base64.
+ */
+class ETCDBase64
+{
+public:
+    enum class Implementation
+    {
+        Scalar,
+        SSE41,
+        AVX2
+    };
+
+    static std::size_t EncodedSize(std::size_t len) { return 4 * ((len + 2) / 3); }
+    // rounded up, so that unpadded input fits too
+    static std::size_t DecodedSize(std::size_t len) { return (len + 3) / 4 * 3; }
+
+    /**
+     * @brief Encode writes the padded base64 of src to dest, which must have room for EncodedSize(len)
+     * bytes
+     * @return the number of bytes written
+     */
+    static std::size_t Encode(char* dest, const char* src, std::size_t len);
+    /**
+     * @brief Decode writes the octets of the base64 in src to dest, which must have room for
+     * DecodedSize(len) bytes. Decoding stops at the padding or at the first invalid character
+     * @return the number of bytes written and the number of characters read
+     */
+    static std::pair<std::size_t, std::size_t> Decode(char* dest, const char* src, std::size_t len);
+
+    static std::string Encode(const std::string& str);
+    static std::string Decode(const std::string& str);
+
+    // a specific implementation; it must be supported by the CPU
+    static std::size_t Encode(char* dest, const char* src, std::size_t len, Implementation impl);
+    static std::pair<std::size_t, std::size_t> Decode(char* dest, const char* src, std::size_t len,
+                                                      Implementation impl);
+
+    static bool           IsSupported(Implementation impl);
+    static Implementation ActiveImplementation();
+    static const char*    ImplementationName(Implementation impl);
+};
+
+#endif // ETCDBASE64_H
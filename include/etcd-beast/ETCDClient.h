@@ -1,20 +1,52 @@
 #ifndef ETCDCLIENT_H
 #define ETCDCLIENT_H
 
+#include "ETCDIoShards.h"
+#include "ETCDLeaseKeeper.h"
+#include "ETCDLeasePool.h"
+#include "ETCDRangeIterator.h"
+#include "ETCDRangeOptions.h"
+#include "ETCDReadCache.h"
 #include "ETCDResponse.h"
+#include "ETCDTransaction.h"
 #include "ETCDWatch.h"
+#include "ETCDWriteCoalescer.h"
+#include "ETCDAwaitable.h"
+#include "HttpSessionPool.h"
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/executor_work_guard.hpp>
 #include <boost/asio/io_context.hpp>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <type_traits>
+
+// completion signature of the asynchronous functions of ETCDClient that take a completion token
+#define ETCD_COMPLETION_SIGNATURE void(boost::system::error_code, ETCDParsedResponse)
 
 class ETCDClient
 {
     std::string                                    address;
     uint16_t                                       port;
     unsigned                                       threadCount;
-    boost::asio::io_context                        io_context;
-    std::unique_ptr<boost::asio::io_context::work> io_context_work;
-    std::vector<std::thread>                       pool;
+    HttpSessionPoolConfig                          sessionPoolConfig;
+    ETCDExecutionConfig                            executionConfig;
+    std::unique_ptr<ETCDIoShards>                  ioShards;
+    std::vector<std::unique_ptr<HttpSessionPool>>  sessionPools; // one per shard
+    std::unique_ptr<ETCDWriteCoalescer>            writeCoalescer;
+    std::shared_ptr<ETCDWatchMultiplexer>          watchMultiplexer;
+    std::vector<std::unique_ptr<ETCDReadCache>>    readCaches;
+    std::mutex                                     leaseKeeperMtx;
+    std::shared_ptr<ETCDLeaseKeeper>               leaseKeeper; // created by the first leaseKeepAlive()
+    std::unique_ptr<ETCDLeasePool>                 leasePool;
+    std::unique_ptr<ETCDIoShards>                  callbackShards; // of enableWatchCallbackThreads()
+    boost::asio::any_io_executor                   watchCallbackExecutor;
+    // the thread and the connections of the requests waited for on io threads (blockingSessionPool)
+    std::once_flag                                 blockingPoolCreated;
+    std::unique_ptr<ETCDIoShards>                  blockingShards;
+    std::unique_ptr<HttpSessionPool>               blockingPool;
 
     // v3alpha is for ETCD v3.2
     std::string ETCDVersionPrefix = "/v3alpha";
@@ -22,26 +54,330 @@ class ETCDClient
     void start();
     void stop();
 
+    /**
+     * @brief ioContext and sessionPool are those of the shard of the calling thread (see ETCDIoShards);
+     * they throw if the client wasn't started. blockingSessionPool is for the requests the calling
+     * thread may wait for: on an io thread of the client, like in a callback, waiting would hold a
+     * thread that may be the one to complete them, so they're sent from a thread of their own, which
+     * runs no callbacks and is started by the first of them
+     */
+    boost::asio::io_context& ioContext();
+    HttpSessionPool&         sessionPool();
+    HttpSessionPool&         blockingSessionPool();
+    bool                     isIoThread() const;
+
     static std::string ToBase64(const std::string& str);
     static std::string ToBase64PlusOne(const std::string& str);
 
     static const uint64_t LEASE_MIN_TTL = 2;
 
+    friend class ETCDTransaction;
+    friend class ETCDReadCache;
+    friend class ETCDRangeIterator;
+
+    struct Command
+    {
+        std::string url;
+        std::string json;
+
+        // the read caches that see the revision of the command if it's a write
+        std::vector<ETCDReadCache*> readCaches;
+        std::string                 key;
+        bool                        isRange = false;
+        bool                        isWrite = false;
+        // a deleterange changes the caches only if it deleted keys
+        bool isDelete = false;
+        // a plain get or getAll, which a read cache of its key can answer
+        bool isCacheableRead = false;
+        // a range or a put, which is sent again when a stale connection drops it; a txn, a delete or a
+        // lease command may have been applied, and would return something else the second time
+        bool isIdempotent = true;
+    };
+
+    Command     setCommand(const std::string& key, const std::string& value, uint64_t leaseID) const;
+    Command     getCommand(const std::string& key) const;
+    Command     getAllCommand(const std::string& prefix) const;
+    Command rangeCommand(const std::string& key, bool isRange, const ETCDRangeOptions& options) const;
+    Command     delCommand(const std::string& key) const;
+    Command     delAllCommand(const std::string& prefix) const;
+    Command     leaseGrantCommand(uint64_t ttl, uint64_t ID) const;
+    Command     leaseRevokeCommand(uint64_t leaseID) const;
+    Command     leaseTimeToLiveCommand(uint64_t leaseID) const;
+    void attachReadCaches(Command& command, const std::string& key, bool isRange, bool isWrite) const;
+    bool readFromCache(const std::string& key, bool isRange, ETCDParsedResponse& out) const;
+
+    ETCDResponse sendCommand(Command command);
+    /**
+     * @brief ParsedResult is the decoded response of requestParsed(), or the error of its request (with
+     * its cause) or of its decoding (with the json)
+     */
+    struct ParsedResult
+    {
+        boost::system::error_code ec;
+        boost::system::error_code cause;
+        ETCDParsedResponse        parsed;
+        std::string               json;
+    };
+    /**
+     * @brief requestParsed sends the command on pool (blockingSessionPool() by default) and decodes its
+     * response on the thread that receives it
+     */
+    std::future<ParsedResult> requestParsed(Command command);
+    std::future<ParsedResult> requestParsed(Command command, HttpSessionPool& pool);
+    /**
+     * @brief TakeParsed waits for the result of requestParsed() and throws its error as an ETCDError
+     */
+    static ETCDParsedResponse TakeParsed(std::future<ParsedResult>& future);
+    ETCDResponse sendWriteToReadCaches(Command command, bool isPut);
+    void         asyncCommand(Command command, bool isPut, const std::string& key,
+                              std::function<void(boost::system::error_code, ETCDParsedResponse)> callback);
+
+    // integers are lease IDs and TTLs, and range options are options, not completion tokens
+    template <typename CompletionToken>
+    using EnableIfCompletionToken = typename std::enable_if<
+        !std::is_arithmetic<typename std::decay<CompletionToken>::type>::value &&
+        !std::is_same<typename std::decay<CompletionToken>::type, ETCDRangeOptions>::value>::type;
+
+    struct AsyncCommandInitiation
+    {
+        ETCDClient* client;
+
+        template <typename Handler>
+        void operator()(Handler&& handler, Command command, bool isPut, const std::string& key) const
+        {
+            using HandlerType  = typename std::decay<Handler>::type;
+            auto sharedHandler = std::make_shared<HandlerType>(std::forward<Handler>(handler));
+            auto executor =
+                boost::asio::get_associated_executor(*sharedHandler, client->ioContext().get_executor());
+            auto work = boost::asio::make_work_guard(executor);
+            client->asyncCommand(std::move(command), isPut, key,
+                                 [sharedHandler, work](boost::system::error_code ec,
+                                                       ETCDParsedResponse        response) mutable {
+                                     auto executor = work.get_executor();
+                                     boost::asio::dispatch(executor, [sharedHandler, ec, response]() mutable {
+                                         (*sharedHandler)(ec, std::move(response));
+                                     });
+                                     work.reset();
+                                 });
+        }
+    };
+
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    initiateCommand(Command command, bool isPut, const std::string& key, CompletionToken&& token)
+    {
+        return boost::asio::async_initiate<CompletionToken, ETCD_COMPLETION_SIGNATURE>(
+            AsyncCommandInitiation{this}, token, std::move(command), isPut, key);
+    }
+
 public:
+    /**
+     * With ExecutionConfig.sharded, the client runs an io_context per thread, each with its own
+     * connection pool of PoolConfig; a thread sends its requests and opens its watches on the same
+     * shard. The write coalescer, the watch multiplexer and the lease keeper run on one shard.
+     * A request waited for on an io thread of the client, like in a callback, is sent from a thread of
+     * its own, so that it doesn't wait for the thread it holds
+     */
     ETCDClient(const std::string& Address, uint16_t Port,
-               unsigned ThreadCount = std::thread::hardware_concurrency());
+               unsigned                     ThreadCount     = std::thread::hardware_concurrency(),
+               const HttpSessionPoolConfig& PoolConfig      = HttpSessionPoolConfig(),
+               const ETCDExecutionConfig&   ExecutionConfig = ETCDExecutionConfig());
     ~ETCDClient();
-    ETCDResponse set(const std::string& key, const std::string& value, uint64_t leaseID = 0);
-    ETCDResponse get(const std::string& key);
-    ETCDResponse getAll(const std::string& prefix);
-    ETCDResponse del(const std::string& key);
-    ETCDResponse delAll(const std::string& prefix);
-    ETCDResponse leaseGrant(uint64_t ttl, uint64_t ID = 0);
-    ETCDResponse leaseRevoke(uint64_t leaseID);
-    ETCDResponse leaseTimeToLive(uint64_t leaseID);
-    ETCDWatch    watch(const std::string& key, const std::function<void(ETCDParsedResponse)> callback);
-    ETCDResponse customCommand(const std::string& url, const std::string& jsonCommand);
-    void         setVersionUrlPrefix(std::string str = "/v3alpha");
+    ETCDResponse    set(const std::string& key, const std::string& value, uint64_t leaseID = 0);
+    ETCDResponse    get(const std::string& key);
+    ETCDResponse    getAll(const std::string& prefix);
+    /**
+     * @brief get and getAll with options read the key or the prefix with the options of the range
+     * request applied. They always go to the server, even if a read cache has the key
+     */
+    ETCDResponse get(const std::string& key, const ETCDRangeOptions& options);
+    ETCDResponse getAll(const std::string& prefix, const ETCDRangeOptions& options);
+    /**
+     * @brief getAllPaginated reads the keys of prefix in pages of at most pageSize keys, to bound the
+     * memory of large prefixes; see ETCDRangeIterator
+     */
+    ETCDRangeIterator getAllPaginated(const std::string& prefix, std::size_t pageSize = 1000);
+    /**
+     * @brief getAllParallel reads the keys of prefix with up to shards concurrent range requests, all at
+     * the same revision, and returns them in key order as one response. The ranges split the byte space
+     * between the first and the last key of the prefix evenly, as found by two one-key probes, so they
+     * hold the same number of keys only if the keys are spread evenly
+     */
+    ETCDResponse getAllParallel(const std::string& prefix, unsigned shards);
+    ETCDResponse    del(const std::string& key);
+    ETCDResponse    delAll(const std::string& prefix);
+    ETCDTransaction txn();
+    ETCDResponse    leaseGrant(uint64_t ttl, uint64_t ID = 0);
+    ETCDResponse    leaseRevoke(uint64_t leaseID);
+    ETCDResponse    leaseTimeToLive(uint64_t leaseID);
+    /**
+     * @brief leaseKeepAlive renews the lease of ttl seconds over the keep-alive stream of the client,
+     * until leaseRevoke() or leaseStopKeepAlive(). If it expires anyway, onExpired is called with its id
+     * on one of the threads of the client (see ETCDLeaseKeeper)
+     */
+    void leaseKeepAlive(uint64_t leaseID, uint64_t ttl,
+                        ETCDLeaseKeeper::ExpiryCallback onExpired = nullptr);
+    void leaseStopKeepAlive(uint64_t leaseID);
+    /**
+     * @brief leaseCheckOut takes a lease of ttl seconds from the lease pool (see enableLeasePool()),
+     * or grants one if none is ready. The lease is kept alive until leaseRevoke(); onExpired is called
+     * if it expires anyway
+     */
+    uint64_t leaseCheckOut(uint64_t ttl, ETCDLeaseKeeper::ExpiryCallback onExpired = nullptr);
+    /**
+     * @brief leaseShared is a lease of ttl seconds for keys that live as long as the client, shared by
+     * all of them; don't revoke it. If it expires, the next call returns another lease
+     */
+    uint64_t leaseShared(uint64_t ttl);
+    ETCDWatch       watch(const std::string& key, const std::function<void(ETCDParsedResponse)> callback);
+    /**
+     * @brief watch watches the key, or the range/prefix of the options, with the options applied. The
+     * events of the messages are given by ETCDParsedResponse::getEvents()
+     */
+    ETCDWatch watch(const std::string& key, const ETCDWatchOptions& options,
+                    const std::function<void(ETCDParsedResponse)> callback);
+    ETCDResponse    customCommand(const std::string& url, const std::string& jsonCommand);
+    void            setVersionUrlPrefix(std::string str = "/v3alpha");
+
+    /**
+     * The following overloads take an asio completion token (a handler, boost::asio::use_future, a
+     * yield_context...) with the signature void(boost::system::error_code, ETCDParsedResponse). The error
+     * code is of ETCDErrorCategory(), with one of the ETCDERROR_* values; nothing is thrown on the way,
+     * so failures cost no more than responses. Handlers are invoked through their associated executor,
+     * or on one of the client's threads if they don't have one.
+     */
+    template <typename CompletionToken, typename = EnableIfCompletionToken<CompletionToken>>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    set(const std::string& key, const std::string& value, CompletionToken&& token)
+    {
+        return initiateCommand(setCommand(key, value, 0), true, key, std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    set(const std::string& key, const std::string& value, uint64_t leaseID, CompletionToken&& token)
+    {
+        return initiateCommand(setCommand(key, value, leaseID), true, key,
+                               std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken, typename = EnableIfCompletionToken<CompletionToken>>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    get(const std::string& key, CompletionToken&& token)
+    {
+        return initiateCommand(getCommand(key), false, key, std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    get(const std::string& key, const ETCDRangeOptions& options, CompletionToken&& token)
+    {
+        return initiateCommand(rangeCommand(key, false, options), false, key,
+                               std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken, typename = EnableIfCompletionToken<CompletionToken>>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    getAll(const std::string& prefix, CompletionToken&& token)
+    {
+        return initiateCommand(getAllCommand(prefix), false, prefix, std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    getAll(const std::string& prefix, const ETCDRangeOptions& options, CompletionToken&& token)
+    {
+        return initiateCommand(rangeCommand(prefix, true, options), false, prefix,
+                               std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    del(const std::string& key, CompletionToken&& token)
+    {
+        return initiateCommand(delCommand(key), false, key, std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    delAll(const std::string& prefix, CompletionToken&& token)
+    {
+        return initiateCommand(delAllCommand(prefix), false, prefix, std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken, typename = EnableIfCompletionToken<CompletionToken>>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    leaseGrant(uint64_t ttl, CompletionToken&& token)
+    {
+        return initiateCommand(leaseGrantCommand(ttl, 0), false, "", std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    leaseGrant(uint64_t ttl, uint64_t ID, CompletionToken&& token)
+    {
+        return initiateCommand(leaseGrantCommand(ttl, ID), false, "", std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    leaseRevoke(uint64_t leaseID, CompletionToken&& token)
+    {
+        leaseStopKeepAlive(leaseID);
+        return initiateCommand(leaseRevokeCommand(leaseID), false, "",
+                               std::forward<CompletionToken>(token));
+    }
+
+    template <typename CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, ETCD_COMPLETION_SIGNATURE)
+    leaseTimeToLive(uint64_t leaseID, CompletionToken&& token)
+    {
+        return initiateCommand(leaseTimeToLiveCommand(leaseID), false, "",
+                               std::forward<CompletionToken>(token));
+    }
+    /**
+     * @brief enableWriteCoalescing makes set() calls that arrive within the window merge into a single
+     * transaction request, up to maxBatchSize puts (etcd's --max-txn-ops, 128 by default, is the limit).
+     * Call this before using the client from other threads
+     */
+    void enableWriteCoalescing(std::chrono::microseconds window       = std::chrono::microseconds(500),
+                               std::size_t               maxBatchSize = 128);
+    /**
+     * @brief enableWatchMultiplexing makes watch() share streamCount watch streams (and connections)
+     * among all the watches, instead of opening a stream per watch. Call this before using the client
+     * from other threads, and after setVersionUrlPrefix()
+     */
+    void enableWatchMultiplexing(unsigned streamCount = 1);
+    /**
+     * @brief enableReadCache keeps the keys of prefix in memory, kept current by a watch, so that get()
+     * and getAll() of keys in the prefix are answered without a request (see ETCDReadCache for the
+     * consistency). Writes of the client in transactions aren't seen by the cache before its watch gets
+     * them. It blocks until the prefix is read. Call this before using the client from other threads, and
+     * after enableWatchMultiplexing()
+     */
+    void enableReadCache(const std::string& prefix);
+    /**
+     * @brief enableLeasePool keeps warmCount leases of ttl seconds granted ahead of time, so that
+     * leaseCheckOut(ttl) doesn't wait for a grant (see ETCDLeasePool). Call it once per TTL
+     */
+    void enableLeasePool(uint64_t ttl, std::size_t warmCount = 16);
+    /**
+     * @brief leasePoolReadyCount
+     * @return the number of leases of ttl seconds the lease pool has ready to be checked out
+     */
+    std::size_t leasePoolReadyCount(uint64_t ttl);
+    /**
+     * @brief enableWatchCallbackThreads calls the callbacks of the watches on threadCount threads of
+     * their own instead of the io threads, so that a slow callback doesn't delay the other requests.
+     * Each watch queues its messages for its callback; see ETCDWatchOptions::queueSize and overflow.
+     * Call this before watch(), and before using the client from other threads
+     */
+    void enableWatchCallbackThreads(unsigned threadCount = 1);
+    /**
+     * @brief enableWatchCallbackExecutor is enableWatchCallbackThreads() with an executor of the caller,
+     * which must not run on the threads of the client with the Block overflow
+     */
+    void enableWatchCallbackExecutor(boost::asio::any_io_executor executor);
 };
 
 #endif // ETCDCLIENT_H
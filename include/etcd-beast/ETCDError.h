@@ -1,6 +1,7 @@
 #ifndef ETCDERROR_H
 #define ETCDERROR_H
 
+#include <boost/system/error_code.hpp>
 #include <limits>
 #include <stdexcept>
 
@@ -24,23 +25,50 @@ static const int ETCDERROR_CANCEL_WATCH_RETURNED_ERROR                 = 26;
 static const int ETCDERROR_MIN_TTL_EXCEEDED_ERROR                      = 27;
 static const int ETCDERROR_EMPTY_KEY_ERROR                             = 28;
 static const int ETCDERROR_INVALID_KEY_PREFIX_ERROR                    = 29;
+static const int ETCDERROR_INVALID_POOL_SIZE                           = 30;
+static const int ETCDERROR_INVALID_PIPELINE_DEPTH                      = 31;
+static const int ETCDERROR_INVALID_WATCH_STREAM_COUNT                  = 32;
+static const int ETCDERROR_WATCH_STREAM_CLOSED                         = 33;
+static const int ETCDERROR_INVALID_PAGE_SIZE                           = 34;
+static const int ETCDERROR_INVALID_SHARD_COUNT                         = 35;
+static const int ETCDERROR_LEASE_KEEPER_CLOSED                         = 36;
 
 class ETCDError : public std::exception
 {
     static const long   DEFAULT_ETCD_ERR_VALUE = std::numeric_limits<long>::min();
-    long                errorCode;
-    long                etcdErrorCode;
-    std::string         errorMsg;
-    mutable std::string fullMessage;
+    long                      errorCode;
+    long                      etcdErrorCode;
+    std::string               errorMsg;
+    std::string               detail;
+    boost::system::error_code cause;
+    mutable std::string       fullMessage;
 
 public:
     ETCDError(long Code = 0, const std::string& Message = "");
     ETCDError(long Code = 0, long EtcdErrorCode = DEFAULT_ETCD_ERR_VALUE,
               const std::string& Message = "");
+    /**
+     * @brief ETCDError with a detail, like the json of the response, which is only appended to the
+     * message when the message is read, by getErrorMessage() or what()
+     */
+    ETCDError(long Code, const std::string& Message, std::string Detail);
+    ETCDError(long Code, long EtcdErrorCode, const std::string& Message, std::string Detail);
+    /**
+     * @brief ETCDError of a failed request: the code and the message of ec (of ETCDErrorCategory()),
+     * followed by the message of Cause, the error of the socket or of the resolver that made it fail
+     */
+    ETCDError(boost::system::error_code ec, boost::system::error_code Cause);
     long        getErrorCode() const;
     long        getEtcdErrorCode() const;
     std::string getErrorMessage() const;
     const char* what() const noexcept override;
 };
 
+/**
+ * @brief ETCDErrorCategory the category of error codes that carry the ETCDERROR_* values, used by the
+ * asynchronous, completion token based functions
+ */
+const boost::system::error_category& ETCDErrorCategory();
+boost::system::error_code            MakeETCDErrorCode(long code);
+
 #endif // ETCDERROR_H
@@ -0,0 +1,66 @@
+#ifndef ETCDIOSHARDS_H
+#define ETCDIOSHARDS_H
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+
+struct ETCDExecutionConfig
+{
+    // one io_context per thread instead of one io_context run by all the threads; the connections and
+    // the watches of a shard are only touched by its thread
+    bool sharded = false;
+    // with sharded, the thread of shard i is bound to core i (modulo the number of cores); Linux only
+    bool pinThreads = false;
+};
+
+/**
+ * @brief The ETCDIoShards class runs the io_contexts of a client: one io_context run by all the threads
+ * (one shard), or one io_context per thread (see ETCDExecutionConfig). With a thread per shard, the
+ * handlers of a shard don't contend with the other threads on the queue of their io_context, and the
+ * sessions of a shard don't move across cores.
+ *
+ * currentIndex() is the shard of the calling thread: its own shard on a thread of the shards, and a
+ * shard picked by the id of the thread otherwise, so that a thread keeps using the same shard.
+ */
+class ETCDIoShards
+{
+    using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+    struct Shard
+    {
+        boost::asio::io_context  ioc;
+        WorkGuard                work;
+        std::vector<std::thread> threads;
+
+        explicit Shard(int concurrencyHint);
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    void run(std::size_t index, bool pinThread);
+
+public:
+    ETCDIoShards(unsigned shardCount, unsigned threadsPerShard, bool pinThreads = false);
+    ~ETCDIoShards();
+    ETCDIoShards(const ETCDIoShards&) = delete;
+    ETCDIoShards& operator=(const ETCDIoShards&) = delete;
+
+    std::size_t              size() const;
+    boost::asio::io_context& at(std::size_t index);
+    std::size_t              currentIndex() const;
+    /**
+     * @brief isShardThread
+     * @return true on a thread of these shards
+     */
+    bool                     isShardThread() const;
+    boost::asio::io_context& current();
+    /**
+     * @brief stop lets the io_contexts run out of work and joins their threads
+     */
+    void stop();
+};
+
+#endif // ETCDIOSHARDS_H
@@ -0,0 +1,112 @@
+#ifndef ETCDLEASEKEEPER_H
+#define ETCDLEASEKEEPER_H
+
+#include "HttpSession.h"
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief The ETCDLeaseKeeper class keeps leases alive over one keep-alive stream: a lease is renewed a
+ * third of its TTL after its last renewal (like etcd's clientv3), by a small message on the stream, so
+ * thousands of leases cost one connection. Get it with ETCDClient::leaseKeepAlive().
+ *
+ * The renewals are scheduled on a timer wheel that ticks every tick, so adding, renewing and removing a
+ * lease is O(1) and a tick only looks at the leases due then. A renewal without an answer is sent again
+ * a third of the TTL later. A lease expires when etcd answers a renewal with a TTL of 0 (it was revoked
+ * or it expired), or when it wasn't renewed for its TTL, for instance while the stream reconnects; then
+ * its onExpired is called, on one of the threads of the client, and it isn't kept anymore.
+ *
+ * When the stream drops, it's reconnected with a jittered exponential backoff, and all the leases are
+ * renewed at once.
+ */
+class ETCDLeaseKeeper : public std::enable_shared_from_this<ETCDLeaseKeeper>
+{
+public:
+    using ExpiryCallback = std::function<void(uint64_t leaseId)>;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Lease
+    {
+        uint64_t          ttl = 0; // seconds
+        ExpiryCallback    onExpired;
+        Clock::time_point expiresAt;
+        uint64_t          generation = 0; // only the last scheduled renewal of the lease is due
+    };
+
+    struct WheelEntry
+    {
+        uint64_t leaseId;
+        uint64_t generation;
+        uint64_t rounds; // turns of the wheel before it's due
+    };
+
+    boost::asio::io_context&                   ioc_;
+    std::string                                host_;
+    std::string                                port_;
+    std::string                                target_;
+    std::chrono::milliseconds                  tick_;
+    std::mutex                                 mtx;
+    std::unordered_map<uint64_t, Lease>        leases;
+    std::vector<std::vector<WheelEntry>>       wheel;
+    std::size_t                                currentSlot = 0;
+    std::unique_ptr<boost::asio::steady_timer> tickTimer; // set while there are leases
+    std::shared_ptr<HttpSession>               session;
+    uint64_t                                   sessionId     = 0; // to ignore a dropped session
+    uint64_t                                   nextSessionId = 1;
+    std::shared_ptr<boost::asio::steady_timer> reconnectTimer; // set while reconnecting
+    unsigned                                   reconnectAttempts = 0;
+    bool                                       isClosed          = false;
+
+    std::chrono::milliseconds minReconnectDelay = std::chrono::milliseconds(50);
+    std::chrono::milliseconds maxReconnectDelay = std::chrono::seconds(5);
+
+    void        schedule(uint64_t leaseId, Lease& lease, std::chrono::milliseconds delay);
+    void        renew(uint64_t leaseId);
+    void        startTicking();
+    void        onTick();
+    void        startStream();
+    void        onMessage(boost::string_view message, uint64_t sessionId);
+    void        onStreamEnd(uint64_t sessionId);
+    void        reconnect();
+    static void CallExpired(std::vector<std::pair<uint64_t, ExpiryCallback>>& expired);
+
+public:
+    ETCDLeaseKeeper(boost::asio::io_context& ioc, const std::string& host, const std::string& port,
+                    const std::string&        target,
+                    std::chrono::milliseconds tick = std::chrono::milliseconds(100));
+    ~ETCDLeaseKeeper();
+    ETCDLeaseKeeper(const ETCDLeaseKeeper&) = delete;
+    ETCDLeaseKeeper& operator=(const ETCDLeaseKeeper&) = delete;
+
+    /**
+     * @brief add renews the lease of ttl seconds now, and then until it's removed or it expires. Adding
+     * a lease again replaces its ttl and onExpired
+     */
+    void add(uint64_t leaseId, uint64_t ttl, ExpiryCallback onExpired);
+    /**
+     * @brief remove stops renewing the lease; it expires at the end of its TTL unless it's revoked
+     */
+    void        remove(uint64_t leaseId);
+    bool        isKept(uint64_t leaseId);
+    std::size_t size();
+    /**
+     * @brief close stops the renewals and the stream; leases can't be added anymore
+     */
+    void close();
+    /**
+     * @brief setReconnectDelays sets the bounds of the backoff between the reconnections of the stream
+     */
+    void setReconnectDelays(std::chrono::milliseconds minDelay, std::chrono::milliseconds maxDelay);
+};
+
+#endif // ETCDLEASEKEEPER_H
@@ -0,0 +1,81 @@
+#ifndef ETCDLEASEPOOL_H
+#define ETCDLEASEPOOL_H
+
+#include "ETCDLeaseKeeper.h"
+#include "ETCDParsedResponse.h"
+#include <boost/system/error_code.hpp>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+
+class ETCDClient;
+
+/**
+ * @brief The ETCDLeasePool class keeps leases granted ahead of time, so that a key can be written with a
+ * lease in one request instead of a grant and then a put. The leases are grouped in buckets by TTL; each
+ * bucket keeps warmCount leases ready, kept alive by the lease keeper of the client, and grants new ones
+ * in the background as they're taken. The client owns its pool; enable a bucket with
+ * ETCDClient::enableLeasePool().
+ *
+ * checkOut() hands a lease of the bucket over to the caller: it stays kept alive until the caller
+ * revokes it (or stops its keep-alive). sharedLease() is one lease of the bucket for all the keys that
+ * live as long as the client: it's never handed over, and if it expires, another lease of the bucket
+ * replaces it. Without a ready lease, both grant one in the request, and refill the bucket, whose grants
+ * may have failed while etcd was out of reach.
+ *
+ * The leases still in the pool when the client stops expire after their TTL.
+ */
+class ETCDLeasePool
+{
+    // the pool lives as long as the client, which stops it before the lease keeper and the io threads
+    // that call it back
+    friend class ETCDClient;
+
+    struct Bucket
+    {
+        std::size_t          warmCount = 0;
+        std::deque<uint64_t> warm;        // granted and kept alive, ready to be taken
+        std::size_t          pending = 0; // grants in flight
+        uint64_t             shared  = 0;
+    };
+
+    ETCDClient*                client;
+    std::mutex                 mtx;
+    std::map<uint64_t, Bucket> buckets; // by TTL
+    bool                       isStopped = false;
+
+    void     refill(uint64_t ttl);
+    void     onGranted(uint64_t ttl, boost::system::error_code ec, const ETCDParsedResponse& response);
+    void     onExpired(uint64_t ttl, uint64_t leaseId);
+    void     keep(uint64_t ttl, uint64_t leaseId);
+    uint64_t grant(uint64_t ttl);
+
+    explicit ETCDLeasePool(ETCDClient& Client);
+
+public:
+    ETCDLeasePool(const ETCDLeasePool&) = delete;
+    ETCDLeasePool& operator=(const ETCDLeasePool&) = delete;
+
+    /**
+     * @brief addBucket keeps warmCount leases of ttl seconds ready; they're granted in the background
+     */
+    void addBucket(uint64_t ttl, std::size_t warmCount);
+    /**
+     * @brief checkOut takes a lease of ttl seconds out of the pool; onExpired is called if it expires
+     * while it's kept alive
+     */
+    uint64_t checkOut(uint64_t ttl, ETCDLeaseKeeper::ExpiryCallback onExpired);
+    /**
+     * @brief sharedLease is the lease of ttl seconds shared by the keys that live as long as the client
+     */
+    uint64_t sharedLease(uint64_t ttl);
+    /**
+     * @brief readyCount
+     * @return the number of leases of ttl seconds ready to be checked out
+     */
+    std::size_t readyCount(uint64_t ttl);
+    void        stop();
+};
+
+#endif // ETCDLEASEPOOL_H
@@ -1,24 +1,69 @@
 #ifndef ETCDPARSEDRESPONSE_H
 #define ETCDPARSEDRESPONSE_H
 
+#include "ETCDArena.h"
+#include <boost/functional/hash.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/utility/string_view.hpp>
 #include <cstdint>
 #include <jsoncpp/json/json.h>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 class ETCDParsedResponse
 {
-    std::string rawJsonString;
+    friend class ETCDResponseDecoder;
+    friend class ETCDReadCache;
 
 public:
+    /**
+     * @brief KVEntry is a key/value of a response. The key and the value point into the memory of the
+     * response they come from, which is shared by its copies; they're valid as long as one of them lives
+     */
     struct KVEntry
     {
-        std::string key;
-        std::string value;
-        std::string create_revision;
-        std::string mod_revision;
-        std::string version;
+        boost::string_view key;
+        boost::string_view value;
+        uint64_t           create_revision = 0;
+        uint64_t           mod_revision    = 0;
+        uint64_t           version         = 0;
+    };
+
+    using KVEntriesMap = std::unordered_map<boost::string_view, KVEntry, boost::hash<boost::string_view>>;
+
+    /**
+     * @brief Event is a change of a key, in a message of a watch
+     */
+    struct Event
+    {
+        enum class Type
+        {
+            Put,
+            Delete
+        };
+        Type    type = Type::Put;
+        KVEntry kv; // for a Delete, only the key and the mod_revision are set
+        bool    hasPrevKv = false;
+        KVEntry prevKv; // the key before the change, if the watch asked for it and it existed
+    };
+
+    /**
+     * @brief TxnResponse is the result of one operation of a transaction
+     */
+    struct TxnResponse
+    {
+        enum class Type
+        {
+            Put,
+            Range,
+            DeleteRange
+        };
+        Type                 type = Type::Put;
+        std::vector<KVEntry> kvEntries;        // for Range
+        uint64_t             deletedCount = 0; // for DeleteRange
     };
 
 private:
@@ -27,31 +72,117 @@ private:
     uint64_t revision  = 0;
     uint64_t raftTerm  = 0;
 
+    uint64_t count   = 0;
+    bool     more    = false;
+    uint64_t deleted = 0;
+
     uint64_t leaseId         = 0;
     uint64_t leaseTtl        = 0;
     uint64_t leaseGrantedTtl = 0;
 
-    std::vector<KVEntry>                     kvEntriesVec;
-    std::unordered_map<std::string, KVEntry> kvEntriesMap;
-    KVEntry                                  parseSingleKvEntry(const Json::Value& kvVal);
-    void                                     parse();
-    static void __verifyHeaderContent(const Json::Value& v, const std::string& vStr);
-    static void __verifyKVEntryContent(const Json::Value& kvVal);
-    static void __processIfError(const Json::Value& v);
+    bool                     txnSucceeded = false;
+    std::vector<TxnResponse> txnResponses;
+
+    uint64_t watchId         = 0;
+    bool     watchCreated    = false;
+    bool     watchCanceled   = false;
+    uint64_t compactRevision = 0;
+
+    // the entries and their keys and values; shared by the copies of the response
+    struct Storage
+    {
+        ETCDArena            arena;
+        std::vector<KVEntry> kvEntriesVec;
+        std::vector<Event>   events;
+        std::once_flag       kvEntriesMapBuilt; // the map is only built if it's asked for
+        KVEntriesMap         kvEntriesMap;
+        // the storages of the responses a concatenation points into
+        std::vector<std::shared_ptr<Storage>> parts;
+
+        explicit Storage(std::size_t arenaBlockSize) : arena(arenaBlockSize) {}
+    };
+    std::shared_ptr<Storage> storage;
+
+    void reset(std::size_t jsonSize);
+    void parse(boost::string_view rawJsonString);
+    bool parse(boost::string_view rawJsonString, boost::system::error_code& ec);
 
 public:
-    static std::string                              __jsonToString(const Json::Value& v);
+    static std::string __jsonToString(const Json::Value& v);
+    /**
+     * @brief Concat joins the kvs of range responses, in order, without copying them: the result keeps
+     * the memory of the parts alive. The header is that of the first part, the count is the sum
+     */
+    static ETCDParsedResponse Concat(std::vector<ETCDParsedResponse> parts);
+    /**
+     * @brief CoalesceEvents merges watch messages, in order, into one with the last event of each key,
+     * without copying them. The header is that of the last message, which covers the changes of all.
+     * The created and canceled messages of a watch are not to be merged: their flags would be lost
+     */
+    static ETCDParsedResponse CoalesceEvents(std::vector<ETCDParsedResponse> messages);
+
     const std::vector<ETCDParsedResponse::KVEntry>& getKVEntriesVec() const;
-    const std::unordered_map<std::string, KVEntry>& getKVEntriesMap() const;
-    ETCDParsedResponse(const std::string RawJsonString = "");
+    const KVEntriesMap&                             getKVEntriesMap() const;
+    /**
+     * @brief getEvents
+     * @return the events of a watch message, in order; their kvs are also in getKVEntriesVec()
+     */
+    const std::vector<Event>& getEvents() const;
+    ETCDParsedResponse(boost::string_view RawJsonString = boost::string_view());
+    /**
+     * @brief ETCDParsedResponse with an error code decodes without throwing, for the errors etcd returns
+     * (see ETCDResponseDecoder); on an error, ec is set and the response is empty. The message of the
+     * error is formatted only by decoding the json again with the other constructor
+     */
+    ETCDParsedResponse(boost::string_view RawJsonString, boost::system::error_code& ec);
     uint64_t getRaftTerm() const;
     uint64_t getRevision() const;
     uint64_t getMemberId() const;
     uint64_t getClusterId() const;
 
+    /**
+     * @brief getCount
+     * @return the number of keys in the range of a range response, whatever its limit
+     */
+    uint64_t getCount() const;
+    /**
+     * @brief isMore
+     * @return true if the range had more keys than the limit of the request
+     */
+    bool isMore() const;
+    /**
+     * @brief getDeletedCount
+     * @return the number of keys a deleterange response deleted
+     */
+    uint64_t getDeletedCount() const;
+
     uint64_t getLeaseId() const;
     uint64_t getTTL() const;
     uint64_t getGrantedTTL() const;
+
+    bool                            isTxnSucceeded() const;
+    const std::vector<TxnResponse>& getTxnResponses() const;
+
+    /**
+     * @brief getWatchId
+     * @return the id of the watch a message of a watch stream belongs to, given by etcd on creation
+     */
+    uint64_t getWatchId() const;
+    /**
+     * @brief isWatchCreated
+     * @return true for the message that confirms the creation of a watch
+     */
+    bool isWatchCreated() const;
+    /**
+     * @brief isWatchCanceled
+     * @return true for the last message of a watch, when it was canceled by the client or by etcd
+     */
+    bool isWatchCanceled() const;
+    /**
+     * @brief getCompactRevision
+     * @return if a watch was canceled because its start revision was compacted, the compaction revision
+     */
+    uint64_t getCompactRevision() const;
 };
 
 #endif // ETCDPARSEDRESPONSE_H
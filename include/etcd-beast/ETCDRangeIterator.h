@@ -0,0 +1,57 @@
+#ifndef ETCDRANGEITERATOR_H
+#define ETCDRANGEITERATOR_H
+
+#include "ETCDResponse.h"
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ETCDClient;
+
+/**
+ * @brief The ETCDRangeIterator class reads the keys of a prefix a page at a time, with range requests of
+ * at most pageSize keys that continue after the last key of the previous page. The next page is requested
+ * as soon as the current one arrives, so it's read while the current one is used; only these two pages are
+ * in memory. Get one with ETCDClient::getAllPaginated().
+ *
+ *     ETCDRangeIterator it = client.getAllPaginated("/big/", 1000);
+ *     while (it.next()) {
+ *         for (const ETCDParsedResponse::KVEntry& kv : it.getKVEntriesVec()) { ... }
+ *     }
+ *
+ * All the pages are read at the revision of the first one, so they're a consistent view of the prefix;
+ * if that revision is compacted before the last page is read, next() throws the error of etcd.
+ */
+class ETCDRangeIterator
+{
+    ETCDClient*                   client;
+    std::string                   prefix_;
+    std::size_t                   pageSize_;
+    uint64_t                      revision = 0;
+    boost::optional<ETCDResponse> current;
+    boost::optional<ETCDResponse> prefetched;
+    bool                          isStarted = false;
+
+    ETCDResponse requestPage(const std::string& fromKey);
+    void         prefetchNextPage();
+
+public:
+    ETCDRangeIterator(ETCDClient& Client, const std::string& prefix, std::size_t pageSize);
+    ETCDRangeIterator(ETCDRangeIterator&&) = default;
+    ETCDRangeIterator& operator=(ETCDRangeIterator&&) = default;
+
+    /**
+     * @brief next waits for the next page; the entries of the previous one aren't valid anymore
+     * @return false once all the keys were read
+     */
+    bool next();
+    const std::vector<ETCDParsedResponse::KVEntry>& getKVEntriesVec();
+    /**
+     * @brief getRevision
+     * @return the revision all the pages are read at, once the first page arrived
+     */
+    uint64_t getRevision() const;
+};
+
+#endif // ETCDRANGEITERATOR_H
@@ -0,0 +1,52 @@
+#ifndef ETCDRANGEOPTIONS_H
+#define ETCDRANGEOPTIONS_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief ETCDRangeOptions are the options of a range request (ETCDClient::get() and getAll()). The
+ * defaults are those of etcd, so a default ETCDRangeOptions reads like get() and getAll() without options
+ */
+struct ETCDRangeOptions
+{
+    enum class SortOrder
+    {
+        None,
+        Ascend,
+        Descend
+    };
+    enum class SortTarget
+    {
+        Key,
+        Version,
+        Create,
+        Mod,
+        Value
+    };
+
+    // get() reads the keys in [key, rangeEnd) instead of the key; "\0" reads all the keys from the key
+    // on. getAll() ignores it
+    std::string rangeEnd;
+    // return the keys without their values
+    bool keysOnly = false;
+    // return only the number of keys in the range, given by ETCDResponse::getCount()
+    bool countOnly = false;
+    // return at most limit keys; ETCDResponse::isMore() tells if there were more. 0 is no limit
+    uint64_t limit = 0;
+    // without a sort order, the keys are sorted by key, ascending
+    SortOrder  sortOrder  = SortOrder::None;
+    SortTarget sortTarget = SortTarget::Key;
+    // read the keys as they were at this revision (must not be compacted); 0 is the current revision
+    uint64_t revision = 0;
+    // keep only the keys with a mod/create revision in these bounds; 0 is no bound
+    uint64_t minModRevision    = 0;
+    uint64_t maxModRevision    = 0;
+    uint64_t minCreateRevision = 0;
+    uint64_t maxCreateRevision = 0;
+    // read from the member that gets the request, without going through the leader: faster, but the
+    // member may be behind the cluster
+    bool serializable = false;
+};
+
+#endif // ETCDRANGEOPTIONS_H
@@ -0,0 +1,99 @@
+#ifndef ETCDREADCACHE_H
+#define ETCDREADCACHE_H
+
+#include "ETCDParsedResponse.h"
+#include "ETCDWatch.h"
+#include <atomic>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+
+class ETCDClient;
+
+/**
+ * @brief The ETCDReadCache class keeps the keys of a prefix in memory: they're read once, then kept
+ * current by a watch of the prefix that starts right after the revision of the read. Get one with
+ * ETCDClient::enableReadCache().
+ *
+ * A cached response is the state of the prefix at its getRevision(): all the changes up to that revision
+ * are in it, and none after. The cache answers only while its watch is live, and once it got the changes
+ * of the writes this client made in the prefix (read-your-writes); otherwise the reads go to the server.
+ * If the revision to resume the watch from was compacted, the prefix is read again.
+ */
+class ETCDReadCache
+{
+    struct Entry
+    {
+        std::string value;
+        uint64_t    create_revision = 0;
+        uint64_t    mod_revision    = 0;
+        uint64_t    version         = 0;
+    };
+
+    ETCDClient*                                client;
+    std::string                                prefix_;
+    mutable std::shared_timed_mutex            mtx;
+    std::map<std::string, Entry>               entries; // ordered like the keys of a range response
+    uint64_t                                   revision  = 0;
+    uint64_t                                   clusterId = 0;
+    uint64_t                                   memberId  = 0;
+    uint64_t                                   raftTerm  = 0;
+    bool                                       isLoaded  = false;
+    bool                                       isStopped = false;
+    std::unique_ptr<ETCDWatch>                 watch;
+    std::atomic<uint64_t>                      minRevision{0}; // of the last write of the client in it
+    std::unique_ptr<boost::asio::steady_timer> retryTimer;
+
+    void load(const ETCDParsedResponse& range);
+    void onMessage(const ETCDParsedResponse& message);
+    void reload();
+    /**
+     * @brief startWatch replaces the watch by one from the revision after the loaded one; the returned
+     * old watch must be destroyed without holding the lock, since its callback takes it
+     */
+    std::unique_ptr<ETCDWatch> startWatch();
+
+public:
+    ETCDReadCache(ETCDClient& Client, const std::string& prefix);
+    ~ETCDReadCache();
+    ETCDReadCache(const ETCDReadCache&) = delete;
+    ETCDReadCache& operator=(const ETCDReadCache&) = delete;
+
+    /**
+     * @brief start reads the prefix and watches it; it blocks until the cache can answer
+     */
+    void start();
+    void stop();
+
+    const std::string& getPrefix() const;
+    /**
+     * @brief covers
+     * @return true if key, and so all the keys of the prefix key, are in the prefix of the cache
+     */
+    bool covers(boost::string_view key) const;
+    /**
+     * @brief overlaps
+     * @return true if writing key (or the prefix key, if isRange) may change keys of the prefix of the
+     * cache
+     */
+    bool overlaps(boost::string_view key, bool isRange) const;
+
+    /**
+     * @brief read answers a get of key, or a getAll of the prefix key if isRange, from memory
+     * @return false if the cache can't answer now: it's loading, its watch is down or it's behind the
+     * writes of the client
+     */
+    bool read(const std::string& key, bool isRange, ETCDParsedResponse& out) const;
+    /**
+     * @brief noteWrite tells the cache that a write of the client changed its prefix at revision; the
+     * cache doesn't answer until its watch got that revision
+     */
+    void     noteWrite(uint64_t revision);
+    uint64_t getRevision() const;
+};
+
+#endif // ETCDREADCACHE_H
@@ -0,0 +1,40 @@
+#ifndef ETCDREQUESTBODY_H
+#define ETCDREQUESTBODY_H
+
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief The ETCDRequestBody class serializes the json body of a request. Keys, values and range ends
+ * are base64-encoded directly into a buffer that is reused by every body built on the same thread, so
+ * that building a body allocates once, for the returned string, whatever the size of its content.
+ *
+ *     std::string body = ETCDRequestBody().raw(R"({"key": ")").base64(key).raw(R"("})").str();
+ */
+class ETCDRequestBody
+{
+    std::string  ownBuffer; // used if the buffer of the thread is taken by another body
+    std::string* buffer;
+    bool         usesThreadBuffer;
+
+public:
+    ETCDRequestBody();
+    ~ETCDRequestBody();
+    ETCDRequestBody(const ETCDRequestBody&) = delete;
+    ETCDRequestBody& operator=(const ETCDRequestBody&) = delete;
+
+    ETCDRequestBody& raw(boost::string_view text);
+    ETCDRequestBody& base64(boost::string_view data);
+    /**
+     * @brief base64RangeEnd appends the base64 of the range end that covers all the keys starting with
+     * prefix, computed like etcd's clientv3.GetPrefixRangeEnd: trailing 0xff bytes are dropped and the
+     * last byte is incremented. If nothing is left, the range end is "\0", meaning no end
+     */
+    ETCDRequestBody& base64RangeEnd(boost::string_view prefix);
+    ETCDRequestBody& number(uint64_t value);
+
+    std::string str() const;
+};
+
+#endif // ETCDREQUESTBODY_H
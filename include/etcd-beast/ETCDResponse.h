@@ -9,35 +9,84 @@
 #include <memory>
 
 #include "ETCDParsedResponse.h"
+#include "HttpSession.h"
 
 class ETCDResponse
 {
 private:
-    mutable std::shared_future<boost::beast::http::response<boost::beast::http::string_body>> response;
+    // the response is moved out of the future once, so its body is never copied on the way
+    std::future<HttpSession::Result> response;
 
     bool                                                          isParsed          = false;
     bool                                                          isFutureRetrieved = false;
+    bool                                                          isCached          = false;
     void                                                          parse();
+    void                                                          retrieve();
     boost::beast::http::response<boost::beast::http::string_body> rawResponse;
+    // set by wait() with an error code, which doesn't throw
+    boost::system::error_code error;
+    // the failure of the request and its cause; only the throwing functions make an ETCDError of it
+    boost::system::error_code failure;
+    boost::system::error_code failureCause;
 
     ETCDParsedResponse parsedData;
 
 public:
     const std::vector<ETCDParsedResponse::KVEntry>&                     getKVEntriesVec();
-    const std::unordered_map<std::string, ETCDParsedResponse::KVEntry>& getKVEntriesMap();
-    std::string                                                         getJsonResponse();
+    const ETCDParsedResponse::KVEntriesMap&                             getKVEntriesMap();
+    const std::string&                                                  getJsonResponse();
 
-    ETCDResponse(
-        std::shared_future<boost::beast::http::response<boost::beast::http::string_body>> Response);
+    ETCDResponse(std::future<HttpSession::Result> Response);
+    /**
+     * @brief ETCDResponse is a response without a request of its own, answered from a read cache
+     * (FromCache) or merged from other responses; it has no json
+     */
+    explicit ETCDResponse(ETCDParsedResponse Parsed, bool FromCache = true);
+    ETCDResponse(ETCDResponse&&) = default;
+    ETCDResponse& operator=(ETCDResponse&&) = default;
 
-    ETCDResponse& wait();
+    /**
+     * @brief wait blocks until the response arrived. On a temporary, it returns an rvalue so that
+     * `ETCDResponse r = client.get(key).wait();` moves the response instead of copying it
+     */
+    ETCDResponse&  wait() &;
+    ETCDResponse&& wait() &&;
+    /**
+     * @brief wait with an error code blocks until the response arrived and decodes it, without throwing
+     * for an error etcd returned: ec is one of the ETCDERROR_* values, of ETCDErrorCategory(). The
+     * message of the error isn't formatted; the getters throw it, with the json, if they're called
+     * anyway
+     */
+    ETCDResponse&  wait(boost::system::error_code& ec) &;
+    ETCDResponse&& wait(boost::system::error_code& ec) &&;
     std::size_t   kvCount();
+    /**
+     * @brief isFromCache
+     * @return true if the response was answered from a read cache (see ETCDClient::enableReadCache)
+     */
+    bool isFromCache() const;
 
     uint64_t getRaftTerm();
     uint64_t getRevision();
     uint64_t getMemberId();
     uint64_t getClusterId();
 
+    /**
+     * @brief getCount
+     * @return the number of keys in the range of a get or getAll, whatever the limit of the request
+     */
+    uint64_t getCount();
+    /**
+     * @brief isMore
+     * @return true if the range had more keys than the limit of the request
+     */
+    bool isMore();
+    /**
+     * @brief getDeletedCount
+     * @return the number of keys a del or delAll deleted
+     */
+    uint64_t getDeletedCount();
+
     uint64_t getLeaseId();
     /**
      * @brief getTTL
@@ -49,6 +98,17 @@ public:
      * @return granted ttl, response to TimeToLive call
      */
     uint64_t getGrantedTTL();
+
+    /**
+     * @brief isTxnSucceeded
+     * @return true if all the compares of a transaction passed, so its success branch ran
+     */
+    bool isTxnSucceeded();
+    /**
+     * @brief getTxnResponses
+     * @return the result of every operation of the transaction branch that ran, in order
+     */
+    const std::vector<ETCDParsedResponse::TxnResponse>& getTxnResponses();
 };
 
 #endif // ETCDRESPONSE_H
@@ -0,0 +1,83 @@
+#ifndef ETCDRESPONSEDECODER_H
+#define ETCDRESPONSEDECODER_H
+
+#include "ETCDParsedResponse.h"
+#include <boost/system/error_code.hpp>
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief The ETCDResponseDecoder class decodes a json response of the etcd gateway in a single pass over
+ * the text, without building a json tree. Header fields, lease fields, kvs, watch events and transaction
+ * responses are written directly into the ETCDParsedResponse, and keys and values are base64-decoded
+ * straight into the arena of the response. Members the decoder doesn't know are skipped, and the
+ * "result" wrapper of watch stream messages is decoded like a top level response.
+ */
+class ETCDResponseDecoder
+{
+    const char* const begin;
+    const char*       cur;
+    const char* const end;
+
+    std::string stringScratch; // unescaped strings, only used when a string has escape sequences
+    ETCDArena*  arena = nullptr;
+
+    bool        hasHeader     = false;
+    bool        hasClusterId  = false;
+    bool        hasMemberId   = false;
+    bool        hasRevision   = false;
+    bool        hasRaftTerm   = false;
+    bool        hasLeaseId    = false;
+    uint64_t    leaseId       = 0;
+    uint64_t    leaseTtl      = 0;
+    bool        isError       = false;
+    long        etcdErrorCode = -1;
+    std::string errorMessage;
+
+    [[noreturn]] void fail(const std::string& what) const;
+    void              skipWhitespace();
+    char              peek();
+    void              expect(char c);
+    bool              consumeIf(char c);
+    boost::string_view readString();
+    void               readStringInto(std::string& target);
+    boost::string_view readBase64();
+    uint64_t           readUInt64();
+    bool               readBool();
+    void               skipString();
+    void               skipValue();
+    void               appendCodePoint(uint32_t codePoint);
+    uint32_t           readHex4();
+
+    template <typename MemberHandler>
+    void forEachMember(MemberHandler&& onMember);
+    template <typename ElementHandler>
+    void forEachElement(ElementHandler&& onElement);
+
+    void decodeMembers(ETCDParsedResponse& out);
+    void decodeHeader(ETCDParsedResponse& out);
+    void decodeKVEntry(ETCDParsedResponse::KVEntry& kv, bool isEvent);
+    void decodeKVEntries(std::vector<ETCDParsedResponse::KVEntry>& kvs);
+    void decodeEvents(ETCDParsedResponse& out);
+    void decodeTxnResponses(ETCDParsedResponse& out);
+    void decodeMessage(ETCDParsedResponse& out);
+    long errorCode() const;
+    void verify() const;
+
+public:
+    explicit ETCDResponseDecoder(boost::string_view json);
+    /**
+     * @brief decodeInto fills the header, lease, kv and txn fields of out. Throws ETCDError if the json is
+     * malformed, if etcd returned an error or if the header is incomplete
+     */
+    void decodeInto(ETCDParsedResponse& out);
+    /**
+     * @brief decodeInto with an error code doesn't throw for an error returned by etcd, an incomplete
+     * header or a message that isn't a json object; ec tells the error, without its message. Only
+     * malformed json is still thrown, and caught, on the way
+     */
+    bool decodeInto(ETCDParsedResponse& out, boost::system::error_code& ec);
+};
+
+#endif // ETCDRESPONSEDECODER_H
@@ -0,0 +1,74 @@
+#ifndef ETCDTRANSACTION_H
+#define ETCDTRANSACTION_H
+
+#include "ETCDResponse.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ETCDClient;
+class ETCDRequestBody;
+
+/**
+ * @brief The ETCDTransaction class packs many put/range/deleterange operations, guarded by optional
+ * compares, into a single /kv/txn request. Get one with ETCDClient::txn().
+ *
+ * Operations run in the success branch, unless onFailure() was called before adding them; then they run
+ * only if any of the compares fails. The result of every operation is found, in order, in
+ * ETCDResponse::getTxnResponses() of the branch that ran.
+ *
+ * Note that etcd limits the number of operations per transaction (--max-txn-ops, 128 by default), and
+ * rejects transactions that put/delete the same key more than once.
+ */
+class ETCDTransaction
+{
+public:
+    enum class Compare
+    {
+        Equal,
+        NotEqual,
+        Greater,
+        Less
+    };
+
+private:
+    ETCDClient*              client;
+    std::vector<std::string> compares;
+    std::vector<std::string> successOps;
+    std::vector<std::string> failureOps;
+    bool                     addingToFailure = false;
+
+    static const char*      CompareToString(Compare c);
+    static ETCDRequestBody& CompareHead(ETCDRequestBody& body, const std::string& key, Compare result,
+                                        const char* target, const char* field);
+
+    ETCDTransaction& addCompare(const std::string& key, Compare result, const char* target,
+                                const char* field, uint64_t value);
+    ETCDTransaction& addOperation(std::string op);
+
+public:
+    explicit ETCDTransaction(ETCDClient* Client);
+
+    ETCDTransaction& ifVersion(const std::string& key, Compare result, uint64_t version);
+    ETCDTransaction& ifCreateRevision(const std::string& key, Compare result, uint64_t revision);
+    ETCDTransaction& ifModRevision(const std::string& key, Compare result, uint64_t revision);
+    ETCDTransaction& ifValue(const std::string& key, Compare result, const std::string& value);
+    ETCDTransaction& ifLease(const std::string& key, Compare result, uint64_t leaseID);
+
+    ETCDTransaction& put(const std::string& key, const std::string& value, uint64_t leaseID = 0);
+    ETCDTransaction& get(const std::string& key);
+    ETCDTransaction& getAll(const std::string& prefix);
+    ETCDTransaction& del(const std::string& key);
+    ETCDTransaction& delAll(const std::string& prefix);
+
+    /**
+     * @brief onFailure operations added after this call run only if a compare fails
+     */
+    ETCDTransaction& onFailure();
+
+    std::size_t  operationsCount() const;
+    std::string  toJson() const;
+    ETCDResponse commit();
+};
+
+#endif // ETCDTRANSACTION_H
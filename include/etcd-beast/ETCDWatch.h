@@ -4,21 +4,56 @@
 #include "HttpSession.h"
 #include <memory>
 #include "ETCDResponse.h"
+#include "ETCDWatchMultiplexer.h"
 
 class ETCDWatch
 {
-    std::shared_ptr<HttpSession> httpSession;
-    std::function<void(ETCDParsedResponse)> callback_;
-    std::string keyBase64_;
-    std::shared_future<boost::beast::http::response<boost::beast::http::string_body>> firstResponse;
+    boost::asio::io_context*     ioc_ = nullptr;
+    boost::asio::any_io_executor callbackExecutor_;
+
+    // a watch that doesn't share a stream with other watches runs on a multiplexer of its own, so that it
+    // resumes the same way when its connection drops
+    std::shared_ptr<ETCDWatchMultiplexer>        multiplexer;
+    bool                                         ownsMultiplexer = false;
+    uint64_t                                     multiplexedId   = 0;
+    std::shared_future<void>                     created;
+    std::shared_ptr<const std::atomic_bool>      live;
+    std::shared_ptr<const std::atomic<uint64_t>> dropped;
 
-    void convertJsonToETCDParsedResponse(Json::Value v);
 public:
-    ETCDWatch(boost::asio::io_context& ioc);
-    void run(const std::string& keyBase64, const std::string& address, uint16_t port,
-             std::function<void(ETCDParsedResponse)> callback);
+    /**
+     * @brief ETCDWatch for run(); with a callbackExecutor, the callback is called on it (see
+     * ETCDWatchMultiplexer::setCallbackExecutor())
+     */
+    ETCDWatch(boost::asio::io_context&     ioc,
+              boost::asio::any_io_executor callbackExecutor = boost::asio::any_io_executor());
+    ETCDWatch(std::shared_ptr<ETCDWatchMultiplexer> Multiplexer, const std::string& key,
+              const ETCDWatchOptions& options, std::function<void(ETCDParsedResponse)> callback);
+    /**
+     * @brief run opens a watch stream of its own at target (the version prefix of the client followed by
+     * "/watch") and creates the watch of key on it
+     */
+    void run(const std::string& key, const ETCDWatchOptions& options, const std::string& address,
+             uint16_t port, const std::string& target, std::function<void(ETCDParsedResponse)> callback);
     void cancel();
+    /**
+     * @brief wait blocks until etcd created the watch; it throws the ETCDError of a watch canceled or
+     * closed before, rejected by etcd, or whose stream failed to connect several times in a row (see
+     * ETCDWatchMultiplexer::add())
+     */
     void wait();
+    /**
+     * @brief isLive
+     * @return true while the watch is created and its stream is up, so that it gets the changes as they
+     * happen; false before its creation, while its stream reconnects, and once it's canceled
+     */
+    bool isLive() const;
+    /**
+     * @brief droppedCount
+     * @return the number of messages dropped because the queue of the watch was full (see
+     * ETCDWatchOptions::overflow)
+     */
+    uint64_t droppedCount() const;
     ~ETCDWatch();
 };
 
@@ -0,0 +1,200 @@
+#ifndef ETCDWATCHMULTIPLEXER_H
+#define ETCDWATCHMULTIPLEXER_H
+
+#include "ETCDError.h"
+#include "ETCDParsedResponse.h"
+#include "HttpSession.h"
+#include <atomic>
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ETCDWatchOptions
+{
+    enum class Overflow
+    {
+        Block,    // stop reading the stream of the watch until the queue has room
+        Coalesce, // merge the queued messages into one, with the last event of each key
+        Drop      // drop the message, counted by ETCDWatch::droppedCount()
+    };
+
+    // watch all the keys starting with the key; rangeEnd is ignored
+    bool prefix = false;
+    // watch the keys in [key, rangeEnd); "\0" watches all the keys from the key on
+    std::string rangeEnd;
+    // replay the changes from this revision on (must not be compacted); 0 starts from the next change
+    uint64_t startRevision = 0;
+    // the events carry the key as it was before the change
+    bool prevKv = false;
+    // etcd sends an empty message with the current revision when the watch is idle for a while
+    bool progressNotify = false;
+    // filter the events out on the server
+    bool noPut    = false;
+    bool noDelete = false;
+    // with a callback executor (see ETCDWatchMultiplexer::setCallbackExecutor()), the messages wait for
+    // the callback in a queue of at most queueSize messages; overflow is what happens to a message that
+    // finds the queue full
+    std::size_t queueSize = 1024;
+    Overflow    overflow  = Overflow::Block;
+};
+
+/**
+ * @brief The ETCDWatchMultiplexer class runs many watches over a few watch streams, instead of one
+ * connection per watch. Create and cancel requests are written on a stream while it runs, and the messages
+ * of the stream are dispatched to the callback of their watch by watch id.
+ *
+ * etcd confirms the creations of a stream in the order of the requests, so the id of a watch is taken from
+ * its creation message; this works with the versions of etcd that don't accept ids from the client.
+ *
+ * When a stream drops, it's reconnected with a jittered exponential backoff and its watches are created
+ * again from the revision after the last one they got, so that no change is lost or repeated. The new
+ * creations are not given to the callbacks. If that revision was compacted meanwhile, etcd cancels the
+ * watch: the callback gets the message with getCompactRevision() set, and the keys must be read again.
+ *
+ * The callbacks are called on the thread that reads the stream, unless a callback executor is set: then
+ * the messages of each watch are queued and its callback is called on the executor, one message at a
+ * time, so that a slow callback doesn't hold the io threads. The queue of a watch is bounded; see
+ * ETCDWatchOptions::overflow. The created and canceled messages are never dropped. A full queue with the
+ * Block overflow pauses the reads of its stream, not an io thread: the other watches of the stream wait
+ * too, and the messages already read are still queued.
+ */
+class ETCDWatchMultiplexer : public std::enable_shared_from_this<ETCDWatchMultiplexer>
+{
+public:
+    using Callback = std::function<void(ETCDParsedResponse)>;
+
+private:
+    struct Watch
+    {
+        uint64_t             id;
+        std::string          key;
+        ETCDWatchOptions     options;
+        Callback             callback;
+        std::promise<void>   created;
+        std::size_t          stream;
+        uint64_t             watchId           = 0; // given by etcd
+        bool                 isCreated         = false;
+        bool                 wasCreated        = false; // on a stream before a reconnection
+        bool                 isCreationSettled = false; // created was set or failed
+        bool                 hasLastRevision   = false;
+        uint64_t             lastRevision      = 0; // the changes up to this revision were given
+        std::atomic_bool     cancelRequested{false};
+        std::atomic_bool     isLive{false}; // created on a stream that is up
+        std::recursive_mutex callbackMtx; // held while the callback runs, so that cancel() waits for it
+
+        // the messages waiting for the callback, with a callback executor
+        std::mutex                     queueMtx;
+        std::deque<ETCDParsedResponse> queue;
+        bool                           isDelivering     = false; // a handler of the executor drains it
+        bool                           isBlockingStream = false; // a full queue with the Block overflow
+        std::atomic<uint64_t>          dropped{0};
+    };
+
+    struct Stream
+    {
+        std::shared_ptr<HttpSession>                         session;
+        uint64_t                                             sessionId = 0; // to ignore a dropped session
+        std::deque<std::shared_ptr<Watch>>                   pendingCreations; // in the order of the requests
+        std::unordered_map<uint64_t, std::shared_ptr<Watch>> watches;          // by etcd watch id
+        std::size_t                                          watchCount = 0;
+        std::shared_ptr<boost::asio::steady_timer>           reconnectTimer; // set while reconnecting
+        unsigned                                             reconnectAttempts = 0;
+        std::size_t                                          blockingWatches   = 0; // not read while > 0
+    };
+
+    boost::asio::io_context& ioc_;
+    std::string              host_;
+    std::string              port_;
+    std::string              target_;
+    std::mutex               mtx;
+    std::vector<Stream>      streams;
+    std::unordered_map<uint64_t, std::shared_ptr<Watch>> watchesById;
+    uint64_t                                             nextId        = 1;
+    uint64_t                                             nextSessionId = 1;
+    bool                                                 isClosed      = false;
+    boost::asio::any_io_executor                         callbackExecutor; // empty: the reading thread
+
+    std::chrono::milliseconds minReconnectDelay = std::chrono::milliseconds(50);
+    std::chrono::milliseconds maxReconnectDelay = std::chrono::seconds(5);
+
+    // the failed connections in a row after which the watches of a stream that aren't created yet fail
+    // their creation; they keep being retried
+    static const unsigned CREATION_ATTEMPTS = 5;
+
+    std::size_t pickStream();
+    void        startStream(std::size_t index);
+    void        writeCreateRequest(Stream& stream, const std::shared_ptr<Watch>& watch);
+    void        onMessage(std::size_t index, boost::string_view message, uint64_t sessionId);
+    void        failPendingCreation(std::size_t index, uint64_t sessionId, const ETCDError& error);
+    void        onStreamEnd(std::size_t index, uint64_t sessionId, boost::system::error_code ec);
+    void        reconnect(std::size_t index);
+    void        deliver(const std::shared_ptr<Watch>& watch, ETCDParsedResponse message,
+                        const boost::asio::any_io_executor& executor);
+    void        updateBlocking(Stream& stream, Watch& watch);
+    static void Drain(const std::weak_ptr<ETCDWatchMultiplexer>& weakSelf,
+                      const std::shared_ptr<Watch>& watch, const boost::asio::any_io_executor& executor);
+    static std::string CancelRequest(uint64_t watchId);
+    static void        FailCreation(Watch& watch, const ETCDError& error);
+
+public:
+    ETCDWatchMultiplexer(boost::asio::io_context& ioc, const std::string& host, const std::string& port,
+                         const std::string& target, unsigned streamCount);
+    ~ETCDWatchMultiplexer();
+    ETCDWatchMultiplexer(const ETCDWatchMultiplexer&) = delete;
+    ETCDWatchMultiplexer& operator=(const ETCDWatchMultiplexer&) = delete;
+
+    /**
+     * @brief CreateRequest is the json of the create_request of a watch of key
+     */
+    static std::string CreateRequest(const std::string& key, const ETCDWatchOptions& options);
+
+    /**
+     * @brief add writes the create request on the stream with the fewest watches. The callback is called
+     * with every message of the watch, starting with its creation; created is ready once etcd created
+     * it. It fails with an ETCDError if the watch is canceled or the multiplexer closed before, or if
+     * the stream failed CREATION_ATTEMPTS times in a row; the watch is still created when it's back.
+     * If etcd rejects the create request, created fails with its error and the watch is canceled
+     * @return the id to cancel the watch with
+     */
+    uint64_t add(const std::string& key, const ETCDWatchOptions& options, Callback callback,
+                 std::shared_future<void>& created);
+    /**
+     * @brief cancel stops calling the callback of the watch and cancels it in etcd
+     */
+    void cancel(uint64_t id);
+    /**
+     * @brief liveness is true while the watch is created on a stream that is up; it's false before the
+     * creation, while its stream reconnects, and once the watch is canceled
+     */
+    std::shared_ptr<const std::atomic_bool> liveness(uint64_t id);
+    /**
+     * @brief droppedCount counts the messages of the watch dropped by the Drop overflow
+     */
+    std::shared_ptr<const std::atomic<uint64_t>> droppedCount(uint64_t id);
+    /**
+     * @brief close cancels the streams; watches can't be added anymore
+     */
+    void        close();
+    std::size_t streamCount() const;
+    /**
+     * @brief setReconnectDelays sets the bounds of the backoff between the reconnections of a stream
+     */
+    void setReconnectDelays(std::chrono::milliseconds minDelay, std::chrono::milliseconds maxDelay);
+    /**
+     * @brief setCallbackExecutor calls the callbacks on executor instead of the thread that reads the
+     * stream
+     */
+    void setCallbackExecutor(boost::asio::any_io_executor executor);
+};
+
+#endif // ETCDWATCHMULTIPLEXER_H
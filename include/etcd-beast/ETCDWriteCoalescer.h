@@ -0,0 +1,60 @@
+#ifndef ETCDWRITECOALESCER_H
+#define ETCDWRITECOALESCER_H
+
+#include "HttpSessionPool.h"
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief The ETCDWriteCoalescer class merges puts that arrive within a short window into a single /kv/txn
+ * request. Every put still gets its own response, which looks like the response of a single put.
+ *
+ * A batch is sent when the window passes since its first put, when it reaches the maximum size, or when
+ * a put for a key that is already in the batch arrives (etcd doesn't accept a key twice in a
+ * transaction). If etcd rejects the batch, its puts are sent again one by one, so that only the failing
+ * put gets the error.
+ */
+class ETCDWriteCoalescer
+{
+    using Response = boost::beast::http::response<boost::beast::http::string_body>;
+
+    struct PendingPut
+    {
+        std::string                  key;
+        std::string                  body; // the json of a single put request
+        HttpSession::ResponseHandler handler;
+    };
+
+    HttpSessionPool&                pool;
+    std::string                     putTarget;
+    std::string                     txnTarget;
+    std::chrono::microseconds       window;
+    std::size_t                     maxBatchSize;
+    std::mutex                      mtx;
+    std::vector<PendingPut>         batch;
+    std::unordered_set<std::string> batchKeys;
+    boost::asio::steady_timer       flushTimer;
+    uint64_t                        batchNumber = 0;
+
+    std::vector<PendingPut> takeBatch();
+    void                    sendBatch(std::vector<PendingPut> puts);
+    void                    sendIndividually(std::vector<PendingPut> puts);
+
+public:
+    ETCDWriteCoalescer(boost::asio::io_context& ioc, HttpSessionPool& Pool, const std::string& versionPrefix,
+                       std::chrono::microseconds Window, std::size_t MaxBatchSize);
+
+    std::future<HttpSession::Result> put(const std::string& key, std::string putBody);
+    void put(const std::string& key, std::string putBody, HttpSession::ResponseHandler handler);
+    /**
+     * @brief flush sends the current batch without waiting for the window to pass
+     */
+    void flush();
+};
+
+#endif // ETCDWRITECOALESCER_H
@@ -3,6 +3,7 @@
 
 #include "JsonStringParserQueue.h"
 #include <algorithm>
+#include <atomic>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/asio/connect.hpp>
@@ -11,7 +12,10 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/optional.hpp>
+#include <chrono>
 #include <cstdlib>
+#include <deque>
 #include <future>
 #include <iostream>
 #include <memory>
@@ -20,7 +24,34 @@
 
 class HttpSession : public std::enable_shared_from_this<HttpSession>
 {
-    struct CancelMessageData
+public:
+    /**
+     * Called with the response of a request; if the request failed, the error code is set (one of the
+     * ETCDERROR_* values, of ETCDErrorCategory()), the cause is the error of the socket or of the
+     * resolver that made it fail, if any, and the response is empty
+     */
+    using ResponseHandler =
+        std::function<void(boost::system::error_code ec, boost::system::error_code cause,
+                           boost::beast::http::response<boost::beast::http::string_body>)>;
+    /**
+     * Called once when a long running request ends without being canceled: the server ended the
+     * response, the connection dropped or it couldn't be made
+     */
+    using StreamEndHandler = std::function<void(boost::system::error_code)>;
+    /**
+     * The outcome of a request given by a future: the error code and its cause, as for a
+     * ResponseHandler, or the response. The future holds no exception, so that a failure is only thrown
+     * by whoever waits for it with a throwing function
+     */
+    struct Result
+    {
+        boost::system::error_code                                     ec;
+        boost::system::error_code                                     cause;
+        boost::beast::http::response<boost::beast::http::string_body> res;
+    };
+
+private:
+    struct MessageData
     {
         std::string        message;
         std::promise<void> donePromise;
@@ -37,14 +68,74 @@ class HttpSession : public std::enable_shared_from_this<HttpSession>
     bool                                                               isLongRunningRequest;
     boost::beast::http::parser<false, boost::beast::http::string_body> parser_;
     JsonStringParserQueue                                              jsonParser;
-    std::function<void(Json::Value)>                                   dataAvailableCallback_;
+    std::function<void(boost::string_view)>                            dataAvailableCallback_;
     boost::asio::io_context::strand                                    strand_;
     bool                                                               firstTimeSet = false;
+    StreamEndHandler                                                   streamEndHandler_;
+    bool                                                               isStreamEnded = false;
+    bool                                                               isReadPaused  = false;
+    bool                                                               isReadWaiting = false;
+    std::atomic_bool                                                   isCanceled{false};
+
+    bool endStream(boost::system::error_code ec);
+    void readLongRunning();
+
+    // these are for streaming requests, whose body is a stream of messages sent with write_message()
+    using RequestSerializer = boost::beast::http::request_serializer<boost::beast::http::string_body>;
+    bool                                     isStreamingRequest = false;
+    bool                                     isRequestWritten   = false;
+    bool                                     isWritingMessage   = false;
+    boost::optional<RequestSerializer>       requestSerializer_;
+    std::deque<std::shared_ptr<MessageData>> messageQueue;
+
+    void writeNextMessage();
+
+    // these are for persistent (keep-alive) sessions, where many requests are sent over one connection
+    struct QueuedRequest
+    {
+        boost::beast::http::request<boost::beast::http::string_body> req;
+        ResponseHandler                                              handler;
+        // a request that may be applied twice; only those are sent again when a connection drops them
+        bool isIdempotent = true;
+        // written after the connection answered a request, which a stale connection drops unanswered
+        bool isOnReusedConnection = false;
+        bool retried              = false;
+    };
+    enum class ConnectionState
+    {
+        Disconnected,
+        Connecting,
+        Connected
+    };
+
+    using ResponseParser = boost::beast::http::response_parser<boost::beast::http::string_body>;
+
+    std::string                                           host_;
+    std::string                                           port_;
+    unsigned                                              pipelineDepth_         = 1;
+    ConnectionState                                       connectionState        = ConnectionState::Disconnected;
+    uint64_t                                              connectionId           = 0;
+    bool                                                  connectionReused       = false;
+    bool                                                  answeredWhilePipelined = false;
+    bool                                                  isWriting              = false;
+    bool                                                  isReading              = false;
+    bool                                                  isClosed               = false;
+    std::deque<std::shared_ptr<QueuedRequest>>            requestQueue;
+    std::deque<std::shared_ptr<QueuedRequest>>            inFlightRequests; // written, waiting for response
+    boost::optional<ResponseParser>                       responseParser_;
+    std::atomic<std::size_t>                              outstandingRequests_{0};
+    std::atomic<std::chrono::steady_clock::duration::rep> lastActivity_{0};
+
+    void startConnect();
+    void closeSocket();
+    void touch();
+    void failQueuedRequests(boost::system::error_code ec, boost::system::error_code cause);
+    void handleConnectionError(boost::system::error_code ec, int errorCode);
 
 public:
     void cancel();
 
-    std::shared_future<boost::beast::http::response<boost::beast::http::string_body>> getResponse();
+    std::future<boost::beast::http::response<boost::beast::http::string_body>> getResponse();
 
     explicit HttpSession(boost::asio::io_context& ioc);
 
@@ -54,16 +145,70 @@ public:
     void runLongRunningRequest(
         boost::beast::http::verb verb, const std::string& host, const std::string& port,
         const std::string& target, const std::string& body, int version,
-        std::function<void(Json::Value)>          dataAvailableCallback,
+        std::function<void(boost::string_view)>   dataAvailableCallback,
+        const std::map<std::string, std::string>& fields = std::map<std::string, std::string>());
+    /**
+     * @brief runStreamingRequest is a long running request whose body is sent in chunks, one per message
+     * written with write_message(), for as long as the session lives (like a bidirectional grpc stream)
+     */
+    void runStreamingRequest(
+        boost::beast::http::verb verb, const std::string& host, const std::string& port,
+        const std::string& target, int version,
+        std::function<void(boost::string_view)>   dataAvailableCallback,
         const std::map<std::string, std::string>& fields = std::map<std::string, std::string>());
+    /**
+     * @brief setStreamEndHandler must be called before running a long running request; the errors of the
+     * request are then given to the handler instead of being thrown
+     */
+    void setStreamEndHandler(StreamEndHandler handler);
+    /**
+     * @brief pauseReading stops reading the response of a long running request once the messages already
+     * read are handed out; the server is then held back by the flow control of the connection
+     */
+    void pauseReading();
+    /**
+     * @brief resumeReading reads the response again after pauseReading()
+     */
+    void resumeReading();
     void on_resolve(boost::system::error_code ec, boost::asio::ip::tcp::resolver::results_type results);
     void on_connect(boost::system::error_code ec);
     void on_write(boost::system::error_code ec, std::size_t /*bytes_transferred*/);
     void on_read(boost::system::error_code ec, std::size_t /*bytes_transferred*/);
     void on_read_long_running(boost::system::error_code ec, std::size_t /*bytes_transferred*/);
+    /**
+     * @brief write_message writes msg on the connection once the request is written; messages are
+     * written one at a time, in the order of the calls
+     */
     std::shared_future<void> write_message(const std::string& msg);
     void write_message_callback(boost::system::error_code ec, std::size_t bytes_transferred,
-                                std::shared_ptr<CancelMessageData> cancelData);
+                                std::shared_ptr<MessageData> messageData);
+
+    /**
+     * @brief connect starts connecting a persistent session; requests queued with enqueueRequest() are
+     * sent over the same connection, which is reopened if the server closes it. Up to pipelineDepth
+     * requests are written before their responses are received (HTTP/1.1 pipelining)
+     */
+    void connect(const std::string& host, const std::string& port, unsigned pipelineDepth = 1);
+    /**
+     * @brief enqueueRequest queues a request on the persistent connection. A request that the server
+     * drops without a response byte after the connection was reused is sent again on a new connection,
+     * unless it isn't idempotent: then its handler gets the error, as it may have been applied
+     */
+    std::future<Result> enqueueRequest(boost::beast::http::verb verb, const std::string& target,
+                                       std::string body, int version, bool isIdempotent = true);
+    void enqueueRequest(boost::beast::http::verb verb, const std::string& target, std::string body,
+                        int version, ResponseHandler handler, bool isIdempotent = true);
+    std::size_t                           outstandingRequests() const;
+    std::chrono::steady_clock::time_point lastActivity() const;
+    void                                  close();
+    void                                  doNextRequest();
+    void on_resolve_persistent(boost::system::error_code                   ec,
+                               boost::asio::ip::tcp::resolver::results_type results);
+    void on_connect_persistent(boost::system::error_code ec);
+    void on_write_persistent(boost::system::error_code ec, std::size_t /*bytes_transferred*/,
+                             uint64_t connId);
+    void on_read_persistent(boost::system::error_code ec, std::size_t /*bytes_transferred*/,
+                            uint64_t connId);
 
     ~HttpSession();
 };
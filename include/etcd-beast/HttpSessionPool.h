@@ -0,0 +1,62 @@
+#ifndef HTTPSESSIONPOOL_H
+#define HTTPSESSIONPOOL_H
+
+#include "HttpSession.h"
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct HttpSessionPoolConfig
+{
+    // number of connections opened at construction and kept open while idle
+    unsigned minSize = 1;
+    // maximum number of connections; requests queue on the least busy connection beyond that
+    unsigned maxSize = 8;
+    // connections above minSize that are idle for longer than this are closed; 0 disables eviction
+    std::chrono::milliseconds idleTimeout = std::chrono::seconds(30);
+    // number of requests written on a connection before their responses arrive; 1 disables pipelining
+    unsigned pipelineDepth = 1;
+};
+
+class HttpSessionPool
+{
+    boost::asio::io_context&                  ioc_;
+    std::string                               host_;
+    std::string                               port_;
+    HttpSessionPoolConfig                     config_;
+    mutable std::mutex                        mtx;
+    std::vector<std::shared_ptr<HttpSession>> sessions;
+    boost::asio::steady_timer                 evictionTimer;
+    bool                                      isShutdown = false;
+
+    std::shared_ptr<HttpSession> createSession();
+    std::shared_ptr<HttpSession> pickSession();
+    void                         scheduleEviction();
+    void                         evictIdleSessions();
+
+public:
+    HttpSessionPool(boost::asio::io_context& ioc, const std::string& host, const std::string& port,
+                    const HttpSessionPoolConfig& config = HttpSessionPoolConfig());
+    ~HttpSessionPool();
+
+    void warmUp();
+    /**
+     * @brief request sends a request on the least busy connection; isIdempotent is false for a request
+     * that mustn't be sent again when a stale connection drops it (see HttpSession::enqueueRequest)
+     */
+    std::future<HttpSession::Result>
+                request(boost::beast::http::verb verb, const std::string& target, std::string body,
+                        bool isIdempotent = true);
+    void        request(boost::beast::http::verb verb, const std::string& target, std::string body,
+                        HttpSession::ResponseHandler handler, bool isIdempotent = true);
+    std::size_t size() const;
+    /**
+     * @brief shutdown stops idle eviction; in-flight requests are still completed
+     */
+    void shutdown();
+};
+
+#endif // HTTPSESSIONPOOL_H
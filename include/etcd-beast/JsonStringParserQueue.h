@@ -1,27 +1,69 @@
 #ifndef JSONSTRINGPARSERQUEUE_H
 #define JSONSTRINGPARSERQUEUE_H
 
-#include <cassert>
-#include <deque>
+#include <boost/system/error_code.hpp>
+#include <boost/utility/string_view.hpp>
+#include <cstddef>
 #include <jsoncpp/json/json.h>
 #include <string>
+#include <utility>
+#include <vector>
 
+/**
+ * @brief The JsonStringParserQueue class splits a stream of concatenated json objects (like the chunks of a
+ * watch) into complete objects. The bytes are kept in one contiguous buffer that is scanned incrementally:
+ * every byte is looked at once, whatever the size of the chunks, and braces inside strings are ignored.
+ * Complete objects are handed out as views into the buffer, without copying them.
+ */
 class JsonStringParserQueue
 {
-    static const char     _openChar             = '{';
-    static const char     _closeChar            = '}';
-    static const uint32_t LARGEST_EXPECTED_JSON = (1 << 14);
+public:
+    static const std::size_t DefaultMemoryBudget = std::size_t(64) << 20;
+
+private:
+    static const char _openChar  = '{';
+    static const char _closeChar = '}';
+
+    std::string buffer;
+    std::size_t consumed = 0; // bytes before this were pulled and can be dropped
+    std::size_t scanned  = 0; // bytes before this were scanned
+    std::size_t objectStart  = 0;
+    std::size_t bracketLevel = 0;
+    bool        inString     = false;
+    bool        escaped      = false;
+    std::size_t memoryBudget;
+    std::string failureMessage; // of the last failed pushData()
 
-    std::deque<char>         dataQueue;
-    std::vector<Json::Value> parsedValuesQueue;
-    uint32_t                 charCount    = 0;
-    int32_t                  bracketLevel = 0;
-    void                     parseAndAppendJson(const std::string& jsonStr);
+    std::vector<std::pair<std::size_t, std::size_t>> completeObjects; // [begin, end) in buffer
+
+    void compact();
+    void scan(boost::system::error_code& ec);
+    void fail(int errorCode, std::string message, boost::system::error_code& ec);
 
 public:
-    void                     pushData(const std::string& data);
+    explicit JsonStringParserQueue(std::size_t MemoryBudget = DefaultMemoryBudget);
+
+    /**
+     * @brief pushData appends data to the stream. Throws ETCDError if a brace closes nothing, or if the
+     * objects that weren't pulled and the incomplete object need more than the memory budget; the queue is
+     * cleared in both cases
+     */
+    void pushData(boost::string_view data);
+    /**
+     * @brief pushData without throwing: the errors of the other pushData() are set in ec
+     */
+    void pushData(boost::string_view data, boost::system::error_code& ec);
+    /**
+     * @brief pullObjects returns the objects completed since the last pull. The views are valid until the
+     * next call to pushData() or clear()
+     */
+    std::vector<boost::string_view> pullObjects();
+    /**
+     * @brief pullDataAndClear parses the objects completed since the last pull
+     */
     std::vector<Json::Value> pullDataAndClear();
     void                     clear();
+    void                     setMemoryBudget(std::size_t MemoryBudget);
 };
 
 #endif // JSONSTRINGPARSERQUEUE_H
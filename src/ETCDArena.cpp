@@ -0,0 +1,34 @@
+#include "etcd-beast/ETCDArena.h"
+
+#include <algorithm>
+
+constexpr std::size_t ETCDArena::MaxBlockSize;
+
+ETCDArena::ETCDArena(std::size_t firstBlockSize)
+    : nextBlockSize(std::max<std::size_t>(firstBlockSize, 64))
+{
+}
+
+char* ETCDArena::allocate(std::size_t size)
+{
+    if (size > remaining) {
+        // blocks grow with the content, so that small responses stay small and large ones use few blocks
+        std::size_t blockSize = std::max(nextBlockSize, size);
+        nextBlockSize         = std::min(nextBlockSize * 2, MaxBlockSize);
+        blocks.emplace_back(new char[blockSize]);
+        current   = blocks.back().get();
+        remaining = blockSize;
+    }
+    char* result = current;
+    current += size;
+    remaining -= size;
+    return result;
+}
+
+void ETCDArena::shrinkLast(char* p, std::size_t allocated, std::size_t used)
+{
+    if (p + allocated == current && used <= allocated) {
+        current = p + used;
+        remaining += allocated - used;
+    }
+}
@@ -0,0 +1,364 @@
+#include "etcd-beast/ETCDBase64.h"
+
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ETCD_BASE64_X86
+#include <immintrin.h>
+#endif
+
+// The vector loops follow the approach of Wojciech Mula and Daniel Lemire ("Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions", and its SSE variant). They only handle full blocks of valid input;
+// the rest, including the padding and invalid characters, goes through the scalar code, so that every
+// implementation stops decoding at the same place.
+
+namespace {
+
+const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+struct InverseTable
+{
+    signed char values[256];
+
+    InverseTable()
+    {
+        for (int i = 0; i < 256; i++) {
+            values[i] = -1;
+        }
+        for (int i = 0; i < 64; i++) {
+            values[static_cast<unsigned char>(Alphabet[i])] = static_cast<signed char>(i);
+        }
+    }
+};
+
+const InverseTable Inverse;
+
+std::size_t EncodeScalar(char* out, const unsigned char* in, std::size_t len)
+{
+    char* const begin = out;
+    for (std::size_t n = len / 3; n--;) {
+        *out++ = Alphabet[in[0] >> 2];
+        *out++ = Alphabet[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+        *out++ = Alphabet[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+        *out++ = Alphabet[in[2] & 0x3f];
+        in += 3;
+    }
+    switch (len % 3) {
+    case 2:
+        *out++ = Alphabet[in[0] >> 2];
+        *out++ = Alphabet[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+        *out++ = Alphabet[(in[1] & 0x0f) << 2];
+        *out++ = '=';
+        break;
+    case 1:
+        *out++ = Alphabet[in[0] >> 2];
+        *out++ = Alphabet[(in[0] & 0x03) << 4];
+        *out++ = '=';
+        *out++ = '=';
+        break;
+    default:
+        break;
+    }
+    return static_cast<std::size_t>(out - begin);
+}
+
+std::pair<std::size_t, std::size_t> DecodeScalar(char* out, const unsigned char* in, std::size_t len)
+{
+    char* const                begin   = out;
+    const unsigned char* const inBegin = in;
+    unsigned char              c4[4]   = {0, 0, 0, 0};
+    int                        i       = 0;
+    while (len-- && *in != '=') {
+        const signed char v = Inverse.values[*in];
+        if (v == -1) {
+            break;
+        }
+        ++in;
+        c4[i] = static_cast<unsigned char>(v);
+        if (++i == 4) {
+            *out++ = static_cast<char>((c4[0] << 2) | (c4[1] >> 4));
+            *out++ = static_cast<char>((c4[1] << 4) | (c4[2] >> 2));
+            *out++ = static_cast<char>((c4[2] << 6) | c4[3]);
+            i      = 0;
+        }
+    }
+    // a partial block gives the bytes that are complete in it
+    if (i > 1) {
+        *out++ = static_cast<char>((c4[0] << 2) | (c4[1] >> 4));
+    }
+    if (i > 2) {
+        *out++ = static_cast<char>((c4[1] << 4) | (c4[2] >> 2));
+    }
+    return {static_cast<std::size_t>(out - begin), static_cast<std::size_t>(in - inBegin)};
+}
+
+#ifdef ETCD_BASE64_X86
+
+// 12 input bytes in the low bytes of each 128 bit lane -> 16 6-bit values, one per byte
+__attribute__((target("sse4.1"))) inline __m128i EncodeReshuffle(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// 6-bit values -> ascii, by adding the offset of the alphabet range each value falls in
+__attribute__((target("sse4.1"))) inline __m128i EncodeTranslate(__m128i in)
+{
+    const __m128i lut  = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m128i       idx  = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    const __m128i mask = _mm_cmpgt_epi8(in, _mm_set1_epi8(25));
+    idx                = _mm_sub_epi8(idx, mask);
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, idx));
+}
+
+__attribute__((target("sse4.1"))) std::size_t EncodeSSE41(char* out, const unsigned char* in,
+                                                          std::size_t len)
+{
+    char* const begin = out;
+    // every iteration loads 16 bytes and encodes 12 of them
+    while (len >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        v         = EncodeTranslate(EncodeReshuffle(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+        in += 12;
+        out += 16;
+        len -= 12;
+    }
+    return static_cast<std::size_t>(out - begin) + EncodeScalar(out, in, len);
+}
+
+// ascii -> 6-bit values; returns false if a byte isn't in the alphabet (the padding included)
+__attribute__((target("sse4.1"))) inline bool DecodeTranslate(__m128i& v)
+{
+    const __m128i lutLo  = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13,
+                                        0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lutHi  = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10,
+                                        0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask2F  = _mm_set1_epi8(0x2f);
+
+    const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(v, 4), mask2F);
+    const __m128i loNibbles = _mm_and_si128(v, mask2F);
+    const __m128i hi        = _mm_shuffle_epi8(lutHi, hiNibbles);
+    const __m128i lo        = _mm_shuffle_epi8(lutLo, loNibbles);
+    if (!_mm_testz_si128(lo, hi)) {
+        return false;
+    }
+    const __m128i eq2F = _mm_cmpeq_epi8(v, mask2F);
+    const __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+    v                  = _mm_add_epi8(v, roll);
+    return true;
+}
+
+// 16 6-bit values -> 12 bytes in the low bytes of the lane
+__attribute__((target("sse4.1"))) inline __m128i DecodeReshuffle(__m128i v)
+{
+    const __m128i mergedAB = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    const __m128i merged   = _mm_madd_epi16(mergedAB, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("sse4.1"))) std::pair<std::size_t, std::size_t>
+DecodeSSE41(char* out, const unsigned char* in, std::size_t len)
+{
+    std::size_t read    = 0;
+    std::size_t written = 0;
+    // every iteration stores 16 bytes and keeps 12 of them; 24 characters left guarantee room in dest
+    while (len - read >= 24) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + read));
+        if (!DecodeTranslate(v)) {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + written), DecodeReshuffle(v));
+        read += 16;
+        written += 12;
+    }
+    std::pair<std::size_t, std::size_t> rest = DecodeScalar(out + written, in + read, len - read);
+    return {written + rest.first, read + rest.second};
+}
+
+__attribute__((target("avx2"))) std::size_t EncodeAVX2(char* out, const unsigned char* in, std::size_t len)
+{
+    if (len < 28) {
+        return EncodeSSE41(out, in, len); // short keys don't fill an avx2 block
+    }
+    char* const   begin       = out;
+    const __m128i shuffleLane = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i shuffle     = _mm256_broadcastsi128_si256(shuffleLane);
+    const __m256i lut         = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0));
+    // every iteration loads 12 bytes into each lane (reading 28) and encodes 24 of them
+    while (len >= 28) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12));
+        __m256i       v  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        v                = _mm256_shuffle_epi8(v, shuffle);
+        const __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        v                = _mm256_or_si256(t1, t3);
+
+        __m256i       idx  = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+        const __m256i mask = _mm256_cmpgt_epi8(v, _mm256_set1_epi8(25));
+        idx                = _mm256_sub_epi8(idx, mask);
+        v                  = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut, idx));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+        in += 24;
+        out += 32;
+        len -= 24;
+    }
+    // the sse tail isn't vex encoded, clear the upper halves to avoid the avx-sse transition penalty
+    _mm256_zeroupper();
+    return static_cast<std::size_t>(out - begin) + EncodeSSE41(out, in, len);
+}
+
+__attribute__((target("avx2"))) std::pair<std::size_t, std::size_t>
+DecodeAVX2(char* out, const unsigned char* in, std::size_t len)
+{
+    if (len < 44) {
+        return DecodeSSE41(out, in, len);
+    }
+    const __m256i lutLo   = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a));
+    const __m256i lutHi   = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+    const __m256i lutRoll = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i mask2F  = _mm256_set1_epi8(0x2f);
+    const __m256i shuffle = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+    std::size_t read    = 0;
+    std::size_t written = 0;
+    // every iteration stores 32 bytes and keeps 24 of them; 44 characters left guarantee room in dest
+    while (len - read >= 44) {
+        __m256i       v         = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + read));
+        const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask2F);
+        const __m256i loNibbles = _mm256_and_si256(v, mask2F);
+        const __m256i hi        = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        const __m256i lo        = _mm256_shuffle_epi8(lutLo, loNibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        const __m256i eq2F = _mm256_cmpeq_epi8(v, mask2F);
+        v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles)));
+
+        const __m256i mergedAB = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v                      = _mm256_madd_epi16(mergedAB, _mm256_set1_epi32(0x00011000));
+        v                      = _mm256_shuffle_epi8(v, shuffle);
+        v                      = _mm256_permutevar8x32_epi32(v, compact);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + written), v);
+        read += 32;
+        written += 24;
+    }
+    _mm256_zeroupper();
+    std::pair<std::size_t, std::size_t> rest = DecodeSSE41(out + written, in + read, len - read);
+    return {written + rest.first, read + rest.second};
+}
+
+#endif // ETCD_BASE64_X86
+
+ETCDBase64::Implementation DetectImplementation()
+{
+#ifdef ETCD_BASE64_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return ETCDBase64::Implementation::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return ETCDBase64::Implementation::SSE41;
+    }
+#endif
+    return ETCDBase64::Implementation::Scalar;
+}
+
+} // namespace
+
+ETCDBase64::Implementation ETCDBase64::ActiveImplementation()
+{
+    static const Implementation active = DetectImplementation();
+    return active;
+}
+
+bool ETCDBase64::IsSupported(Implementation impl)
+{
+    return static_cast<int>(impl) <= static_cast<int>(ActiveImplementation());
+}
+
+const char* ETCDBase64::ImplementationName(Implementation impl)
+{
+    switch (impl) {
+    case Implementation::AVX2:
+        return "avx2";
+    case Implementation::SSE41:
+        return "sse4.1";
+    default:
+        return "scalar";
+    }
+}
+
+std::size_t ETCDBase64::Encode(char* dest, const char* src, std::size_t len, Implementation impl)
+{
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+    switch (impl) {
+#ifdef ETCD_BASE64_X86
+    case Implementation::AVX2:
+        return EncodeAVX2(dest, in, len);
+    case Implementation::SSE41:
+        return EncodeSSE41(dest, in, len);
+#endif
+    default:
+        return EncodeScalar(dest, in, len);
+    }
+}
+
+std::pair<std::size_t, std::size_t> ETCDBase64::Decode(char* dest, const char* src, std::size_t len,
+                                                       Implementation impl)
+{
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+    switch (impl) {
+#ifdef ETCD_BASE64_X86
+    case Implementation::AVX2:
+        return DecodeAVX2(dest, in, len);
+    case Implementation::SSE41:
+        return DecodeSSE41(dest, in, len);
+#endif
+    default:
+        return DecodeScalar(dest, in, len);
+    }
+}
+
+std::size_t ETCDBase64::Encode(char* dest, const char* src, std::size_t len)
+{
+    return Encode(dest, src, len, ActiveImplementation());
+}
+
+std::pair<std::size_t, std::size_t> ETCDBase64::Decode(char* dest, const char* src, std::size_t len)
+{
+    return Decode(dest, src, len, ActiveImplementation());
+}
+
+std::string ETCDBase64::Encode(const std::string& str)
+{
+    std::string result;
+    result.resize(EncodedSize(str.size()));
+    result.resize(Encode(&result[0], str.data(), str.size()));
+    return result;
+}
+
+std::string ETCDBase64::Decode(const std::string& str)
+{
+    std::string result;
+    result.resize(DecodedSize(str.size()));
+    result.resize(Decode(&result[0], str.data(), str.size()).first);
+    return result;
+}
@@ -1,11 +1,11 @@
 ﻿#include "etcd-beast/ETCDClient.h"
 
+#include "etcd-beast/ETCDBase64.h"
 #include "etcd-beast/ETCDError.h"
+#include "etcd-beast/ETCDRequestBody.h"
 #include "etcd-beast/HttpSession.h"
-
-#include <boost/algorithm/hex.hpp>
-#include <boost/beast/core/detail/base64.hpp>
-#include <boost/multiprecision/cpp_int.hpp>
+#include <boost/asio/post.hpp>
+#include <algorithm>
 
 void ETCDClient::start()
 {
@@ -15,54 +15,108 @@ void ETCDClient::start()
     if (address.empty()) {
         throw ETCDError(ETCDERROR_INVALID_ADDRESS, "Invalid address");
     }
-    io_context_work.reset(new boost::asio::io_context::work(io_context));
-    for (auto i = 0u; i < threadCount; ++i) {
-        pool.push_back(std::thread([this]() { io_context.run(); }));
+    if (executionConfig.sharded) {
+        ioShards.reset(new ETCDIoShards(threadCount, 1, executionConfig.pinThreads));
+    } else {
+        ioShards.reset(new ETCDIoShards(1, threadCount));
+    }
+    for (std::size_t i = 0; i < ioShards->size(); ++i) {
+        sessionPools.emplace_back(
+            new HttpSessionPool(ioShards->at(i), address, std::to_string(port), sessionPoolConfig));
+        sessionPools.back()->warmUp();
     }
+    leasePool.reset(new ETCDLeasePool(*this));
 }
 
 void ETCDClient::stop()
 {
-    io_context_work.reset();
-    for (auto&& t : pool) {
-        t.join();
+    if (writeCoalescer) {
+        writeCoalescer->flush();
+    }
+    // before the multiplexer is closed, since a cache may be reloading and adding its watch
+    for (const std::unique_ptr<ETCDReadCache>& cache : readCaches) {
+        cache->stop();
+    }
+    if (watchMultiplexer) {
+        watchMultiplexer->close();
+    }
+    // before the keeper is closed, since a grant of the pool may complete and keep its lease alive
+    if (leasePool) {
+        leasePool->stop();
+    }
+    {
+        std::lock_guard<std::mutex> lg(leaseKeeperMtx);
+        if (leaseKeeper) {
+            leaseKeeper->close();
+        }
+    }
+    for (const std::unique_ptr<HttpSessionPool>& sessionPool : sessionPools) {
+        sessionPool->shutdown();
+    }
+    if (blockingPool) {
+        blockingPool->shutdown();
+    }
+    if (ioShards) {
+        ioShards->stop();
+    }
+    if (blockingShards) {
+        blockingShards->stop();
+    }
+    // after the io threads, which may still queue messages for the callbacks
+    if (callbackShards) {
+        callbackShards->stop();
+    }
+}
+
+boost::asio::io_context& ETCDClient::ioContext()
+{
+    if (!ioShards) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
     }
+    return ioShards->current();
 }
 
-std::string ETCDClient::ToBase64(const std::string& str)
+HttpSessionPool& ETCDClient::sessionPool()
 {
-#if BOOST_VERSION >= 107100
-    std::string result;
-    std::size_t size = boost::beast::detail::base64::encoded_size(str.size());
-    result.resize(size);
-    std::size_t writtenSize =
-        boost::beast::detail::base64::encode((void*)result.data(), str.data(), str.size());
-    result.resize(writtenSize);
-    return result;
-#else
-    return boost::beast::detail::base64_encode(str);
-#endif
+    if (!ioShards) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    return *sessionPools[ioShards->currentIndex()];
 }
 
+HttpSessionPool& ETCDClient::blockingSessionPool()
+{
+    if (!isIoThread()) {
+        return sessionPool();
+    }
+    std::call_once(blockingPoolCreated, [this]() {
+        blockingShards.reset(new ETCDIoShards(1, 1));
+        blockingPool.reset(new HttpSessionPool(blockingShards->at(0), address, std::to_string(port),
+                                               sessionPoolConfig));
+        // like the pools of the shards, so that its idle connections are closed too
+        blockingPool->warmUp();
+    });
+    return *blockingPool;
+}
+
+bool ETCDClient::isIoThread() const { return ioShards && ioShards->isShardThread(); }
+
+std::string ETCDClient::ToBase64(const std::string& str) { return ETCDBase64::Encode(str); }
+
 std::string ETCDClient::ToBase64PlusOne(const std::string& str)
 {
-    std::string                    keyEndHex = boost::algorithm::hex(str); // convert to hex
-    boost::multiprecision::cpp_int keyEndNum;
-    std::stringstream              keyEndSS(keyEndHex);
-    keyEndSS >> std::hex >> keyEndNum;   // convert hex to cpp_int
-    keyEndNum++;                         // add one
-    keyEndSS = std::stringstream();      // reset the stringstream to reuse it
-    keyEndSS << std::hex << keyEndNum;   // convert the cpp_int to hex stringstream
-    keyEndHex          = keyEndSS.str(); // to string
-    std::string result = boost::algorithm::unhex(keyEndHex);
-    return ToBase64(result);
+    return ETCDRequestBody().base64RangeEnd(str).str();
 }
 
-ETCDClient::ETCDClient(const std::string& Address, uint16_t Port, unsigned ThreadCount)
+ETCDClient::ETCDClient(const std::string& Address, uint16_t Port, unsigned ThreadCount,
+                       const HttpSessionPoolConfig& PoolConfig,
+                       const ETCDExecutionConfig&   ExecutionConfig)
 {
-    address     = Address;
-    port        = Port;
-    threadCount = ThreadCount;
+    address           = Address;
+    port              = Port;
+    threadCount       = ThreadCount;
+    sessionPoolConfig = PoolConfig;
+    executionConfig   = ExecutionConfig;
     if (!address.empty()) {
         start();
     }
@@ -70,122 +124,675 @@ ETCDClient::ETCDClient(const std::string& Address, uint16_t Port, unsigned Threa
 
 ETCDClient::~ETCDClient() { stop(); }
 
-ETCDResponse ETCDClient::set(const std::string& key, const std::string& value, uint64_t leaseID)
+ETCDClient::Command ETCDClient::setCommand(const std::string& key, const std::string& value,
+                                           uint64_t leaseID) const
 {
     if (key.empty()) {
         throw ETCDError(ETCDERROR_EMPTY_KEY_ERROR, "Key cannot be empty");
     }
 
-    std::string target = "/v3alpha/kv/put";
+    ETCDRequestBody body;
+    body.raw(R"({"key": ")").base64(key).raw(R"(", "value": ")").base64(value);
+    // leaseID == 0 means it'll be generated
+    if (leaseID != 0) {
+        body.raw(R"(", "lease": ")").number(leaseID);
+    }
+    body.raw(R"("})");
+    Command command{ETCDVersionPrefix + "/kv/put", body.str()};
+    attachReadCaches(command, key, false, true);
+    return command;
+}
+
+ETCDClient::Command ETCDClient::getCommand(const std::string& key) const
+{
+    ETCDRequestBody body;
+    body.raw(R"({"key": ")").base64(key).raw(R"("})");
+    Command command{ETCDVersionPrefix + "/kv/range", body.str()};
+    attachReadCaches(command, key, false, false);
+    return command;
+}
 
-    std::string k64 = ToBase64(key);
-    std::string v64 = ToBase64(value);
+ETCDClient::Command ETCDClient::getAllCommand(const std::string& prefix) const
+{
+    ETCDRequestBody body;
+    body.raw(R"({"key": ")").base64(prefix).raw(R"(", "range_end": ")").base64RangeEnd(prefix).raw(R"("})");
+    Command command{ETCDVersionPrefix + "/kv/range", body.str()};
+    attachReadCaches(command, prefix, true, false);
+    return command;
+}
 
-    if (leaseID == 0) {
-        // leaseID == 0 means it'll be generated
-        const std::string bset = R"({"key": ")" + k64 + R"(", "value": ")" + v64 + R"("})";
-        return customCommand(target, bset);
-    } else {
-        const std::string bset = R"({"key": ")" + k64 + R"(", "value": ")" + v64 + R"(", "lease": ")" +
-                                 std::to_string(leaseID) + R"("})";
-        return customCommand(target, bset);
+namespace {
+
+const char* SortOrderName(ETCDRangeOptions::SortOrder order)
+{
+    switch (order) {
+    case ETCDRangeOptions::SortOrder::Ascend:
+        return "ASCEND";
+    case ETCDRangeOptions::SortOrder::Descend:
+        return "DESCEND";
+    default:
+        return "NONE";
     }
 }
 
-ETCDResponse ETCDClient::get(const std::string& key)
+const char* SortTargetName(ETCDRangeOptions::SortTarget target)
+{
+    switch (target) {
+    case ETCDRangeOptions::SortTarget::Version:
+        return "VERSION";
+    case ETCDRangeOptions::SortTarget::Create:
+        return "CREATE";
+    case ETCDRangeOptions::SortTarget::Mod:
+        return "MOD";
+    case ETCDRangeOptions::SortTarget::Value:
+        return "VALUE";
+    default:
+        return "KEY";
+    }
+}
+
+// the range end of the keys starting with prefix, like ETCDRequestBody::base64RangeEnd() but not encoded
+std::string PrefixRangeEnd(const std::string& prefix)
+{
+    std::string end = prefix;
+    while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xff) {
+        end.pop_back();
+    }
+    if (end.empty()) {
+        return std::string(1, '\0');
+    }
+    end.back() = static_cast<char>(static_cast<unsigned char>(end.back()) + 1);
+    return end;
+}
+
+// up to ranges - 1 split points strictly between first and last, spread evenly over the byte space of the
+// 8 bytes that follow their common part
+std::vector<std::string> SplitKeySpace(const std::string& first, const std::string& last, std::size_t ranges)
+{
+    const std::size_t Width  = 8;
+    std::size_t       common = 0;
+    while (common < first.size() && common < last.size() && first[common] == last[common]) {
+        common++;
+    }
+    auto valueAfterCommon = [common, Width](const std::string& key) {
+        uint64_t value = 0;
+        for (std::size_t i = 0; i < Width; i++) {
+            const std::size_t pos = common + i;
+            value = (value << 8) | (pos < key.size() ? static_cast<unsigned char>(key[pos]) : 0u);
+        }
+        return value;
+    };
+    const uint64_t low  = valueAfterCommon(first);
+    const uint64_t high = valueAfterCommon(last);
+
+    std::vector<std::string> points;
+    if (high <= low) {
+        return points;
+    }
+    const uint64_t step = (high - low) / ranges;
+    for (std::size_t i = 1; i < ranges && step > 0; i++) {
+        const uint64_t value = low + step * i;
+        std::string    point = first.substr(0, common);
+        for (std::size_t b = Width; b > 0; b--) {
+            point.push_back(static_cast<char>((value >> (8 * (b - 1))) & 0xff));
+        }
+        // the trailing zero bytes add nothing to where the point splits
+        while (point.size() > common && point.back() == '\0') {
+            point.pop_back();
+        }
+        points.push_back(std::move(point));
+    }
+    return points;
+}
+
+} // namespace
+
+ETCDClient::Command ETCDClient::rangeCommand(const std::string& key, bool isRange,
+                                             const ETCDRangeOptions& options) const
+{
+    ETCDRequestBody body;
+    body.raw(R"({"key": ")").base64(key);
+    if (isRange) {
+        body.raw(R"(", "range_end": ")").base64RangeEnd(key);
+    } else if (!options.rangeEnd.empty()) {
+        body.raw(R"(", "range_end": ")").base64(options.rangeEnd);
+    }
+    body.raw(R"(")");
+    // int64 fields are strings in the json of the grpc gateway; the defaults are left out
+    auto number = [&body](const char* name, uint64_t value) {
+        if (value != 0) {
+            body.raw(R"(, ")").raw(name).raw(R"(": ")").number(value).raw(R"(")");
+        }
+    };
+    auto flag = [&body](const char* name, bool value) {
+        if (value) {
+            body.raw(R"(, ")").raw(name).raw(R"(": true)");
+        }
+    };
+    number("limit", options.limit);
+    number("revision", options.revision);
+    if (options.sortOrder != ETCDRangeOptions::SortOrder::None) {
+        body.raw(R"(, "sort_order": ")").raw(SortOrderName(options.sortOrder)).raw(R"(")");
+    }
+    if (options.sortTarget != ETCDRangeOptions::SortTarget::Key) {
+        body.raw(R"(, "sort_target": ")").raw(SortTargetName(options.sortTarget)).raw(R"(")");
+    }
+    flag("serializable", options.serializable);
+    flag("keys_only", options.keysOnly);
+    flag("count_only", options.countOnly);
+    number("min_mod_revision", options.minModRevision);
+    number("max_mod_revision", options.maxModRevision);
+    number("min_create_revision", options.minCreateRevision);
+    number("max_create_revision", options.maxCreateRevision);
+    body.raw("}");
+    // not answered from the read caches, which don't apply the options
+    return Command{ETCDVersionPrefix + "/kv/range", body.str()};
+}
+
+ETCDClient::Command ETCDClient::delCommand(const std::string& key) const
+{
+    ETCDRequestBody body;
+    body.raw(R"({"key": ")").base64(key).raw(R"("})");
+    Command command{ETCDVersionPrefix + "/kv/deleterange", body.str()};
+    attachReadCaches(command, key, false, true);
+    command.isDelete     = true;
+    command.isIdempotent = false;
+    return command;
+}
+
+ETCDClient::Command ETCDClient::delAllCommand(const std::string& prefix) const
+{
+    ETCDRequestBody body;
+    body.raw(R"({"key": ")").base64(prefix).raw(R"(", "range_end": ")").base64RangeEnd(prefix).raw(R"("})");
+    Command command{ETCDVersionPrefix + "/kv/deleterange", body.str()};
+    attachReadCaches(command, prefix, true, true);
+    command.isDelete     = true;
+    command.isIdempotent = false;
+    return command;
+}
+
+ETCDClient::Command ETCDClient::leaseGrantCommand(uint64_t ttl, uint64_t ID) const
+{
+    if (ttl < LEASE_MIN_TTL) {
+        throw ETCDError(ETCDERROR_MIN_TTL_EXCEEDED_ERROR,
+                        "A TTL value used that is less than the minimum. Increase LEASE_MIN_TTL in the "
+                        "header if you want it higher. The API may not response though.");
+    }
+    ETCDRequestBody body;
+    body.raw(R"({"ID": ")").number(ID).raw(R"(", "TTL": ")").number(ttl).raw(R"("})");
+    Command command{ETCDVersionPrefix + "/lease/grant", body.str()};
+    command.isIdempotent = false;
+    return command;
+}
+
+ETCDClient::Command ETCDClient::leaseRevokeCommand(uint64_t leaseID) const
+{
+    ETCDRequestBody body;
+    body.raw(R"({"ID": ")").number(leaseID).raw(R"("})");
+    Command command{ETCDVersionPrefix + "/kv/lease/revoke", body.str()};
+    command.isIdempotent = false;
+    return command;
+}
+
+ETCDClient::Command ETCDClient::leaseTimeToLiveCommand(uint64_t leaseID) const
+{
+    ETCDRequestBody body;
+    body.raw(R"({"ID": ")").number(leaseID).raw(R"("})");
+    return Command{ETCDVersionPrefix + "/kv/lease/timetolive", body.str()};
+}
+
+void ETCDClient::attachReadCaches(Command& command, const std::string& key, bool isRange,
+                                  bool isWrite) const
+{
+    command.key     = key;
+    command.isRange = isRange;
+    command.isWrite = isWrite;
+    if (!isWrite) {
+        command.isCacheableRead = true;
+        return;
+    }
+    for (const std::unique_ptr<ETCDReadCache>& cache : readCaches) {
+        if (cache->overlaps(key, isRange)) {
+            command.readCaches.push_back(cache.get());
+        }
+    }
+}
+
+ETCDResponse ETCDClient::set(const std::string& key, const std::string& value, uint64_t leaseID)
 {
-    std::string target = ETCDVersionPrefix + "/kv/range";
+    Command c = setCommand(key, value, leaseID);
+    if (!c.readCaches.empty()) {
+        return sendWriteToReadCaches(std::move(c), true);
+    }
+    // the coalescer flushes on its io thread, which may be the calling one
+    if (writeCoalescer && !isIoThread()) {
+        return ETCDResponse(writeCoalescer->put(key, std::move(c.json)));
+    }
+    return sendCommand(std::move(c));
+}
 
-    std::string k64 = ToBase64(key);
+bool ETCDClient::readFromCache(const std::string& key, bool isRange, ETCDParsedResponse& out) const
+{
+    for (const std::unique_ptr<ETCDReadCache>& cache : readCaches) {
+        if (cache->covers(key)) {
+            return cache->read(key, isRange, out);
+        }
+    }
+    return false;
+}
 
-    const std::string bget = R"({"key": ")" + k64 + R"("})";
-    return customCommand(target, bget);
+ETCDResponse ETCDClient::get(const std::string& key)
+{
+    // checked before the request is built, which takes longer than reading the cache
+    ETCDParsedResponse cached;
+    if (readFromCache(key, false, cached)) {
+        return ETCDResponse(std::move(cached));
+    }
+    return sendCommand(getCommand(key));
 }
 
 ETCDResponse ETCDClient::getAll(const std::string& prefix)
 {
-    std::string target = ETCDVersionPrefix + "/kv/range";
+    ETCDParsedResponse cached;
+    if (readFromCache(prefix, true, cached)) {
+        return ETCDResponse(std::move(cached));
+    }
+    return sendCommand(getAllCommand(prefix));
+}
 
-    std::string k64Start = ToBase64(prefix);
-    std::string k64End   = ToBase64PlusOne(prefix);
+ETCDResponse ETCDClient::get(const std::string& key, const ETCDRangeOptions& options)
+{
+    return sendCommand(rangeCommand(key, false, options));
+}
 
-    const std::string bget = R"({"key": ")" + k64Start + R"(", "range_end": ")" + k64End + R"("})";
-    return customCommand(target, bget);
+ETCDResponse ETCDClient::getAll(const std::string& prefix, const ETCDRangeOptions& options)
+{
+    return sendCommand(rangeCommand(prefix, true, options));
 }
 
-ETCDResponse ETCDClient::del(const std::string& key)
+ETCDResponse ETCDClient::getAllParallel(const std::string& prefix, unsigned shards)
 {
-    std::string target = ETCDVersionPrefix + "/kv/deleterange";
+    if (shards == 0) {
+        throw ETCDError(ETCDERROR_INVALID_SHARD_COUNT, "A range must be read in at least 1 shard");
+    }
+    ETCDParsedResponse cached;
+    if (readFromCache(prefix, true, cached)) {
+        return ETCDResponse(std::move(cached));
+    }
+
+    // the first and the last key of the prefix, probed concurrently with a key each; the revision of
+    // the first is the one all the shards are read at. The ranges are split evenly between them in byte
+    // space, so the probes cost the same whatever the size of the prefix
+    ETCDRangeOptions firstOptions;
+    firstOptions.keysOnly = true;
+    firstOptions.limit    = 1;
+    ETCDRangeOptions lastOptions = firstOptions;
+    lastOptions.sortOrder        = ETCDRangeOptions::SortOrder::Descend;
+    std::future<ParsedResult> firstResult = requestParsed(rangeCommand(prefix, true, firstOptions));
+    std::future<ParsedResult> lastResult  = requestParsed(rangeCommand(prefix, true, lastOptions));
+    ETCDParsedResponse        firstKey    = TakeParsed(firstResult);
+    ETCDParsedResponse        lastKey     = TakeParsed(lastResult);
+    if (firstKey.getKVEntriesVec().empty()) {
+        return ETCDResponse(std::move(firstKey), false);
+    }
+
+    // range i is [bounds[i], bounds[i + 1]); the ranges before the first key and after the last one
+    // are empty, so they aren't read. The last key may come from a later revision: the last range goes
+    // to the end of the prefix anyway
+    std::vector<std::string> bounds{std::string(firstKey.getKVEntriesVec().front().key)};
+    if (!lastKey.getKVEntriesVec().empty()) {
+        const std::string last(lastKey.getKVEntriesVec().front().key);
+        for (std::string& point : SplitKeySpace(bounds.front(), last, shards)) {
+            bounds.push_back(std::move(point));
+        }
+    }
+    bounds.push_back(PrefixRangeEnd(prefix));
+    const std::size_t rangeCount = bounds.size() - 1;
+
+    // the ranges are read on all the shards, each decoding its own responses. An io thread can't wait
+    // for the shards, so there they're all read on the thread of the requests waited for
+    const bool                             isSpread = !isIoThread();
+    const std::size_t                      base     = ioShards->currentIndex();
+    std::vector<std::future<ParsedResult>> futures;
+    ETCDRangeOptions                       shardOptions;
+    shardOptions.revision = firstKey.getRevision();
+    for (std::size_t i = 0; i < rangeCount; i++) {
+        HttpSessionPool& pool =
+            isSpread ? *sessionPools[(base + i) % sessionPools.size()] : blockingSessionPool();
+        shardOptions.rangeEnd = bounds[i + 1];
+        futures.push_back(requestParsed(rangeCommand(bounds[i], false, shardOptions), pool));
+    }
+    std::vector<ETCDParsedResponse> parts;
+    for (std::future<ParsedResult>& future : futures) {
+        parts.push_back(TakeParsed(future));
+    }
+    // the ranges are in key order, so their concatenation is too
+    return ETCDResponse(ETCDParsedResponse::Concat(std::move(parts)), false);
+}
 
-    std::string k64 = ToBase64(key);
+ETCDRangeIterator ETCDClient::getAllPaginated(const std::string& prefix, std::size_t pageSize)
+{
+    return ETCDRangeIterator(*this, prefix, pageSize);
+}
 
-    const std::string bget = R"({"key": ")" + k64 + R"("})";
-    return customCommand(target, bget);
+ETCDResponse ETCDClient::del(const std::string& key)
+{
+    return sendCommand(delCommand(key));
 }
 
 ETCDResponse ETCDClient::delAll(const std::string& prefix)
 {
-    std::string target = ETCDVersionPrefix + "/kv/deleterange";
+    return sendCommand(delAllCommand(prefix));
+}
 
-    std::string k64Start = ToBase64(prefix);
-    std::string k64End   = ToBase64PlusOne(prefix);
+ETCDTransaction ETCDClient::txn() { return ETCDTransaction(this); }
 
-    const std::string bget = R"({"key": ")" + k64Start + R"(", "range_end": ")" + k64End + R"("})";
-    return customCommand(target, bget);
+ETCDResponse ETCDClient::leaseGrant(uint64_t ttl, uint64_t ID)
+{
+    return sendCommand(leaseGrantCommand(ttl, ID));
 }
 
-ETCDResponse ETCDClient::leaseGrant(uint64_t ttl, uint64_t ID)
+ETCDResponse ETCDClient::leaseRevoke(uint64_t leaseID)
+{
+    leaseStopKeepAlive(leaseID);
+    return sendCommand(leaseRevokeCommand(leaseID));
+}
+
+ETCDResponse ETCDClient::leaseTimeToLive(uint64_t leaseID)
 {
+    return sendCommand(leaseTimeToLiveCommand(leaseID));
+}
+
+void ETCDClient::leaseKeepAlive(uint64_t leaseID, uint64_t ttl,
+                                ETCDLeaseKeeper::ExpiryCallback onExpired)
+{
+    if (sessionPools.empty()) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
     if (ttl < LEASE_MIN_TTL) {
         throw ETCDError(ETCDERROR_MIN_TTL_EXCEEDED_ERROR,
                         "A TTL value used that is less than the minimum. Increase LEASE_MIN_TTL in the "
                         "header if you want it higher. The API may not response though.");
     }
-    std::string target = ETCDVersionPrefix + "/lease/grant";
-
-    const std::string blease =
-        R"({"ID": ")" + std::to_string(ID) + R"(", "TTL": ")" + std::to_string(ttl) + R"("})";
-    return customCommand(target, blease);
+    std::shared_ptr<ETCDLeaseKeeper> keeper;
+    {
+        std::lock_guard<std::mutex> lg(leaseKeeperMtx);
+        if (!leaseKeeper) {
+            leaseKeeper = std::make_shared<ETCDLeaseKeeper>(ioContext(), address, std::to_string(port),
+                                                            ETCDVersionPrefix + "/lease/keepalive");
+        }
+        keeper = leaseKeeper;
+    }
+    keeper->add(leaseID, ttl, std::move(onExpired));
 }
 
-ETCDResponse ETCDClient::leaseRevoke(uint64_t leaseID)
+void ETCDClient::leaseStopKeepAlive(uint64_t leaseID)
 {
-    std::string target = ETCDVersionPrefix + "/kv/lease/revoke";
-
-    const std::string blease = R"({"ID": ")" + std::to_string(leaseID) + R"("})";
-    return customCommand(target, blease);
+    std::shared_ptr<ETCDLeaseKeeper> keeper;
+    {
+        std::lock_guard<std::mutex> lg(leaseKeeperMtx);
+        keeper = leaseKeeper;
+    }
+    if (keeper) {
+        keeper->remove(leaseID);
+    }
 }
 
-ETCDResponse ETCDClient::leaseTimeToLive(uint64_t leaseID)
+uint64_t ETCDClient::leaseCheckOut(uint64_t ttl, ETCDLeaseKeeper::ExpiryCallback onExpired)
 {
-    std::string target = ETCDVersionPrefix + "/kv/lease/timetolive";
+    if (!leasePool) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    return leasePool->checkOut(ttl, std::move(onExpired));
+}
 
-    const std::string blease = R"({"ID": ")" + std::to_string(leaseID) + R"("})";
-    return customCommand(target, blease);
+uint64_t ETCDClient::leaseShared(uint64_t ttl)
+{
+    if (!leasePool) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    return leasePool->sharedLease(ttl);
 }
 
 ETCDWatch ETCDClient::watch(const std::string&                            key,
                             const std::function<void(ETCDParsedResponse)> callback)
 {
-    std::string k64 = ToBase64(key);
-
-    ETCDWatch w(io_context);
+    return watch(key, ETCDWatchOptions(), callback);
+}
 
-    w.run(k64, address, port, callback);
+ETCDWatch ETCDClient::watch(const std::string& key, const ETCDWatchOptions& options,
+                            const std::function<void(ETCDParsedResponse)> callback)
+{
+    // the watch must not be copied, its stream calls it back, so it's returned through a single object
+    ETCDWatch w = watchMultiplexer ? ETCDWatch(watchMultiplexer, key, options, callback)
+                                   : ETCDWatch(ioContext(), watchCallbackExecutor);
+    if (!watchMultiplexer) {
+        w.run(key, options, address, port, ETCDVersionPrefix + "/watch", callback);
+    }
 
     return w;
 }
 
 ETCDResponse ETCDClient::customCommand(const std::string& url, const std::string& jsonCommand)
 {
-    const std::string& target      = url;
-    static const int   httpVersion = 11; // http 1.1
+    // a txn, for one, may have been applied when its connection dropped
+    Command command{url, jsonCommand};
+    command.isIdempotent = false;
+    return sendCommand(std::move(command));
+}
+
+ETCDResponse ETCDClient::sendCommand(Command command)
+{
+    if (sessionPools.empty()) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    if (command.isWrite && !command.readCaches.empty()) {
+        return sendWriteToReadCaches(std::move(command), false);
+    }
+    return ETCDResponse(blockingSessionPool().request(boost::beast::http::verb::post, command.url,
+                                                      std::move(command.json), command.isIdempotent));
+}
+
+std::future<ETCDClient::ParsedResult> ETCDClient::requestParsed(Command command)
+{
+    if (sessionPools.empty()) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    return requestParsed(std::move(command), blockingSessionPool());
+}
+
+std::future<ETCDClient::ParsedResult> ETCDClient::requestParsed(Command command, HttpSessionPool& pool)
+{
+    auto                      promise = std::make_shared<std::promise<ParsedResult>>();
+    std::future<ParsedResult> future  = promise->get_future();
+    HttpSession::ResponseHandler handler =
+        [promise](boost::system::error_code ec, boost::system::error_code cause,
+                  boost::beast::http::response<boost::beast::http::string_body> res) {
+            ParsedResult result;
+            result.ec    = ec;
+            result.cause = cause;
+            if (!ec) {
+                result.parsed = ETCDParsedResponse(res.body(), result.ec);
+                if (result.ec) {
+                    result.json = std::move(res.body());
+                }
+            }
+            promise->set_value(std::move(result));
+        };
+    pool.request(boost::beast::http::verb::post, command.url, std::move(command.json),
+                 std::move(handler), command.isIdempotent);
+    return future;
+}
+
+ETCDParsedResponse ETCDClient::TakeParsed(std::future<ParsedResult>& future)
+{
+    ParsedResult result = future.get();
+    if (result.ec && result.json.empty()) {
+        throw ETCDError(result.ec, result.cause);
+    }
+    if (result.ec) {
+        // the json is only appended to the message when the message is read
+        throw ETCDError(result.ec.value(), result.ec.message() + ": ", std::move(result.json));
+    }
+    return std::move(result.parsed);
+}
+
+ETCDResponse ETCDClient::sendWriteToReadCaches(Command command, bool isPut)
+{
+    using Response = boost::beast::http::response<boost::beast::http::string_body>;
+
+    // the caches see the revision of the write before the response is handed out, so that a read that
+    // follows it is answered from a cache only once the cache has it
+    auto                             promise = std::make_shared<std::promise<HttpSession::Result>>();
+    std::future<HttpSession::Result> future  = promise->get_future();
+    HttpSession::ResponseHandler handler = [promise, caches = command.readCaches,
+                                            isDelete = command.isDelete](
+                                               boost::system::error_code ec,
+                                               boost::system::error_code cause, Response res) {
+        if (ec) {
+            promise->set_value(HttpSession::Result{ec, cause, Response()});
+            return;
+        }
+        // the response gives the error etcd returned. A delete that found nothing changed no cache,
+        // which would otherwise refuse its reads until an event of its prefix came
+        const ETCDParsedResponse parsed(res.body(), ec);
+        if (!ec && (!isDelete || parsed.getDeletedCount() > 0)) {
+            for (ETCDReadCache* cache : caches) {
+                cache->noteWrite(parsed.getRevision());
+            }
+        }
+        promise->set_value(HttpSession::Result{boost::system::error_code(), cause, std::move(res)});
+    };
+
+    if (isPut && writeCoalescer && !isIoThread()) {
+        writeCoalescer->put(command.key, std::move(command.json), std::move(handler));
+    } else {
+        blockingSessionPool().request(boost::beast::http::verb::post, command.url,
+                                      std::move(command.json), std::move(handler), command.isIdempotent);
+    }
+    return ETCDResponse(std::move(future));
+}
 
-    auto session = std::make_shared<HttpSession>(io_context);
-    session->run(boost::beast::http::verb::post, address, std::to_string(port), target, jsonCommand,
-                 httpVersion);
-    ETCDResponse response(session->getResponse());
-    return response;
+void ETCDClient::asyncCommand(Command command, bool isPut, const std::string& key,
+                              std::function<void(boost::system::error_code, ETCDParsedResponse)> callback)
+{
+    if (sessionPools.empty()) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+
+    if (command.isCacheableRead) {
+        ETCDParsedResponse cached;
+        if (readFromCache(command.key, command.isRange, cached)) {
+            // the handler is never called from the initiating function
+            boost::asio::post(ioContext(),
+                              [callback, cached]() { callback(boost::system::error_code(), cached); });
+            return;
+        }
+    }
+
+    std::vector<ETCDReadCache*> writtenCaches;
+    if (command.isWrite) {
+        writtenCaches = std::move(command.readCaches);
+    }
+    HttpSession::ResponseHandler handler =
+        [callback, writtenCaches, isDelete = command.isDelete](
+            boost::system::error_code ec, boost::system::error_code /*cause*/,
+            boost::beast::http::response<boost::beast::http::string_body> res) {
+            // nothing is thrown on the io thread, so an error storm costs no unwinding; the handlers of
+            // the asynchronous functions get the error code only
+            ETCDParsedResponse parsed;
+            if (!ec) {
+                parsed = ETCDParsedResponse(res.body(), ec);
+            }
+            if (!ec && (!isDelete || parsed.getDeletedCount() > 0)) {
+                for (ETCDReadCache* cache : writtenCaches) {
+                    cache->noteWrite(parsed.getRevision());
+                }
+            }
+            callback(ec, std::move(parsed));
+        };
+
+    if (isPut && writeCoalescer) {
+        writeCoalescer->put(key, std::move(command.json), std::move(handler));
+    } else {
+        sessionPool().request(boost::beast::http::verb::post, command.url, std::move(command.json),
+                             std::move(handler), command.isIdempotent);
+    }
 }
 
 void ETCDClient::setVersionUrlPrefix(std::string str) { ETCDVersionPrefix = std::move(str); }
+
+void ETCDClient::enableWriteCoalescing(std::chrono::microseconds window, std::size_t maxBatchSize)
+{
+    if (sessionPools.empty()) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    writeCoalescer.reset(
+        new ETCDWriteCoalescer(ioContext(), sessionPool(), ETCDVersionPrefix, window, maxBatchSize));
+}
+
+void ETCDClient::enableWatchMultiplexing(unsigned streamCount)
+{
+    if (sessionPools.empty()) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    watchMultiplexer = std::make_shared<ETCDWatchMultiplexer>(ioContext(), address, std::to_string(port),
+                                                              ETCDVersionPrefix + "/watch", streamCount);
+    if (watchCallbackExecutor) {
+        watchMultiplexer->setCallbackExecutor(watchCallbackExecutor);
+    }
+}
+
+void ETCDClient::enableReadCache(const std::string& prefix)
+{
+    if (sessionPools.empty()) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    std::unique_ptr<ETCDReadCache> cache(new ETCDReadCache(*this, prefix));
+    cache->start();
+    readCaches.push_back(std::move(cache));
+}
+
+void ETCDClient::enableLeasePool(uint64_t ttl, std::size_t warmCount)
+{
+    if (!leasePool) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    if (ttl < LEASE_MIN_TTL) {
+        throw ETCDError(ETCDERROR_MIN_TTL_EXCEEDED_ERROR,
+                        "A TTL value used that is less than the minimum. Increase LEASE_MIN_TTL in the "
+                        "header if you want it higher. The API may not response though.");
+    }
+    leasePool->addBucket(ttl, warmCount);
+}
+
+std::size_t ETCDClient::leasePoolReadyCount(uint64_t ttl)
+{
+    if (!leasePool) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    return leasePool->readyCount(ttl);
+}
+
+void ETCDClient::enableWatchCallbackThreads(unsigned threadCount)
+{
+    if (sessionPools.empty()) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    if (threadCount == 0) {
+        throw ETCDError(ETCDERROR_INVALID_NUM_OF_THREADS, "Invalid number of threads");
+    }
+    callbackShards.reset(new ETCDIoShards(1, threadCount));
+    enableWatchCallbackExecutor(callbackShards->at(0).get_executor());
+}
+
+void ETCDClient::enableWatchCallbackExecutor(boost::asio::any_io_executor executor)
+{
+    if (sessionPools.empty()) {
+        throw ETCDError(ETCDERROR_INVALID_ADDRESS, "The client was not started with a valid address");
+    }
+    watchCallbackExecutor = std::move(executor);
+    if (watchMultiplexer) {
+        watchMultiplexer->setCallbackExecutor(watchCallbackExecutor);
+    }
+}
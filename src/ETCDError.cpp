@@ -2,25 +2,128 @@
 
 #include <string>
 
-ETCDError::ETCDError(long Code, const std::string& Message) : errorCode(Code), errorMsg(Message) {}
+ETCDError::ETCDError(long Code, const std::string& Message)
+    : errorCode(Code), etcdErrorCode(DEFAULT_ETCD_ERR_VALUE), errorMsg(Message)
+{
+}
 
 ETCDError::ETCDError(long Code, long EtcdErrorCode, const std::string& Message)
     : errorCode(Code), etcdErrorCode(EtcdErrorCode), errorMsg(Message)
 {
 }
 
+ETCDError::ETCDError(long Code, const std::string& Message, std::string Detail)
+    : errorCode(Code), etcdErrorCode(DEFAULT_ETCD_ERR_VALUE), errorMsg(Message),
+      detail(std::move(Detail))
+{
+}
+
+ETCDError::ETCDError(long Code, long EtcdErrorCode, const std::string& Message, std::string Detail)
+    : errorCode(Code), etcdErrorCode(EtcdErrorCode), errorMsg(Message), detail(std::move(Detail))
+{
+}
+
+ETCDError::ETCDError(boost::system::error_code ec, boost::system::error_code Cause)
+    : errorCode(ec.value()), etcdErrorCode(DEFAULT_ETCD_ERR_VALUE), errorMsg(ec.message()), cause(Cause)
+{
+}
+
 long ETCDError::getErrorCode() const { return errorCode; }
 
 long ETCDError::getEtcdErrorCode() const { return etcdErrorCode; }
 
-std::string ETCDError::getErrorMessage() const { return errorMsg; }
+std::string ETCDError::getErrorMessage() const
+{
+    if (cause) {
+        return errorMsg + detail + ": " + cause.message();
+    }
+    return errorMsg + detail;
+}
 
 const char* ETCDError::what() const noexcept
 {
     if (etcdErrorCode == DEFAULT_ETCD_ERR_VALUE) {
-        fullMessage = "Error: " + std::to_string(errorCode) + ": " + errorMsg;
+        fullMessage = "Error: " + std::to_string(errorCode) + ": " + getErrorMessage();
     } else {
-        fullMessage = "Error from ETCD response: " + std::to_string(etcdErrorCode) + ": " + errorMsg;
+        fullMessage =
+            "Error from ETCD response: " + std::to_string(etcdErrorCode) + ": " + getErrorMessage();
     }
     return fullMessage.c_str();
 }
+
+class ETCDErrorCategoryImpl : public boost::system::error_category
+{
+public:
+    const char* name() const noexcept override { return "etcd"; }
+
+    std::string message(int ev) const override
+    {
+        switch (ev) {
+        case ETCDERROR_INVALID_NUM_OF_THREADS:
+            return "Invalid number of threads";
+        case ETCDERROR_INVALID_ADDRESS:
+            return "Invalid address";
+        case ETCDERROR_FAILED_TO_READ_SOCKET:
+            return "Failed to read from socket";
+        case ETCDERROR_FAILED_TO_WRITE_SOCKET:
+            return "Failed to write to socket";
+        case ETCDERROR_FAILED_TO_RESOLVE_ADDRESS:
+            return "Failed to resolve address";
+        case ETCDERROR_FAILED_TO_CONNECT:
+            return "Failed to connect";
+        case ETCDERROR_INVALID_MSG_HEADER:
+            return "Invalid message header";
+        case ETCDERROR_INVALID_MSG_KV_CONTENT:
+            return "Invalid key-value content in message";
+        case ETCDERROR_ETCD_RETURNED_ERROR:
+            return "ETCD returned an error";
+        case ETCDERROR_FAILED_TO_READ_SOCKET_LONG_RUNNING:
+            return "Failed to read from socket for a long running session";
+        case ETCDERROR_FAILED_TO_PARSE_JSON_FROM_QUEUE:
+            return "Failed to parse json string from queue";
+        case ETCDERROR_HUGE_UNPARSED_FROM_QUEUE:
+            return "Huge unparsed json data";
+        case ETCDERROR_INVALID_JSON_STR_CLOSURE:
+            return "Invalid bracket in json string";
+        case ETCDERROR_REQUESTED_SINGLE_RESPONSE_FROM_LONG_REQUEST:
+            return "Requested a single response from a long running request";
+        case ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE:
+            return "Could not parse json message";
+        case ETCDERROR_CANCEL_WATCH_RETURNED_ERROR:
+            return "Canceling watch returned an error";
+        case ETCDERROR_MIN_TTL_EXCEEDED_ERROR:
+            return "TTL is less than the minimum";
+        case ETCDERROR_EMPTY_KEY_ERROR:
+            return "Key cannot be empty";
+        case ETCDERROR_INVALID_KEY_PREFIX_ERROR:
+            return "Invalid key prefix";
+        case ETCDERROR_INVALID_POOL_SIZE:
+            return "Invalid connection pool size";
+        case ETCDERROR_INVALID_PIPELINE_DEPTH:
+            return "Invalid pipeline depth";
+        case ETCDERROR_INVALID_WATCH_STREAM_COUNT:
+            return "Invalid number of watch streams";
+        case ETCDERROR_WATCH_STREAM_CLOSED:
+            return "The watch stream is closed";
+        case ETCDERROR_INVALID_PAGE_SIZE:
+            return "Invalid page size";
+        case ETCDERROR_INVALID_SHARD_COUNT:
+            return "Invalid shard count";
+        case ETCDERROR_LEASE_KEEPER_CLOSED:
+            return "The lease keep-alive stream is closed";
+        default:
+            return "Unknown error";
+        }
+    }
+};
+
+const boost::system::error_category& ETCDErrorCategory()
+{
+    static const ETCDErrorCategoryImpl category;
+    return category;
+}
+
+boost::system::error_code MakeETCDErrorCode(long code)
+{
+    return boost::system::error_code(static_cast<int>(code), ETCDErrorCategory());
+}
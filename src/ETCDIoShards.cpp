@@ -0,0 +1,87 @@
+#include "etcd-beast/ETCDIoShards.h"
+
+#include <algorithm>
+#include <functional>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// the shards that the calling thread runs, if any
+thread_local const ETCDIoShards* CurrentShards = nullptr;
+thread_local std::size_t         CurrentShard  = 0;
+
+void PinThread(std::size_t index)
+{
+#ifdef __linux__
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t      set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cores, &set);
+    // best effort: a thread that can't be pinned (restricted cpuset, container...) runs anywhere
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)index;
+#endif
+}
+
+} // namespace
+
+ETCDIoShards::Shard::Shard(int concurrencyHint) : ioc(concurrencyHint), work(ioc.get_executor()) {}
+
+ETCDIoShards::ETCDIoShards(unsigned shardCount, unsigned threadsPerShard, bool pinThreads)
+{
+    for (auto i = 0u; i < shardCount; ++i) {
+        shards.emplace_back(new Shard(static_cast<int>(threadsPerShard)));
+    }
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        for (auto t = 0u; t < threadsPerShard; ++t) {
+            shards[i]->threads.push_back(std::thread([this, i, pinThreads]() { run(i, pinThreads); }));
+        }
+    }
+}
+
+ETCDIoShards::~ETCDIoShards() { stop(); }
+
+void ETCDIoShards::run(std::size_t index, bool pinThread)
+{
+    CurrentShards = this;
+    CurrentShard  = index;
+    if (pinThread) {
+        PinThread(index);
+    }
+    shards[index]->ioc.run();
+}
+
+std::size_t ETCDIoShards::size() const { return shards.size(); }
+
+boost::asio::io_context& ETCDIoShards::at(std::size_t index) { return shards[index]->ioc; }
+
+std::size_t ETCDIoShards::currentIndex() const
+{
+    if (CurrentShards == this) {
+        return CurrentShard;
+    }
+    return std::hash<std::thread::id>()(std::this_thread::get_id()) % shards.size();
+}
+
+bool ETCDIoShards::isShardThread() const { return CurrentShards == this; }
+
+boost::asio::io_context& ETCDIoShards::current() { return at(currentIndex()); }
+
+void ETCDIoShards::stop()
+{
+    for (const std::unique_ptr<Shard>& shard : shards) {
+        shard->work.reset();
+    }
+    for (const std::unique_ptr<Shard>& shard : shards) {
+        for (std::thread& t : shard->threads) {
+            if (t.joinable()) {
+                t.join();
+            }
+        }
+    }
+}
@@ -0,0 +1,278 @@
+#include "etcd-beast/ETCDLeaseKeeper.h"
+
+#include "etcd-beast/ETCDError.h"
+#include "etcd-beast/ETCDParsedResponse.h"
+#include "etcd-beast/ETCDRequestBody.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+
+// a turn of the wheel; renewals further away wait for more turns
+const std::size_t WheelSize = 512;
+
+// etcd's clientv3 renews at a third of the TTL too, which leaves two tries before the lease expires
+std::chrono::milliseconds RenewDelay(uint64_t ttl) { return std::chrono::milliseconds(ttl * 1000 / 3); }
+
+} // namespace
+
+ETCDLeaseKeeper::ETCDLeaseKeeper(boost::asio::io_context& ioc, const std::string& host,
+                                 const std::string& port, const std::string& target,
+                                 std::chrono::milliseconds tick)
+    : ioc_(ioc), host_(host), port_(port), target_(target),
+      tick_(std::max(tick, std::chrono::milliseconds(1))), wheel(WheelSize)
+{
+}
+
+ETCDLeaseKeeper::~ETCDLeaseKeeper() { close(); }
+
+void ETCDLeaseKeeper::schedule(uint64_t leaseId, Lease& lease, std::chrono::milliseconds delay)
+{
+    // the renewals scheduled before are stale; they're dropped when their slot comes
+    lease.generation++;
+    const uint64_t ticks = std::max<uint64_t>(1, (delay.count() + tick_.count() - 1) / tick_.count());
+    wheel[(currentSlot + ticks) % wheel.size()].push_back(
+        WheelEntry{leaseId, lease.generation, (ticks - 1) / wheel.size()});
+}
+
+void ETCDLeaseKeeper::renew(uint64_t leaseId)
+{
+    if (!session) {
+        // a reconnecting stream renews all the leases once it's connected
+        if (reconnectTimer) {
+            return;
+        }
+        startStream();
+    }
+    session->write_message(ETCDRequestBody().raw(R"({"ID": ")").number(leaseId).raw(R"("})").str());
+}
+
+void ETCDLeaseKeeper::startTicking()
+{
+    if (!tickTimer) {
+        tickTimer.reset(new boost::asio::steady_timer(ioc_));
+    }
+    std::weak_ptr<ETCDLeaseKeeper> weakSelf = shared_from_this();
+    tickTimer->expires_after(tick_);
+    tickTimer->async_wait([weakSelf](boost::system::error_code ec) {
+        if (auto self = weakSelf.lock()) {
+            if (!ec) {
+                self->onTick();
+            }
+        }
+    });
+}
+
+void ETCDLeaseKeeper::onTick()
+{
+    std::vector<std::pair<uint64_t, ExpiryCallback>> expired;
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        if (isClosed || !tickTimer) {
+            return;
+        }
+        currentSlot = (currentSlot + 1) % wheel.size();
+        std::vector<WheelEntry> due;
+        due.swap(wheel[currentSlot]);
+        const Clock::time_point now = Clock::now();
+        for (const WheelEntry& entry : due) {
+            auto it = leases.find(entry.leaseId);
+            if (it == leases.end() || it->second.generation != entry.generation) {
+                continue;
+            }
+            if (entry.rounds > 0) {
+                wheel[currentSlot].push_back(
+                    WheelEntry{entry.leaseId, entry.generation, entry.rounds - 1});
+                continue;
+            }
+            Lease& lease = it->second;
+            if (now >= lease.expiresAt) {
+                expired.emplace_back(it->first, std::move(lease.onExpired));
+                leases.erase(it);
+                continue;
+            }
+            renew(entry.leaseId);
+            // sent again if it isn't answered, until the lease expires
+            const auto untilExpiry =
+                std::chrono::duration_cast<std::chrono::milliseconds>(lease.expiresAt - now);
+            schedule(entry.leaseId, lease, std::min(RenewDelay(lease.ttl), untilExpiry));
+        }
+
+        if (leases.empty()) {
+            // ticking again when a lease is added
+            tickTimer.reset();
+            for (std::vector<WheelEntry>& slot : wheel) {
+                slot.clear();
+            }
+        } else {
+            startTicking();
+        }
+    }
+    CallExpired(expired);
+}
+
+void ETCDLeaseKeeper::startStream()
+{
+    static const int httpVersion = 11; // http 1.1
+
+    std::weak_ptr<ETCDLeaseKeeper> weakSelf = shared_from_this();
+    const uint64_t                 id       = nextSessionId++;
+    sessionId                               = id;
+    session                                 = std::make_shared<HttpSession>(ioc_);
+    session->setStreamEndHandler([weakSelf, id](boost::system::error_code) {
+        if (auto self = weakSelf.lock()) {
+            self->onStreamEnd(id);
+        }
+    });
+    session->runStreamingRequest(boost::beast::http::verb::post, host_, port_, target_, httpVersion,
+                                 [weakSelf, id](boost::string_view message) {
+                                     if (auto self = weakSelf.lock()) {
+                                         self->onMessage(message, id);
+                                     }
+                                 });
+}
+
+void ETCDLeaseKeeper::onMessage(boost::string_view message, uint64_t id)
+{
+    boost::system::error_code ec;
+    ETCDParsedResponse        response(message, ec);
+    if (ec) {
+        // an error of the stream; the leases it was about are sent again
+        return;
+    }
+
+    std::vector<std::pair<uint64_t, ExpiryCallback>> expired;
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        if (isClosed || id != sessionId) {
+            return;
+        }
+        reconnectAttempts = 0;
+        auto it           = leases.find(response.getLeaseId());
+        if (it == leases.end()) {
+            return;
+        }
+        Lease& lease = it->second;
+        if (response.getTTL() == 0) {
+            // revoked, or expired before it was renewed
+            expired.emplace_back(it->first, std::move(lease.onExpired));
+            leases.erase(it);
+        } else {
+            lease.ttl       = response.getTTL();
+            lease.expiresAt = Clock::now() + std::chrono::seconds(lease.ttl);
+            schedule(it->first, lease, RenewDelay(lease.ttl));
+        }
+    }
+    CallExpired(expired);
+}
+
+void ETCDLeaseKeeper::onStreamEnd(uint64_t id)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    if (isClosed || id != sessionId) {
+        return;
+    }
+    session.reset();
+    // the next add() connects a stream without leases again
+    if (leases.empty()) {
+        return;
+    }
+
+    // full jitter between half the backoff and the backoff, like the watch streams
+    static thread_local std::mt19937 generator{std::random_device()()};
+    const unsigned                   shift = std::min(reconnectAttempts++, 16u);
+    const auto                       backoff =
+        std::min(maxReconnectDelay, std::chrono::milliseconds(minReconnectDelay.count() << shift));
+    std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(backoff.count() / 2,
+                                                                          backoff.count());
+
+    std::weak_ptr<ETCDLeaseKeeper> weakSelf = shared_from_this();
+    reconnectTimer = std::make_shared<boost::asio::steady_timer>(ioc_);
+    reconnectTimer->expires_after(std::chrono::milliseconds(jitter(generator)));
+    reconnectTimer->async_wait([weakSelf](boost::system::error_code ec) {
+        if (auto self = weakSelf.lock()) {
+            if (!ec) {
+                self->reconnect();
+            }
+        }
+    });
+}
+
+void ETCDLeaseKeeper::reconnect()
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    reconnectTimer.reset();
+    if (isClosed) {
+        return;
+    }
+    startStream();
+    for (const auto& l : leases) {
+        renew(l.first);
+    }
+}
+
+void ETCDLeaseKeeper::CallExpired(std::vector<std::pair<uint64_t, ExpiryCallback>>& expired)
+{
+    for (std::pair<uint64_t, ExpiryCallback>& e : expired) {
+        if (e.second) {
+            e.second(e.first);
+        }
+    }
+}
+
+void ETCDLeaseKeeper::add(uint64_t leaseId, uint64_t ttl, ExpiryCallback onExpired)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    if (isClosed) {
+        throw ETCDError(ETCDERROR_LEASE_KEEPER_CLOSED, "Leases can't be kept alive by a closed client");
+    }
+    Lease& lease    = leases[leaseId];
+    lease.ttl       = ttl;
+    lease.onExpired = std::move(onExpired);
+    // until the first renewal is answered, the lease is taken as just granted
+    lease.expiresAt = Clock::now() + std::chrono::seconds(ttl);
+    renew(leaseId);
+    schedule(leaseId, lease, RenewDelay(ttl));
+    if (!tickTimer) {
+        startTicking();
+    }
+}
+
+void ETCDLeaseKeeper::remove(uint64_t leaseId)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    leases.erase(leaseId);
+}
+
+bool ETCDLeaseKeeper::isKept(uint64_t leaseId)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    return leases.count(leaseId) != 0;
+}
+
+std::size_t ETCDLeaseKeeper::size()
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    return leases.size();
+}
+
+void ETCDLeaseKeeper::close()
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    isClosed = true;
+    if (session) {
+        session->cancel();
+    }
+    if (reconnectTimer) {
+        reconnectTimer->cancel();
+    }
+    tickTimer.reset();
+}
+
+void ETCDLeaseKeeper::setReconnectDelays(std::chrono::milliseconds minDelay,
+                                         std::chrono::milliseconds maxDelay)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    minReconnectDelay = std::max(minDelay, std::chrono::milliseconds(1));
+    maxReconnectDelay = std::max(maxDelay, minReconnectDelay);
+}
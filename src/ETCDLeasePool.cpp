@@ -0,0 +1,152 @@
+#include "etcd-beast/ETCDLeasePool.h"
+
+#include "etcd-beast/ETCDClient.h"
+#include <algorithm>
+
+ETCDLeasePool::ETCDLeasePool(ETCDClient& Client) : client(&Client) {}
+
+void ETCDLeasePool::keep(uint64_t ttl, uint64_t leaseId)
+{
+    // the keeper doesn't hold its lock while it calls back, so this may be called under the lock
+    client->leaseKeepAlive(leaseId, ttl, [this, ttl](uint64_t id) { onExpired(ttl, id); });
+}
+
+uint64_t ETCDLeasePool::grant(uint64_t ttl) { return client->leaseGrant(ttl).wait().getLeaseId(); }
+
+void ETCDLeasePool::refill(uint64_t ttl)
+{
+    std::size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto                        it = buckets.find(ttl);
+        if (isStopped || it == buckets.end()) {
+            return;
+        }
+        Bucket& bucket = it->second;
+        while (bucket.warm.size() + bucket.pending < bucket.warmCount) {
+            bucket.pending++;
+            count++;
+        }
+    }
+    // outside the lock, in case a failed request calls its handler right away
+    for (std::size_t i = 0; i < count; i++) {
+        client->leaseGrant(ttl, [this, ttl](boost::system::error_code ec, ETCDParsedResponse response) {
+            onGranted(ttl, ec, response);
+        });
+    }
+}
+
+void ETCDLeasePool::onGranted(uint64_t ttl, boost::system::error_code ec,
+                              const ETCDParsedResponse& response)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    Bucket&                     bucket = buckets[ttl];
+    bucket.pending--;
+    // after an error, the bucket is filled again by the next checkOut() or sharedLease()
+    if (isStopped || ec) {
+        return;
+    }
+    bucket.warm.push_back(response.getLeaseId());
+    keep(ttl, response.getLeaseId());
+}
+
+void ETCDLeasePool::onExpired(uint64_t ttl, uint64_t leaseId)
+{
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto                        it = buckets.find(ttl);
+        if (it == buckets.end()) {
+            return;
+        }
+        Bucket& bucket = it->second;
+        bucket.warm.erase(std::remove(bucket.warm.begin(), bucket.warm.end(), leaseId),
+                          bucket.warm.end());
+        if (bucket.shared == leaseId) {
+            // the keys of the shared lease are gone with it; the next keys get a ready lease
+            bucket.shared = 0;
+            if (!bucket.warm.empty()) {
+                bucket.shared = bucket.warm.front();
+                bucket.warm.pop_front();
+            }
+        }
+    }
+    refill(ttl);
+}
+
+void ETCDLeasePool::addBucket(uint64_t ttl, std::size_t warmCount)
+{
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        buckets[ttl].warmCount = warmCount;
+    }
+    refill(ttl);
+}
+
+uint64_t ETCDLeasePool::checkOut(uint64_t ttl, ETCDLeaseKeeper::ExpiryCallback onExpired)
+{
+    uint64_t leaseId = 0;
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto                        it = buckets.find(ttl);
+        if (it != buckets.end() && !it->second.warm.empty()) {
+            leaseId = it->second.warm.front();
+            it->second.warm.pop_front();
+            // the keep-alive goes on, with the callback of the caller
+            client->leaseKeepAlive(leaseId, ttl, std::move(onExpired));
+        }
+    }
+    // an empty bucket is refilled too: its grants may have failed, while etcd was out of reach
+    refill(ttl);
+    if (leaseId != 0) {
+        return leaseId;
+    }
+
+    leaseId = grant(ttl);
+    client->leaseKeepAlive(leaseId, ttl, std::move(onExpired));
+    return leaseId;
+}
+
+uint64_t ETCDLeasePool::sharedLease(uint64_t ttl)
+{
+    uint64_t promoted = 0;
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        Bucket&                     bucket = buckets[ttl];
+        if (bucket.shared != 0) {
+            return bucket.shared;
+        }
+        if (!bucket.warm.empty()) {
+            bucket.shared = promoted = bucket.warm.front();
+            bucket.warm.pop_front();
+        }
+    }
+    refill(ttl);
+    if (promoted != 0) {
+        return promoted;
+    }
+
+    const uint64_t              leaseId = grant(ttl);
+    std::lock_guard<std::mutex> lg(mtx);
+    Bucket&                     bucket = buckets[ttl];
+    keep(ttl, leaseId);
+    // another thread may have set the shared lease meanwhile; then this one is ready for checkOut()
+    if (bucket.shared == 0) {
+        bucket.shared = leaseId;
+    } else {
+        bucket.warm.push_back(leaseId);
+    }
+    return bucket.shared;
+}
+
+std::size_t ETCDLeasePool::readyCount(uint64_t ttl)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    auto                        it = buckets.find(ttl);
+    return it == buckets.end() ? 0 : it->second.warm.size();
+}
+
+void ETCDLeasePool::stop()
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    isStopped = true;
+}
@@ -1,85 +1,40 @@
 #include "etcd-beast/ETCDParsedResponse.h"
 
-#include "etcd-beast/ETCDError.h"
-#include <boost/beast/core/detail/base64.hpp>
+#include "etcd-beast/ETCDResponseDecoder.h"
+#include <algorithm>
 
-std::string FromBase64(const std::string& str)
+ETCDParsedResponse::ETCDParsedResponse(boost::string_view RawJsonString)
 {
-#if BOOST_VERSION >= 107100
-    std::string result;
-    std::size_t size = boost::beast::detail::base64::decoded_size(str.size());
-    result.resize(size);
-    std::size_t writtenSize;
-    std::size_t readSize;
-    std::tie(writtenSize, readSize) =
-        boost::beast::detail::base64::decode((void*)result.data(), str.data(), str.size());
-    result.resize(writtenSize);
-    return result;
-#else
-    return boost::beast::detail::base64_encode(str);
-#endif
+    if (!RawJsonString.empty()) {
+        parse(RawJsonString);
+    }
 }
 
-ETCDParsedResponse::ETCDParsedResponse(const std::string RawJsonString)
-    : rawJsonString(std::move(RawJsonString))
+ETCDParsedResponse::ETCDParsedResponse(boost::string_view RawJsonString, boost::system::error_code& ec)
 {
-    if (!rawJsonString.empty()) {
-        parse();
+    ec.clear();
+    if (!RawJsonString.empty() && !parse(RawJsonString, ec)) {
+        *this = ETCDParsedResponse();
     }
 }
 
-void ETCDParsedResponse::parse()
+void ETCDParsedResponse::reset(std::size_t jsonSize)
 {
-    Json::Value v;
-    {
-        Json::Reader r;
-        if (!r.parse(rawJsonString, v)) {
-            throw ETCDError(ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE,
-                            "Could not parse json message: " + rawJsonString);
-        }
-    }
-
-    __processIfError(v);
-
-    __verifyHeaderContent(v, rawJsonString);
-    clusterId = std::stoull(v["header"]["cluster_id"].asString());
-    memberId  = std::stoull(v["header"]["member_id"].asString());
-    revision  = std::stoull(v["header"]["revision"].asString());
-    raftTerm  = std::stoull(v["header"]["raft_term"].asString());
-
-    // lease response
-    if (v.isMember("ID") && v.isMember("TTL")) {
-        leaseId  = std::stoull(v["ID"].asString());
-        leaseTtl = std::stoull(v["TTL"].asString());
-    }
-    if (v.isMember("grantedTTL")) {
-        leaseGrantedTtl = std::stoull(v["grantedTTL"].asString());
-    }
-
-    kvEntriesVec.clear();
-    kvEntriesMap.clear();
-
-    // get response
-    if (v.isMember("kvs")) {
-        const auto& kvs = v["kvs"];
-        for (unsigned i = 0; i < kvs.size(); i++) {
-            kvEntriesVec.push_back(parseSingleKvEntry(kvs[i]));
-        }
-    }
+    // decoded keys and values are at most 3/4 of the json, which is a good first block for small responses
+    storage = std::make_shared<Storage>(std::min<std::size_t>(jsonSize * 3 / 4, 64 * 1024));
+    txnResponses.clear();
+}
 
-    // watch callback
-    if (v.isMember("events")) {
-        const auto& events = v["events"];
-        for (unsigned i = 0; i < events.size(); i++) {
-            if (events[i].isMember("kv")) {
-                kvEntriesVec.push_back(parseSingleKvEntry(events[i]["kv"]));
-            }
-        }
-    }
+void ETCDParsedResponse::parse(boost::string_view rawJsonString)
+{
+    reset(rawJsonString.size());
+    ETCDResponseDecoder(rawJsonString).decodeInto(*this);
+}
 
-    for (const KVEntry& kv : kvEntriesVec) {
-        kvEntriesMap[kv.key] = kv;
-    }
+bool ETCDParsedResponse::parse(boost::string_view rawJsonString, boost::system::error_code& ec)
+{
+    reset(rawJsonString.size());
+    return ETCDResponseDecoder(rawJsonString).decodeInto(*this, ec);
 }
 
 uint64_t ETCDParsedResponse::getRaftTerm() const { return raftTerm; }
@@ -90,75 +45,88 @@ uint64_t ETCDParsedResponse::getMemberId() const { return memberId; }
 
 uint64_t ETCDParsedResponse::getClusterId() const { return clusterId; }
 
+uint64_t ETCDParsedResponse::getCount() const { return count; }
+
+bool ETCDParsedResponse::isMore() const { return more; }
+
+uint64_t ETCDParsedResponse::getDeletedCount() const { return deleted; }
+
 uint64_t ETCDParsedResponse::getLeaseId() const { return leaseId; }
 
 uint64_t ETCDParsedResponse::getTTL() const { return leaseTtl; }
 
 uint64_t ETCDParsedResponse::getGrantedTTL() const { return leaseGrantedTtl; }
 
-ETCDParsedResponse::KVEntry ETCDParsedResponse::parseSingleKvEntry(const Json::Value& kvVal)
-{
-    __verifyKVEntryContent(kvVal);
-    KVEntry result;
-    result.create_revision = kvVal["create_revision"].asString();
-    result.mod_revision    = kvVal["mod_revision"].asString();
-    result.version         = kvVal["version"].asString();
-    result.key             = FromBase64(kvVal["key"].asString());
-    // value may not appear if it's empty
-    if (kvVal.isMember("value")) {
-        result.value = FromBase64(kvVal["value"].asString());
-    } else {
-        result.value = "";
-    }
+bool ETCDParsedResponse::isTxnSucceeded() const { return txnSucceeded; }
 
-    return result;
-}
-
-void ETCDParsedResponse::__verifyHeaderContent(const Json::Value& v, const std::string& vStr)
+const std::vector<ETCDParsedResponse::TxnResponse>& ETCDParsedResponse::getTxnResponses() const
 {
-    if (!v.isMember("header")) {
-        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No header found in: " + vStr);
-    }
-    if (!v["header"].isMember("cluster_id")) {
-        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No cluster id in: " + vStr);
-    }
-    if (!v["header"].isMember("member_id")) {
-        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No member id in: " + vStr);
-    }
-    if (!v["header"].isMember("revision")) {
-        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No revision in: " + vStr);
-    }
-    if (!v["header"].isMember("raft_term")) {
-        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No raft term in: " + vStr);
-    }
+    return txnResponses;
 }
 
-void ETCDParsedResponse::__verifyKVEntryContent(const Json::Value& kvVal)
+uint64_t ETCDParsedResponse::getWatchId() const { return watchId; }
+
+bool ETCDParsedResponse::isWatchCreated() const { return watchCreated; }
+
+bool ETCDParsedResponse::isWatchCanceled() const { return watchCanceled; }
+
+uint64_t ETCDParsedResponse::getCompactRevision() const { return compactRevision; }
+
+ETCDParsedResponse ETCDParsedResponse::Concat(std::vector<ETCDParsedResponse> parts)
 {
-    if (!kvVal.isMember("key")) {
-        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No key id in: " + __jsonToString(kvVal));
-    }
-    if (!kvVal.isMember("create_revision")) {
-        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No create_revision in: " + __jsonToString(kvVal));
-    }
-    if (!kvVal.isMember("mod_revision")) {
-        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No mod_revision in: " + __jsonToString(kvVal));
-    }
-    if (!kvVal.isMember("version")) {
-        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No version in: " + __jsonToString(kvVal));
+    ETCDParsedResponse result;
+    if (parts.empty()) {
+        return result;
+    }
+    result           = parts.front();
+    result.storage   = std::make_shared<Storage>(64);
+    result.count     = 0;
+    std::size_t size = 0;
+    for (const ETCDParsedResponse& part : parts) {
+        size += part.getKVEntriesVec().size();
+    }
+    result.storage->kvEntriesVec.reserve(size);
+    for (ETCDParsedResponse& part : parts) {
+        const std::vector<KVEntry>& kvs = part.getKVEntriesVec();
+        result.storage->kvEntriesVec.insert(result.storage->kvEntriesVec.end(), kvs.begin(), kvs.end());
+        result.count += part.count;
+        if (part.storage) {
+            result.storage->parts.push_back(std::move(part.storage));
+        }
     }
-    // value may not appear if it's empty
+    return result;
 }
 
-void ETCDParsedResponse::__processIfError(const Json::Value& v)
+ETCDParsedResponse ETCDParsedResponse::CoalesceEvents(std::vector<ETCDParsedResponse> messages)
 {
-    if (v.isMember("error")) {
-        Json::FastWriter w;
-        int              errorCode = v.isMember("code") ? v["code"].asInt() : -1;
-        std::string      msg       = v["error"].isString() ? v["error"].asString() : w.write(v);
-        throw ETCDError(ETCDERROR_ETCD_RETURNED_ERROR, errorCode,
-                        "ETCD returned an error: " + msg + "; Full json response: " + w.write(v));
+    ETCDParsedResponse result;
+    if (messages.empty()) {
+        return result;
+    }
+    result         = messages.back();
+    result.storage = std::make_shared<Storage>(64);
+
+    // the position of the last event of each key, among the events of all the messages
+    std::unordered_map<boost::string_view, std::size_t, boost::hash<boost::string_view>> lastEvents;
+    std::size_t                                                                         position = 0;
+    for (const ETCDParsedResponse& message : messages) {
+        for (const Event& event : message.getEvents()) {
+            lastEvents[event.kv.key] = position++;
+        }
     }
+    position = 0;
+    for (ETCDParsedResponse& message : messages) {
+        for (const Event& event : message.getEvents()) {
+            if (lastEvents[event.kv.key] == position++) {
+                result.storage->events.push_back(event);
+                result.storage->kvEntriesVec.push_back(event.kv);
+            }
+        }
+        if (message.storage) {
+            result.storage->parts.push_back(std::move(message.storage));
+        }
+    }
+    return result;
 }
 
 std::string ETCDParsedResponse::__jsonToString(const Json::Value& v)
@@ -169,11 +137,28 @@ std::string ETCDParsedResponse::__jsonToString(const Json::Value& v)
 
 const std::vector<ETCDParsedResponse::KVEntry>& ETCDParsedResponse::getKVEntriesVec() const
 {
-    return kvEntriesVec;
+    static const std::vector<KVEntry> empty;
+    return storage ? storage->kvEntriesVec : empty;
+}
+
+const std::vector<ETCDParsedResponse::Event>& ETCDParsedResponse::getEvents() const
+{
+    static const std::vector<Event> empty;
+    return storage ? storage->events : empty;
 }
 
-const std::unordered_map<std::string, ETCDParsedResponse::KVEntry>&
-ETCDParsedResponse::getKVEntriesMap() const
+const ETCDParsedResponse::KVEntriesMap& ETCDParsedResponse::getKVEntriesMap() const
 {
-    return kvEntriesMap;
+    static const KVEntriesMap empty;
+    if (!storage) {
+        return empty;
+    }
+    Storage& s = *storage;
+    std::call_once(s.kvEntriesMapBuilt, [&s]() {
+        s.kvEntriesMap.reserve(s.kvEntriesVec.size());
+        for (const KVEntry& kv : s.kvEntriesVec) {
+            s.kvEntriesMap[kv.key] = kv;
+        }
+    });
+    return s.kvEntriesMap;
 }
@@ -0,0 +1,63 @@
+#include "etcd-beast/ETCDRangeIterator.h"
+
+#include "etcd-beast/ETCDClient.h"
+#include "etcd-beast/ETCDError.h"
+#include "etcd-beast/ETCDRequestBody.h"
+
+ETCDRangeIterator::ETCDRangeIterator(ETCDClient& Client, const std::string& prefix, std::size_t pageSize)
+    : client(&Client), prefix_(prefix), pageSize_(pageSize)
+{
+    if (pageSize == 0) {
+        throw ETCDError(ETCDERROR_INVALID_PAGE_SIZE, "The page size of a range must be at least 1");
+    }
+}
+
+ETCDResponse ETCDRangeIterator::requestPage(const std::string& fromKey)
+{
+    ETCDRequestBody body;
+    body.raw(R"({"key": ")").base64(fromKey).raw(R"(", "range_end": ")").base64RangeEnd(prefix_);
+    body.raw(R"(", "limit": ")").number(pageSize_);
+    if (revision != 0) {
+        body.raw(R"(", "revision": ")").number(revision);
+    }
+    body.raw(R"("})");
+    return client->sendCommand(ETCDClient::Command{client->ETCDVersionPrefix + "/kv/range", body.str()});
+}
+
+void ETCDRangeIterator::prefetchNextPage()
+{
+    const std::vector<ETCDParsedResponse::KVEntry>& kvs = current->getKVEntriesVec();
+    if (!current->isMore() || kvs.empty()) {
+        return;
+    }
+    // the smallest key after the last one
+    std::string fromKey(kvs.back().key.data(), kvs.back().key.size());
+    fromKey.push_back('\0');
+    prefetched.emplace(requestPage(fromKey));
+}
+
+bool ETCDRangeIterator::next()
+{
+    if (!isStarted) {
+        isStarted = true;
+        current.emplace(requestPage(prefix_));
+        revision = current->wait().getRevision();
+    } else if (prefetched) {
+        current = std::move(prefetched);
+        prefetched.reset();
+        current->wait();
+    } else {
+        current.reset();
+        return false;
+    }
+    prefetchNextPage();
+    return !current->getKVEntriesVec().empty();
+}
+
+const std::vector<ETCDParsedResponse::KVEntry>& ETCDRangeIterator::getKVEntriesVec()
+{
+    static const std::vector<ETCDParsedResponse::KVEntry> empty;
+    return current ? current->getKVEntriesVec() : empty;
+}
+
+uint64_t ETCDRangeIterator::getRevision() const { return revision; }
@@ -0,0 +1,210 @@
+#include "etcd-beast/ETCDReadCache.h"
+
+#include "etcd-beast/ETCDClient.h"
+#include "etcd-beast/ETCDError.h"
+#include <cstring>
+
+ETCDReadCache::ETCDReadCache(ETCDClient& Client, const std::string& prefix)
+    : client(&Client), prefix_(prefix)
+{
+}
+
+ETCDReadCache::~ETCDReadCache() { stop(); }
+
+void ETCDReadCache::start()
+{
+    // not registered in the client yet, so this isn't read from the cache itself
+    ETCDResponse range = client->getAll(prefix_).wait();
+
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(mtx);
+        load(ETCDParsedResponse(range.getJsonResponse()));
+        startWatch();
+    }
+    watch->wait();
+}
+
+void ETCDReadCache::stop()
+{
+    std::unique_ptr<ETCDWatch> old; // destroyed after the lock is released
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(mtx);
+        isStopped = true;
+        isLoaded  = false;
+        old       = std::move(watch);
+        if (retryTimer) {
+            retryTimer->cancel();
+        }
+    }
+}
+
+void ETCDReadCache::load(const ETCDParsedResponse& range)
+{
+    entries.clear();
+    for (const ETCDParsedResponse::KVEntry& kv : range.getKVEntriesVec()) {
+        Entry& entry          = entries[std::string(kv.key)];
+        entry.value           = std::string(kv.value);
+        entry.create_revision = kv.create_revision;
+        entry.mod_revision    = kv.mod_revision;
+        entry.version         = kv.version;
+    }
+    revision  = range.getRevision();
+    clusterId = range.getClusterId();
+    memberId  = range.getMemberId();
+    raftTerm  = range.getRaftTerm();
+    isLoaded  = true;
+}
+
+std::unique_ptr<ETCDWatch> ETCDReadCache::startWatch()
+{
+    ETCDWatchOptions options;
+    options.prefix         = true;
+    options.startRevision  = revision + 1;
+    options.progressNotify = true; // moves the revision on while the prefix doesn't change
+    std::unique_ptr<ETCDWatch> old = std::move(watch);
+    watch.reset(new ETCDWatch(
+        client->watch(prefix_, options, [this](ETCDParsedResponse message) { onMessage(message); })));
+    return old;
+}
+
+void ETCDReadCache::onMessage(const ETCDParsedResponse& message)
+{
+    if (message.isWatchCreated()) {
+        return;
+    }
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(mtx);
+        if (!message.isWatchCanceled()) {
+            for (const ETCDParsedResponse::Event& event : message.getEvents()) {
+                // the events of a revision come in one message, so a revision is all in or all out
+                if (event.kv.mod_revision <= revision) {
+                    continue;
+                }
+                if (event.type == ETCDParsedResponse::Event::Type::Delete) {
+                    entries.erase(std::string(event.kv.key));
+                } else {
+                    Entry& entry          = entries[std::string(event.kv.key)];
+                    entry.value           = std::string(event.kv.value);
+                    entry.create_revision = event.kv.create_revision;
+                    entry.mod_revision    = event.kv.mod_revision;
+                    entry.version         = event.kv.version;
+                }
+            }
+            if (!message.getEvents().empty()) {
+                revision = std::max(revision, message.getEvents().back().kv.mod_revision);
+            } else {
+                // a progress notification: all the changes up to its revision were sent
+                revision = std::max(revision, message.getRevision());
+            }
+            raftTerm = std::max(raftTerm, message.getRaftTerm());
+            return;
+        }
+        // the watch ended, most likely because the revision to resume from was compacted
+        isLoaded = false;
+        if (isStopped) {
+            return;
+        }
+    }
+    reload();
+}
+
+void ETCDReadCache::reload()
+{
+    // the cache isn't loaded, so this goes to the server
+    client->asyncCommand(client->getAllCommand(prefix_), false, prefix_,
+                         [this](boost::system::error_code ec, ETCDParsedResponse range) {
+                             std::unique_ptr<ETCDWatch> old; // destroyed after the lock is released
+                             std::unique_lock<std::shared_timed_mutex> lock(mtx);
+                             if (isStopped) {
+                                 return;
+                             }
+                             if (ec) {
+                                 // the reads go to the server (and fail) until it's back
+                                 retryTimer.reset(new boost::asio::steady_timer(client->ioContext()));
+                                 retryTimer->expires_after(std::chrono::seconds(1));
+                                 retryTimer->async_wait([this](boost::system::error_code ec) {
+                                     if (!ec) {
+                                         reload();
+                                     }
+                                 });
+                                 return;
+                             }
+                             load(range);
+                             old = startWatch();
+                         });
+}
+
+const std::string& ETCDReadCache::getPrefix() const { return prefix_; }
+
+bool ETCDReadCache::covers(boost::string_view key) const
+{
+    return key.substr(0, prefix_.size()) == prefix_;
+}
+
+bool ETCDReadCache::overlaps(boost::string_view key, bool isRange) const
+{
+    if (covers(key)) {
+        return true;
+    }
+    // a range of a shorter prefix may contain the prefix of the cache
+    return isRange && boost::string_view(prefix_).substr(0, key.size()) == key;
+}
+
+bool ETCDReadCache::read(const std::string& key, bool isRange, ETCDParsedResponse& out) const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(mtx);
+    if (!isLoaded || !watch || !watch->isLive() || revision < minRevision.load()) {
+        return false;
+    }
+
+    auto first = entries.lower_bound(key);
+    auto last  = first;
+    if (isRange) {
+        while (last != entries.end() && last->first.compare(0, key.size(), key) == 0) {
+            ++last;
+        }
+    } else if (last != entries.end() && last->first == key) {
+        ++last;
+    }
+
+    std::size_t size = 0;
+    for (auto it = first; it != last; ++it) {
+        size += it->first.size() + it->second.value.size();
+    }
+    ETCDParsedResponse response;
+    response.clusterId = clusterId;
+    response.memberId  = memberId;
+    response.revision  = revision;
+    response.raftTerm  = raftTerm;
+    response.storage   = std::make_shared<ETCDParsedResponse::Storage>(std::max<std::size_t>(size, 64));
+    auto copy          = [&response](const std::string& s) {
+        char* dest = response.storage->arena.allocate(s.size());
+        std::memcpy(dest, s.data(), s.size());
+        return boost::string_view(dest, s.size());
+    };
+    for (auto it = first; it != last; ++it) {
+        ETCDParsedResponse::KVEntry kv;
+        kv.key             = copy(it->first);
+        kv.value           = copy(it->second.value);
+        kv.create_revision = it->second.create_revision;
+        kv.mod_revision    = it->second.mod_revision;
+        kv.version         = it->second.version;
+        response.storage->kvEntriesVec.push_back(kv);
+    }
+    response.count = response.storage->kvEntriesVec.size();
+    out = std::move(response);
+    return true;
+}
+
+void ETCDReadCache::noteWrite(uint64_t revision)
+{
+    uint64_t current = minRevision.load();
+    while (current < revision && !minRevision.compare_exchange_weak(current, revision)) {
+    }
+}
+
+uint64_t ETCDReadCache::getRevision() const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(mtx);
+    return revision;
+}
@@ -0,0 +1,93 @@
+#include "etcd-beast/ETCDRequestBody.h"
+
+#include "etcd-beast/ETCDBase64.h"
+#include <cstring>
+
+namespace {
+
+struct ThreadBuffer
+{
+    std::string buffer;
+    bool        inUse = false;
+};
+
+thread_local ThreadBuffer threadBuffer;
+
+// a buffer that grew for a huge value isn't kept for the life of the thread
+const std::size_t MaxRetainedBufferCapacity = 1 << 20;
+
+} // namespace
+
+ETCDRequestBody::ETCDRequestBody() : usesThreadBuffer(!threadBuffer.inUse)
+{
+    if (usesThreadBuffer) {
+        threadBuffer.inUse = true;
+        buffer             = &threadBuffer.buffer;
+        buffer->clear();
+    } else {
+        buffer = &ownBuffer;
+    }
+}
+
+ETCDRequestBody::~ETCDRequestBody()
+{
+    if (usesThreadBuffer) {
+        if (buffer->capacity() > MaxRetainedBufferCapacity) {
+            std::string().swap(*buffer);
+        }
+        threadBuffer.inUse = false;
+    }
+}
+
+ETCDRequestBody& ETCDRequestBody::raw(boost::string_view text)
+{
+    buffer->append(text.data(), text.size());
+    return *this;
+}
+
+ETCDRequestBody& ETCDRequestBody::base64(boost::string_view data)
+{
+    const std::size_t start = buffer->size();
+    buffer->resize(start + ETCDBase64::EncodedSize(data.size()));
+    const std::size_t written = ETCDBase64::Encode(&(*buffer)[start], data.data(), data.size());
+    buffer->resize(start + written);
+    return *this;
+}
+
+ETCDRequestBody& ETCDRequestBody::base64RangeEnd(boost::string_view prefix)
+{
+    // the range end is built after the body, encoded after itself and then moved in place
+    const std::size_t start = buffer->size();
+    std::size_t       len   = prefix.size();
+    while (len > 0 && static_cast<unsigned char>(prefix[len - 1]) == 0xff) {
+        len--;
+    }
+    const std::size_t rangeEndSize = len > 0 ? len : 1;
+    buffer->resize(start + rangeEndSize + ETCDBase64::EncodedSize(rangeEndSize));
+    char* rangeEnd = &(*buffer)[start];
+    if (len > 0) {
+        std::memcpy(rangeEnd, prefix.data(), len);
+        rangeEnd[len - 1] = static_cast<char>(static_cast<unsigned char>(rangeEnd[len - 1]) + 1);
+    } else {
+        rangeEnd[0] = '\0';
+    }
+    const std::size_t written = ETCDBase64::Encode(rangeEnd + rangeEndSize, rangeEnd, rangeEndSize);
+    std::memmove(rangeEnd, rangeEnd + rangeEndSize, written);
+    buffer->resize(start + written);
+    return *this;
+}
+
+ETCDRequestBody& ETCDRequestBody::number(uint64_t value)
+{
+    char  digits[20];
+    char* end = digits + sizeof(digits);
+    char* p   = end;
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    buffer->append(p, static_cast<std::size_t>(end - p));
+    return *this;
+}
+
+std::string ETCDRequestBody::str() const { return *buffer; }
@@ -23,38 +23,83 @@ const std::vector<ETCDParsedResponse::KVEntry>& ETCDResponse::getKVEntriesVec()
     return parsedData.getKVEntriesVec();
 }
 
-const std::unordered_map<std::string, ETCDParsedResponse::KVEntry>& ETCDResponse::getKVEntriesMap()
+const ETCDParsedResponse::KVEntriesMap& ETCDResponse::getKVEntriesMap()
 {
     parse();
     return parsedData.getKVEntriesMap();
 }
 
-std::string ETCDResponse::getJsonResponse()
+const std::string& ETCDResponse::getJsonResponse()
 {
     wait();
     return rawResponse.body();
 }
 
-ETCDResponse::ETCDResponse(std::shared_future<boost::beast::http::response<http::string_body>> Response)
+ETCDResponse::ETCDResponse(std::future<HttpSession::Result> Response) : response(std::move(Response)) {}
+
+ETCDResponse::ETCDResponse(ETCDParsedResponse Parsed, bool FromCache)
+    : isParsed(true), isFutureRetrieved(true), isCached(FromCache), parsedData(std::move(Parsed))
+{
+}
+
+void ETCDResponse::retrieve()
+{
+    if (isFutureRetrieved) {
+        return;
+    }
+    isFutureRetrieved          = true;
+    HttpSession::Result result = response.get();
+    failure                    = result.ec;
+    failureCause               = result.cause;
+    rawResponse                = std::move(result.res);
+}
+
+ETCDResponse& ETCDResponse::wait() &
+{
+    retrieve();
+    if (failure) {
+        throw ETCDError(failure, failureCause);
+    }
+    return *this;
+}
+
+ETCDResponse&& ETCDResponse::wait() &&
 {
-    response = Response;
+    wait();
+    return std::move(*this);
 }
 
-ETCDResponse& ETCDResponse::wait()
+ETCDResponse& ETCDResponse::wait(boost::system::error_code& ec) &
 {
-    if (!isFutureRetrieved) {
-        isFutureRetrieved = true;
-        rawResponse       = response.get();
+    retrieve();
+    if (failure) {
+        error = failure;
     }
+    if (!error && !isParsed) {
+        ETCDParsedResponse parsed(rawResponse.body(), error);
+        if (!error) {
+            parsedData = std::move(parsed);
+            isParsed   = true;
+        }
+    }
+    ec = error;
     return *this;
 }
 
+ETCDResponse&& ETCDResponse::wait(boost::system::error_code& ec) &&
+{
+    wait(ec);
+    return std::move(*this);
+}
+
 std::size_t ETCDResponse::kvCount()
 {
     parse();
     return getKVEntriesVec().size();
 }
 
+bool ETCDResponse::isFromCache() const { return isCached; }
+
 uint64_t ETCDResponse::getRaftTerm()
 {
     parse();
@@ -96,3 +141,33 @@ uint64_t ETCDResponse::getGrantedTTL()
     parse();
     return parsedData.getGrantedTTL();
 }
+
+uint64_t ETCDResponse::getCount()
+{
+    parse();
+    return parsedData.getCount();
+}
+
+bool ETCDResponse::isMore()
+{
+    parse();
+    return parsedData.isMore();
+}
+
+uint64_t ETCDResponse::getDeletedCount()
+{
+    parse();
+    return parsedData.getDeletedCount();
+}
+
+bool ETCDResponse::isTxnSucceeded()
+{
+    parse();
+    return parsedData.isTxnSucceeded();
+}
+
+const std::vector<ETCDParsedResponse::TxnResponse>& ETCDResponse::getTxnResponses()
+{
+    parse();
+    return parsedData.getTxnResponses();
+}
@@ -0,0 +1,567 @@
+#include "etcd-beast/ETCDResponseDecoder.h"
+
+#include "etcd-beast/ETCDBase64.h"
+#include "etcd-beast/ETCDError.h"
+#include <cstring>
+#include <limits>
+
+ETCDResponseDecoder::ETCDResponseDecoder(boost::string_view json)
+    : begin(json.data()), cur(json.data()), end(json.data() + json.size())
+{
+}
+
+template <typename MemberHandler>
+void ETCDResponseDecoder::forEachMember(MemberHandler&& onMember)
+{
+    expect('{');
+    if (consumeIf('}')) {
+        return;
+    }
+    do {
+        if (peek() != '"') {
+            fail("expected a member name");
+        }
+        // the name is only valid until the next string is read
+        boost::string_view name = readString();
+        expect(':');
+        onMember(name);
+    } while (consumeIf(','));
+    expect('}');
+}
+
+template <typename ElementHandler>
+void ETCDResponseDecoder::forEachElement(ElementHandler&& onElement)
+{
+    if (peek() == 'n') {
+        skipValue(); // null
+        return;
+    }
+    expect('[');
+    if (consumeIf(']')) {
+        return;
+    }
+    do {
+        onElement();
+    } while (consumeIf(','));
+    expect(']');
+}
+
+void ETCDResponseDecoder::decodeMembers(ETCDParsedResponse& out)
+{
+    forEachMember([&](boost::string_view name) {
+        if (name == "result") {
+            // messages of a watch stream wrap the watch response
+            decodeMembers(out);
+        } else if (name == "header") {
+            decodeHeader(out);
+        } else if (name == "kvs") {
+            decodeKVEntries(out.storage->kvEntriesVec);
+        } else if (name == "events") {
+            decodeEvents(out);
+        } else if (name == "count") {
+            out.count = readUInt64();
+        } else if (name == "more") {
+            out.more = readBool();
+        } else if (name == "deleted") {
+            out.deleted = readUInt64();
+        } else if (name == "ID") {
+            leaseId    = readUInt64();
+            hasLeaseId = true;
+        } else if (name == "TTL") {
+            leaseTtl = readUInt64();
+        } else if (name == "grantedTTL") {
+            out.leaseGrantedTtl = readUInt64();
+        } else if (name == "succeeded") {
+            out.txnSucceeded = readBool();
+        } else if (name == "responses") {
+            decodeTxnResponses(out);
+        } else if (name == "watch_id") {
+            out.watchId = readUInt64();
+        } else if (name == "created") {
+            out.watchCreated = readBool();
+        } else if (name == "canceled") {
+            out.watchCanceled = readBool();
+        } else if (name == "compact_revision") {
+            out.compactRevision = readUInt64();
+        } else if (name == "error") {
+            isError = true;
+            if (peek() == '"') {
+                readStringInto(errorMessage);
+            } else {
+                const char* valueBegin = cur;
+                skipValue();
+                errorMessage.assign(valueBegin, cur);
+            }
+        } else if (name == "code") {
+            etcdErrorCode = static_cast<long>(readUInt64());
+        } else {
+            skipValue();
+        }
+    });
+}
+
+void ETCDResponseDecoder::decodeMessage(ETCDParsedResponse& out)
+{
+    arena = &out.storage->arena;
+    decodeMembers(out);
+    skipWhitespace();
+    if (cur != end) {
+        fail("unexpected data after the end of the message");
+    }
+
+    // lease response; a TTL of 0, as in the answer to the keep-alive of an expired lease, is left out
+    if (hasLeaseId) {
+        out.leaseId  = leaseId;
+        out.leaseTtl = leaseTtl;
+    }
+}
+
+void ETCDResponseDecoder::decodeInto(ETCDParsedResponse& out)
+{
+    decodeMessage(out);
+    verify();
+}
+
+bool ETCDResponseDecoder::decodeInto(ETCDParsedResponse& out, boost::system::error_code& ec)
+{
+    // anything but a json object, like the error page of a restarting gateway, fails before decoding
+    skipWhitespace();
+    if (cur == end || *cur != '{') {
+        ec = MakeETCDErrorCode(ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE);
+        return false;
+    }
+    try {
+        decodeMessage(out);
+    } catch (const ETCDError& e) {
+        ec = MakeETCDErrorCode(e.getErrorCode());
+        return false;
+    }
+    ec = MakeETCDErrorCode(errorCode());
+    return !ec;
+}
+
+long ETCDResponseDecoder::errorCode() const
+{
+    if (isError) {
+        return ETCDERROR_ETCD_RETURNED_ERROR;
+    }
+    if (!hasHeader || !hasClusterId || !hasMemberId || !hasRevision || !hasRaftTerm) {
+        return ETCDERROR_INVALID_MSG_HEADER;
+    }
+    return 0;
+}
+
+void ETCDResponseDecoder::verify() const
+{
+    if (errorCode() == 0) {
+        return;
+    }
+    // the json is only copied into the detail of an error
+    if (isError) {
+        throw ETCDError(ETCDERROR_ETCD_RETURNED_ERROR, etcdErrorCode,
+                        "ETCD returned an error: " + errorMessage + "; Full json response: ",
+                        std::string(begin, end));
+    }
+    const char* missing = !hasHeader      ? "No header found in: "
+                          : !hasClusterId ? "No cluster id in: "
+                          : !hasMemberId  ? "No member id in: "
+                          : !hasRevision  ? "No revision in: "
+                                          : "No raft term in: ";
+    throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, missing, std::string(begin, end));
+}
+
+void ETCDResponseDecoder::decodeHeader(ETCDParsedResponse& out)
+{
+    hasHeader = true;
+    forEachMember([&](boost::string_view name) {
+        if (name == "cluster_id") {
+            out.clusterId = readUInt64();
+            hasClusterId  = true;
+        } else if (name == "member_id") {
+            out.memberId = readUInt64();
+            hasMemberId  = true;
+        } else if (name == "revision") {
+            out.revision = readUInt64();
+            hasRevision  = true;
+        } else if (name == "raft_term") {
+            out.raftTerm = readUInt64();
+            hasRaftTerm  = true;
+        } else {
+            skipValue();
+        }
+    });
+}
+
+void ETCDResponseDecoder::decodeKVEntry(ETCDParsedResponse::KVEntry& kv, bool isEvent)
+{
+    skipWhitespace();
+    const char* entryBegin        = cur;
+    bool        hasKey            = false;
+    bool        hasCreateRevision = false;
+    bool        hasModRevision    = false;
+    bool        hasVersion        = false;
+
+    // value may not appear if it's empty
+    forEachMember([&](boost::string_view name) {
+        if (name == "key") {
+            kv.key = readBase64();
+            hasKey = true;
+        } else if (name == "value") {
+            kv.value = readBase64();
+        } else if (name == "create_revision") {
+            kv.create_revision = readUInt64();
+            hasCreateRevision  = true;
+        } else if (name == "mod_revision") {
+            kv.mod_revision = readUInt64();
+            hasModRevision  = true;
+        } else if (name == "version") {
+            kv.version = readUInt64();
+            hasVersion = true;
+        } else {
+            skipValue();
+        }
+    });
+
+    if (!hasKey) {
+        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No key id in: ", std::string(entryBegin, cur));
+    }
+    // the kv of a DELETE event has no create revision and version, which are 0 and omitted
+    if (!hasCreateRevision && !isEvent) {
+        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No create_revision in: ",
+                        std::string(entryBegin, cur));
+    }
+    if (!hasModRevision) {
+        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No mod_revision in: ",
+                        std::string(entryBegin, cur));
+    }
+    if (!hasVersion && !isEvent) {
+        throw ETCDError(ETCDERROR_INVALID_MSG_HEADER, "No version in: ", std::string(entryBegin, cur));
+    }
+}
+
+void ETCDResponseDecoder::decodeKVEntries(std::vector<ETCDParsedResponse::KVEntry>& kvs)
+{
+    forEachElement([&]() {
+        kvs.emplace_back();
+        decodeKVEntry(kvs.back(), false);
+    });
+}
+
+void ETCDResponseDecoder::decodeEvents(ETCDParsedResponse& out)
+{
+    using Event = ETCDParsedResponse::Event;
+    forEachElement([&]() {
+        // type is omitted for a PUT, which is the 0 of the enum
+        Event event;
+        forEachMember([&](boost::string_view name) {
+            if (name == "type") {
+                event.type = readString() == "DELETE" ? Event::Type::Delete : Event::Type::Put;
+            } else if (name == "kv") {
+                decodeKVEntry(event.kv, true);
+            } else if (name == "prev_kv") {
+                decodeKVEntry(event.prevKv, false);
+                event.hasPrevKv = true;
+            } else {
+                skipValue();
+            }
+        });
+        out.storage->kvEntriesVec.push_back(event.kv);
+        out.storage->events.push_back(event);
+    });
+}
+
+void ETCDResponseDecoder::decodeTxnResponses(ETCDParsedResponse& out)
+{
+    using TxnResponse = ETCDParsedResponse::TxnResponse;
+    forEachElement([&]() {
+        TxnResponse txnResponse;
+        forEachMember([&](boost::string_view name) {
+            if (name == "response_range") {
+                txnResponse.type = TxnResponse::Type::Range;
+                forEachMember([&](boost::string_view rangeMember) {
+                    if (rangeMember == "kvs") {
+                        decodeKVEntries(txnResponse.kvEntries);
+                    } else {
+                        skipValue();
+                    }
+                });
+            } else if (name == "response_delete_range") {
+                txnResponse.type = TxnResponse::Type::DeleteRange;
+                forEachMember([&](boost::string_view deleteMember) {
+                    if (deleteMember == "deleted") {
+                        txnResponse.deletedCount = readUInt64();
+                    } else {
+                        skipValue();
+                    }
+                });
+            } else {
+                skipValue();
+            }
+        });
+        out.txnResponses.push_back(std::move(txnResponse));
+    });
+}
+
+void ETCDResponseDecoder::fail(const std::string& what) const
+{
+    throw ETCDError(ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE,
+                    "Could not parse json message (" + what + " at offset " +
+                        std::to_string(cur - begin) + "): ",
+                    std::string(begin, end));
+}
+
+void ETCDResponseDecoder::skipWhitespace()
+{
+    while (cur != end && (*cur == ' ' || *cur == '\n' || *cur == '\r' || *cur == '\t')) {
+        ++cur;
+    }
+}
+
+char ETCDResponseDecoder::peek()
+{
+    skipWhitespace();
+    if (cur == end) {
+        fail("unexpected end of message");
+    }
+    return *cur;
+}
+
+void ETCDResponseDecoder::expect(char c)
+{
+    if (peek() != c) {
+        fail(std::string("expected '") + c + "'");
+    }
+    ++cur;
+}
+
+bool ETCDResponseDecoder::consumeIf(char c)
+{
+    if (peek() == c) {
+        ++cur;
+        return true;
+    }
+    return false;
+}
+
+boost::string_view ETCDResponseDecoder::readString()
+{
+    expect('"');
+    const char* stringBegin = cur;
+    // fast path: no escape sequences, the string is used in place
+    while (cur != end && *cur != '"' && *cur != '\\') {
+        ++cur;
+    }
+    if (cur == end) {
+        fail("unterminated string");
+    }
+    if (*cur == '"') {
+        return boost::string_view(stringBegin, static_cast<std::size_t>(cur++ - stringBegin));
+    }
+
+    stringScratch.assign(stringBegin, cur);
+    while (true) {
+        if (cur == end) {
+            fail("unterminated string");
+        }
+        char c = *cur++;
+        if (c == '"') {
+            break;
+        }
+        if (c != '\\') {
+            stringScratch.push_back(c);
+            continue;
+        }
+        if (cur == end) {
+            fail("unterminated escape sequence");
+        }
+        switch (*cur++) {
+        case '"':
+            stringScratch.push_back('"');
+            break;
+        case '\\':
+            stringScratch.push_back('\\');
+            break;
+        case '/':
+            stringScratch.push_back('/');
+            break;
+        case 'b':
+            stringScratch.push_back('\b');
+            break;
+        case 'f':
+            stringScratch.push_back('\f');
+            break;
+        case 'n':
+            stringScratch.push_back('\n');
+            break;
+        case 'r':
+            stringScratch.push_back('\r');
+            break;
+        case 't':
+            stringScratch.push_back('\t');
+            break;
+        case 'u': {
+            uint32_t codePoint = readHex4();
+            if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+                // surrogate pair
+                if (end - cur < 6 || cur[0] != '\\' || cur[1] != 'u') {
+                    fail("invalid unicode surrogate pair");
+                }
+                cur += 2;
+                uint32_t low = readHex4();
+                if (low < 0xDC00 || low > 0xDFFF) {
+                    fail("invalid unicode surrogate pair");
+                }
+                codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+            }
+            appendCodePoint(codePoint);
+            break;
+        }
+        default:
+            fail("invalid escape sequence");
+        }
+    }
+    return boost::string_view(stringScratch);
+}
+
+uint32_t ETCDResponseDecoder::readHex4()
+{
+    if (end - cur < 4) {
+        fail("invalid unicode escape");
+    }
+    uint32_t result = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *cur++;
+        result <<= 4;
+        if (c >= '0' && c <= '9') {
+            result |= static_cast<uint32_t>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            result |= static_cast<uint32_t>(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            result |= static_cast<uint32_t>(c - 'A' + 10);
+        } else {
+            fail("invalid unicode escape");
+        }
+    }
+    return result;
+}
+
+void ETCDResponseDecoder::appendCodePoint(uint32_t codePoint)
+{
+    if (codePoint < 0x80) {
+        stringScratch.push_back(static_cast<char>(codePoint));
+    } else if (codePoint < 0x800) {
+        stringScratch.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+        stringScratch.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    } else if (codePoint < 0x10000) {
+        stringScratch.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+        stringScratch.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+        stringScratch.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    } else {
+        stringScratch.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+        stringScratch.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+        stringScratch.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+        stringScratch.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    }
+}
+
+void ETCDResponseDecoder::readStringInto(std::string& target)
+{
+    boost::string_view s = readString();
+    target.assign(s.data(), s.size());
+}
+
+boost::string_view ETCDResponseDecoder::readBase64()
+{
+    boost::string_view s         = readString();
+    const std::size_t  allocated = ETCDBase64::DecodedSize(s.size());
+    char*              dest      = arena->allocate(allocated);
+    const std::size_t  written   = ETCDBase64::Decode(dest, s.data(), s.size()).first;
+    arena->shrinkLast(dest, allocated, written);
+    return boost::string_view(dest, written);
+}
+
+uint64_t ETCDResponseDecoder::readUInt64()
+{
+    bool quoted = consumeIf('"');
+    if (!quoted && cur != end && *cur == 'n') {
+        skipValue(); // null
+        return 0;
+    }
+    // like std::stoull, a negative number (e.g. TTL -1 of an expired lease) wraps around
+    bool negative = cur != end && *cur == '-';
+    if (negative) {
+        ++cur;
+    }
+    if (cur == end || *cur < '0' || *cur > '9') {
+        fail("expected an integer");
+    }
+    uint64_t result = 0;
+    while (cur != end && *cur >= '0' && *cur <= '9') {
+        const uint64_t digit = static_cast<uint64_t>(*cur - '0');
+        // std::stoull throws for what doesn't fit in 64 bits
+        if (result > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+            fail("integer out of range");
+        }
+        result = result * 10 + digit;
+        ++cur;
+    }
+    if (quoted) {
+        expect('"');
+    }
+    return negative ? static_cast<uint64_t>(0) - result : result;
+}
+
+bool ETCDResponseDecoder::readBool()
+{
+    char c = peek();
+    if (c == 't' && end - cur >= 4 && std::memcmp(cur, "true", 4) == 0) {
+        cur += 4;
+        return true;
+    }
+    if (c == 'f' && end - cur >= 5 && std::memcmp(cur, "false", 5) == 0) {
+        cur += 5;
+        return false;
+    }
+    if (c == 'n' && end - cur >= 4 && std::memcmp(cur, "null", 4) == 0) {
+        cur += 4;
+        return false;
+    }
+    fail("expected a boolean");
+}
+
+void ETCDResponseDecoder::skipString()
+{
+    expect('"');
+    while (cur != end && *cur != '"') {
+        if (*cur == '\\' && ++cur == end) {
+            break;
+        }
+        ++cur;
+    }
+    if (cur == end) {
+        fail("unterminated string");
+    }
+    ++cur;
+}
+
+void ETCDResponseDecoder::skipValue()
+{
+    char c = peek();
+    if (c == '"') {
+        skipString();
+    } else if (c == '{') {
+        forEachMember([this](boost::string_view) { skipValue(); });
+    } else if (c == '[') {
+        forEachElement([this]() { skipValue(); });
+    } else {
+        // number, true, false or null
+        const char* valueBegin = cur;
+        while (cur != end && ((*cur >= '0' && *cur <= '9') || (*cur >= 'a' && *cur <= 'z') || *cur == '-' ||
+                              *cur == '+' || *cur == '.' || *cur == 'E')) {
+            ++cur;
+        }
+        if (cur == valueBegin) {
+            fail("unexpected character");
+        }
+    }
+}
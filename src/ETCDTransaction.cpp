@@ -0,0 +1,176 @@
+#include "etcd-beast/ETCDTransaction.h"
+
+#include "etcd-beast/ETCDClient.h"
+#include "etcd-beast/ETCDError.h"
+#include "etcd-beast/ETCDRequestBody.h"
+
+const char* ETCDTransaction::CompareToString(Compare c)
+{
+    switch (c) {
+    case Compare::Equal:
+        return "EQUAL";
+    case Compare::NotEqual:
+        return "NOT_EQUAL";
+    case Compare::Greater:
+        return "GREATER";
+    case Compare::Less:
+        return "LESS";
+    }
+    throw ETCDError(ETCDERROR_UNKNOWN_ERROR, "Invalid compare result in transaction");
+}
+
+ETCDRequestBody& ETCDTransaction::CompareHead(ETCDRequestBody& body, const std::string& key, Compare result,
+                                              const char* target, const char* field)
+{
+    if (key.empty()) {
+        throw ETCDError(ETCDERROR_EMPTY_KEY_ERROR, "Key cannot be empty");
+    }
+    return body.raw(R"({"key": ")")
+        .base64(key)
+        .raw(R"(", "result": ")")
+        .raw(CompareToString(result))
+        .raw(R"(", "target": ")")
+        .raw(target)
+        .raw(R"(", ")")
+        .raw(field)
+        .raw(R"(": ")");
+}
+
+ETCDTransaction& ETCDTransaction::addCompare(const std::string& key, Compare result, const char* target,
+                                             const char* field, uint64_t value)
+{
+    ETCDRequestBody body;
+    CompareHead(body, key, result, target, field).number(value).raw(R"("})");
+    compares.push_back(body.str());
+    return *this;
+}
+
+ETCDTransaction& ETCDTransaction::addOperation(std::string op)
+{
+    if (addingToFailure) {
+        failureOps.push_back(std::move(op));
+    } else {
+        successOps.push_back(std::move(op));
+    }
+    return *this;
+}
+
+ETCDTransaction::ETCDTransaction(ETCDClient* Client) : client(Client) {}
+
+ETCDTransaction& ETCDTransaction::ifVersion(const std::string& key, Compare result, uint64_t version)
+{
+    return addCompare(key, result, "VERSION", "version", version);
+}
+
+ETCDTransaction& ETCDTransaction::ifCreateRevision(const std::string& key, Compare result,
+                                                   uint64_t revision)
+{
+    return addCompare(key, result, "CREATE", "create_revision", revision);
+}
+
+ETCDTransaction& ETCDTransaction::ifModRevision(const std::string& key, Compare result, uint64_t revision)
+{
+    return addCompare(key, result, "MOD", "mod_revision", revision);
+}
+
+ETCDTransaction& ETCDTransaction::ifValue(const std::string& key, Compare result, const std::string& value)
+{
+    ETCDRequestBody body;
+    CompareHead(body, key, result, "VALUE", "value").base64(value).raw(R"("})");
+    compares.push_back(body.str());
+    return *this;
+}
+
+ETCDTransaction& ETCDTransaction::ifLease(const std::string& key, Compare result, uint64_t leaseID)
+{
+    return addCompare(key, result, "LEASE", "lease", leaseID);
+}
+
+ETCDTransaction& ETCDTransaction::put(const std::string& key, const std::string& value, uint64_t leaseID)
+{
+    if (key.empty()) {
+        throw ETCDError(ETCDERROR_EMPTY_KEY_ERROR, "Key cannot be empty");
+    }
+
+    ETCDRequestBody body;
+    body.raw(R"({"request_put": {"key": ")").base64(key).raw(R"(", "value": ")").base64(value);
+    if (leaseID != 0) {
+        body.raw(R"(", "lease": ")").number(leaseID);
+    }
+    body.raw(R"("}})");
+    return addOperation(body.str());
+}
+
+ETCDTransaction& ETCDTransaction::get(const std::string& key)
+{
+    ETCDRequestBody body;
+    body.raw(R"({"request_range": {"key": ")").base64(key).raw(R"("}})");
+    return addOperation(body.str());
+}
+
+ETCDTransaction& ETCDTransaction::getAll(const std::string& prefix)
+{
+    ETCDRequestBody body;
+    body.raw(R"({"request_range": {"key": ")")
+        .base64(prefix)
+        .raw(R"(", "range_end": ")")
+        .base64RangeEnd(prefix)
+        .raw(R"("}})");
+    return addOperation(body.str());
+}
+
+ETCDTransaction& ETCDTransaction::del(const std::string& key)
+{
+    ETCDRequestBody body;
+    body.raw(R"({"request_delete_range": {"key": ")").base64(key).raw(R"("}})");
+    return addOperation(body.str());
+}
+
+ETCDTransaction& ETCDTransaction::delAll(const std::string& prefix)
+{
+    ETCDRequestBody body;
+    body.raw(R"({"request_delete_range": {"key": ")")
+        .base64(prefix)
+        .raw(R"(", "range_end": ")")
+        .base64RangeEnd(prefix)
+        .raw(R"("}})");
+    return addOperation(body.str());
+}
+
+ETCDTransaction& ETCDTransaction::onFailure()
+{
+    addingToFailure = true;
+    return *this;
+}
+
+std::size_t ETCDTransaction::operationsCount() const { return successOps.size() + failureOps.size(); }
+
+static void AppendJsonArray(ETCDRequestBody& body, const std::vector<std::string>& elements)
+{
+    body.raw("[");
+    for (std::size_t i = 0; i < elements.size(); i++) {
+        if (i > 0) {
+            body.raw(", ");
+        }
+        body.raw(elements[i]);
+    }
+    body.raw("]");
+}
+
+std::string ETCDTransaction::toJson() const
+{
+    ETCDRequestBody body;
+    body.raw(R"({"compare": )");
+    AppendJsonArray(body, compares);
+    body.raw(R"(, "success": )");
+    AppendJsonArray(body, successOps);
+    body.raw(R"(, "failure": )");
+    AppendJsonArray(body, failureOps);
+    body.raw("}");
+    return body.str();
+}
+
+ETCDResponse ETCDTransaction::commit()
+{
+    return client->customCommand(client->ETCDVersionPrefix + "/kv/txn", toJson());
+}
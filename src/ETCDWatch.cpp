@@ -1,46 +1,53 @@
 #include "etcd-beast/ETCDWatch.h"
 
-void ETCDWatch::convertJsonToETCDParsedResponse(Json::Value v)
+ETCDWatch::ETCDWatch(boost::asio::io_context& ioc, boost::asio::any_io_executor callbackExecutor)
+    : ioc_(&ioc), callbackExecutor_(std::move(callbackExecutor))
 {
-    //    Json::FastWriter w;
-    //        std::cout << w.write(v) << std::endl;
-    if (v.isMember("result")) {
-        callback_(ETCDParsedResponse::__jsonToString(v["result"]));
-    } else {
-        callback_(ETCDParsedResponse::__jsonToString(v));
-    }
 }
 
-ETCDWatch::ETCDWatch(boost::asio::io_context& ioc) : httpSession(std::make_shared<HttpSession>(ioc)) {}
+ETCDWatch::ETCDWatch(std::shared_ptr<ETCDWatchMultiplexer> Multiplexer, const std::string& key,
+                     const ETCDWatchOptions& options, std::function<void(ETCDParsedResponse)> callback)
+    : multiplexer(std::move(Multiplexer))
+{
+    multiplexedId = multiplexer->add(key, options, std::move(callback), created);
+    live          = multiplexer->liveness(multiplexedId);
+    dropped       = multiplexer->droppedCount(multiplexedId);
+}
 
-void ETCDWatch::run(const std::string& keyBase64, const std::string& address, uint16_t port,
+void ETCDWatch::run(const std::string& key, const ETCDWatchOptions& options, const std::string& address,
+                    uint16_t port, const std::string& target,
                     std::function<void(ETCDParsedResponse)> callback)
 {
-    callback_ = std::move(callback);
-
-    std::string      target      = "/v3alpha/watch";
-    static const int httpVersion = 11; // http 1.1
-
-    keyBase64_ = keyBase64;
-    // this gives a callback error, which is useful to test callback errors
-    //    const std::string bWatch = R"({"create_request": ")" + keyBase64 + R"(" })";
-
-    const std::string bWatch = R"({"create_request": {"key":")" + keyBase64 + R"("} })";
-
-    httpSession->runLongRunningRequest(boost::beast::http::verb::post, address, std::to_string(port),
-                                       target, bWatch, httpVersion,
-                                       [this](Json::Value v) { convertJsonToETCDParsedResponse(v); });
-
-    firstResponse = httpSession->getResponse();
+    multiplexer     = std::make_shared<ETCDWatchMultiplexer>(*ioc_, address, std::to_string(port), target, 1);
+    ownsMultiplexer = true;
+    if (callbackExecutor_) {
+        multiplexer->setCallbackExecutor(callbackExecutor_);
+    }
+    multiplexedId = multiplexer->add(key, options, std::move(callback), created);
+    live          = multiplexer->liveness(multiplexedId);
+    dropped       = multiplexer->droppedCount(multiplexedId);
 }
 
 void ETCDWatch::cancel()
 {
-    //    const std::string bCancel = R"({"cancel_request": {"key":")" + keyBase64_ + R"("} })";
-    //    return httpSession->write_message(bCancel);
-    httpSession->cancel();
+    if (!multiplexer) {
+        return;
+    }
+    multiplexer->cancel(multiplexedId);
+    if (ownsMultiplexer) {
+        multiplexer->close();
+    }
+}
+
+void ETCDWatch::wait()
+{
+    if (multiplexer) {
+        created.get();
+    }
 }
 
-void ETCDWatch::wait() { firstResponse.get(); }
+bool ETCDWatch::isLive() const { return live && live->load(); }
+
+uint64_t ETCDWatch::droppedCount() const { return dropped ? dropped->load() : 0; }
 
-ETCDWatch::~ETCDWatch() { httpSession->cancel(); }
+ETCDWatch::~ETCDWatch() { cancel(); }
@@ -0,0 +1,528 @@
+#include "etcd-beast/ETCDWatchMultiplexer.h"
+
+#include "etcd-beast/ETCDError.h"
+#include "etcd-beast/ETCDRequestBody.h"
+#include <boost/asio/post.hpp>
+#include <algorithm>
+#include <iterator>
+#include <random>
+
+ETCDWatchMultiplexer::ETCDWatchMultiplexer(boost::asio::io_context& ioc, const std::string& host,
+                                           const std::string& port, const std::string& target,
+                                           unsigned streamCount)
+    : ioc_(ioc), host_(host), port_(port), target_(target)
+{
+    if (streamCount == 0) {
+        throw ETCDError(ETCDERROR_INVALID_WATCH_STREAM_COUNT, "At least one watch stream is needed");
+    }
+    // the streams are only connected when their first watch is added
+    streams.resize(streamCount);
+}
+
+ETCDWatchMultiplexer::~ETCDWatchMultiplexer() { close(); }
+
+std::string ETCDWatchMultiplexer::CreateRequest(const std::string& key, const ETCDWatchOptions& options)
+{
+    ETCDRequestBody body;
+    body.raw(R"({"create_request": {"key": ")").base64(key).raw(R"(")");
+    if (options.prefix) {
+        body.raw(R"(, "range_end": ")").base64RangeEnd(key).raw(R"(")");
+    } else if (!options.rangeEnd.empty()) {
+        body.raw(R"(, "range_end": ")").base64(options.rangeEnd).raw(R"(")");
+    }
+    if (options.startRevision != 0) {
+        body.raw(R"(, "start_revision": ")").number(options.startRevision).raw(R"(")");
+    }
+    if (options.prevKv) {
+        body.raw(R"(, "prev_kv": true)");
+    }
+    if (options.progressNotify) {
+        body.raw(R"(, "progress_notify": true)");
+    }
+    if (options.noPut || options.noDelete) {
+        body.raw(R"(, "filters": [)");
+        if (options.noPut) {
+            body.raw(R"("NOPUT")").raw(options.noDelete ? ", " : "");
+        }
+        if (options.noDelete) {
+            body.raw(R"("NODELETE")");
+        }
+        body.raw("]");
+    }
+    body.raw("}}");
+    return body.str();
+}
+
+std::string ETCDWatchMultiplexer::CancelRequest(uint64_t watchId)
+{
+    return ETCDRequestBody().raw(R"({"cancel_request": {"watch_id": ")").number(watchId).raw(R"("}})").str();
+}
+
+void ETCDWatchMultiplexer::FailCreation(Watch& watch, const ETCDError& error)
+{
+    // under the lock; the promise is settled once, by the creation or by the first failure
+    if (watch.isCreationSettled) {
+        return;
+    }
+    watch.isCreationSettled = true;
+    watch.created.set_exception(std::make_exception_ptr(error));
+}
+
+std::size_t ETCDWatchMultiplexer::pickStream()
+{
+    std::size_t best = 0;
+    for (std::size_t i = 1; i < streams.size(); i++) {
+        if (streams[i].watchCount < streams[best].watchCount) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void ETCDWatchMultiplexer::startStream(std::size_t index)
+{
+    static const int httpVersion = 11; // http 1.1
+
+    std::weak_ptr<ETCDWatchMultiplexer> weakSelf  = shared_from_this();
+    Stream&                             stream    = streams[index];
+    const uint64_t                      sessionId = nextSessionId++;
+    stream.sessionId                              = sessionId;
+    stream.session                                = std::make_shared<HttpSession>(ioc_);
+    if (stream.blockingWatches > 0) {
+        // the full queues of the watches weren't drained while the stream reconnected
+        stream.session->pauseReading();
+    }
+    stream.session->setStreamEndHandler([weakSelf, index, sessionId](boost::system::error_code ec) {
+        if (auto self = weakSelf.lock()) {
+            self->onStreamEnd(index, sessionId, ec);
+        }
+    });
+    stream.session->runStreamingRequest(boost::beast::http::verb::post, host_, port_, target_, httpVersion,
+                                        [weakSelf, index, sessionId](boost::string_view message) {
+                                            if (auto self = weakSelf.lock()) {
+                                                self->onMessage(index, message, sessionId);
+                                            }
+                                        });
+}
+
+void ETCDWatchMultiplexer::writeCreateRequest(Stream& stream, const std::shared_ptr<Watch>& watch)
+{
+    ETCDWatchOptions options = watch->options;
+    if (watch->hasLastRevision) {
+        options.startRevision = watch->lastRevision + 1;
+    }
+    stream.pendingCreations.push_back(watch);
+    // written under the lock, so that the requests are in the order of pendingCreations
+    stream.session->write_message(CreateRequest(watch->key, options));
+}
+
+uint64_t ETCDWatchMultiplexer::add(const std::string& key, const ETCDWatchOptions& options,
+                                   Callback callback, std::shared_future<void>& created)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    if (isClosed) {
+        throw ETCDError(ETCDERROR_WATCH_STREAM_CLOSED, "Watches can't be added to a closed client");
+    }
+    std::shared_ptr<Watch> watch = std::make_shared<Watch>();
+    watch->id                    = nextId++;
+    watch->key                   = key;
+    watch->options               = options;
+    watch->callback              = std::move(callback);
+    watch->stream                = pickStream();
+    created                      = watch->created.get_future().share();
+    if (options.startRevision != 0) {
+        watch->hasLastRevision = true;
+        watch->lastRevision    = options.startRevision - 1;
+    }
+
+    Stream& stream = streams[watch->stream];
+    stream.watchCount++;
+    watchesById[watch->id] = watch;
+    // a stream that is reconnecting creates all its watches once it's connected
+    if (!stream.reconnectTimer) {
+        if (!stream.session) {
+            startStream(watch->stream);
+        }
+        writeCreateRequest(stream, watch);
+    }
+    return watch->id;
+}
+
+void ETCDWatchMultiplexer::cancel(uint64_t id)
+{
+    std::shared_ptr<Watch> watch;
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto                        it = watchesById.find(id);
+        if (it == watchesById.end()) {
+            return;
+        }
+        watch = std::move(it->second);
+        watchesById.erase(it);
+        watch->cancelRequested = true;
+        watch->isLive          = false;
+
+        Stream& stream = streams[watch->stream];
+        stream.watchCount--;
+        // the stream isn't held back by the queue of a canceled watch
+        updateBlocking(stream, *watch);
+        // its creation isn't given anymore
+        FailCreation(*watch, ETCDError(ETCDERROR_WATCH_STREAM_CLOSED, "The watch was canceled"));
+        // a watch that isn't created yet is canceled when its creation arrives
+        if (watch->isCreated && !isClosed) {
+            stream.watches.erase(watch->watchId);
+            stream.session->write_message(CancelRequest(watch->watchId));
+        }
+    }
+    std::lock_guard<std::recursive_mutex> lg(watch->callbackMtx);
+}
+
+std::shared_ptr<const std::atomic_bool> ETCDWatchMultiplexer::liveness(uint64_t id)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    auto                        it = watchesById.find(id);
+    if (it == watchesById.end()) {
+        return std::make_shared<const std::atomic_bool>(false);
+    }
+    // shares the ownership of the watch
+    return std::shared_ptr<const std::atomic_bool>(it->second, &it->second->isLive);
+}
+
+std::shared_ptr<const std::atomic<uint64_t>> ETCDWatchMultiplexer::droppedCount(uint64_t id)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    auto                        it = watchesById.find(id);
+    if (it == watchesById.end()) {
+        return std::make_shared<const std::atomic<uint64_t>>(0);
+    }
+    return std::shared_ptr<const std::atomic<uint64_t>>(it->second, &it->second->dropped);
+}
+
+void ETCDWatchMultiplexer::onMessage(std::size_t index, boost::string_view message, uint64_t sessionId)
+{
+    boost::system::error_code ec;
+    ETCDParsedResponse        response(message, ec);
+    if (ec) {
+        // an error message of the stream; thrown, it would take the io thread out of the io_context
+        if (ec.value() == ETCDERROR_ETCD_RETURNED_ERROR) {
+            failPendingCreation(index, sessionId,
+                                ETCDError(ec.value(), ec.message() + ": ", std::string(message)));
+        }
+        return;
+    }
+    std::shared_ptr<Watch>       watch;
+    bool                         isFirstCreation = false;
+    bool                         setsCreated     = false;
+    boost::asio::any_io_executor executor;
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        executor       = callbackExecutor;
+        Stream& stream = streams[index];
+        if (stream.sessionId != sessionId) {
+            return;
+        }
+        stream.reconnectAttempts = 0;
+        if (response.isWatchCreated()) {
+            if (stream.pendingCreations.empty()) {
+                return;
+            }
+            watch = std::move(stream.pendingCreations.front());
+            stream.pendingCreations.pop_front();
+            watch->watchId   = response.getWatchId();
+            watch->isCreated = true;
+            isFirstCreation  = !watch->wasCreated;
+            watch->wasCreated = true;
+            // unless its creation failed meanwhile
+            setsCreated              = !watch->isCreationSettled;
+            watch->isCreationSettled = true;
+            // without a start revision, the watch starts after the revision of its creation
+            if (!watch->hasLastRevision) {
+                watch->hasLastRevision = true;
+                watch->lastRevision    = response.getRevision();
+            }
+            if (watch->cancelRequested) {
+                stream.session->write_message(CancelRequest(watch->watchId));
+            } else {
+                stream.watches[watch->watchId] = watch;
+                watch->isLive                  = true;
+            }
+        } else {
+            auto it = stream.watches.find(response.getWatchId());
+            if (it == stream.watches.end()) {
+                return;
+            }
+            watch = it->second;
+            if (response.isWatchCanceled()) {
+                watch->isLive = false;
+                stream.watches.erase(it);
+                watchesById.erase(watch->id);
+                stream.watchCount--;
+            } else if (response.getEvents().empty()) {
+                // a progress notification: all the changes up to its revision were sent
+                watch->lastRevision = std::max(watch->lastRevision, response.getRevision());
+            }
+            for (const ETCDParsedResponse::Event& event : response.getEvents()) {
+                watch->lastRevision = std::max(watch->lastRevision, event.kv.mod_revision);
+            }
+        }
+    }
+
+    if (response.isWatchCreated()) {
+        if (!isFirstCreation) {
+            return;
+        }
+        if (setsCreated) {
+            watch->created.set_value();
+        }
+    }
+    if (executor) {
+        deliver(watch, std::move(response), executor);
+        return;
+    }
+    std::lock_guard<std::recursive_mutex> lg(watch->callbackMtx);
+    if (!watch->cancelRequested) {
+        watch->callback(std::move(response));
+    }
+}
+
+void ETCDWatchMultiplexer::failPendingCreation(std::size_t index, uint64_t sessionId,
+                                               const ETCDError& error)
+{
+    // etcd rejected a create request, as the gateway does for a bad range or a compacted start
+    // revision; the rejection takes the place of the creation of the first watch that waits for one
+    std::lock_guard<std::mutex> lg(mtx);
+    Stream&                     stream = streams[index];
+    if (stream.sessionId != sessionId || stream.pendingCreations.empty()) {
+        return;
+    }
+    std::shared_ptr<Watch> watch = std::move(stream.pendingCreations.front());
+    stream.pendingCreations.pop_front();
+    watch->cancelRequested = true;
+    watch->isLive          = false;
+    if (watchesById.erase(watch->id) > 0) {
+        stream.watchCount--;
+        updateBlocking(stream, *watch);
+    }
+    FailCreation(*watch, error);
+}
+
+void ETCDWatchMultiplexer::deliver(const std::shared_ptr<Watch>& watch, ETCDParsedResponse message,
+                                   const boost::asio::any_io_executor& executor)
+{
+    const std::size_t limit = std::max<std::size_t>(watch->options.queueSize, 1);
+    bool              isFull = false;
+    {
+        std::lock_guard<std::mutex> lg(watch->queueMtx);
+        if (watch->queue.size() >= limit) {
+            switch (watch->options.overflow) {
+            case ETCDWatchOptions::Overflow::Block:
+                // queued anyway: the message was read already; the next ones wait in the connection
+                break;
+            case ETCDWatchOptions::Overflow::Coalesce: {
+                // only the events are merged: the callback gets the created and canceled messages as
+                // they are, and the messages queued before them aren't merged with the ones after
+                if (message.isWatchCreated() || message.isWatchCanceled()) {
+                    break;
+                }
+                auto first = watch->queue.end();
+                while (first != watch->queue.begin() && !std::prev(first)->isWatchCreated() &&
+                       !std::prev(first)->isWatchCanceled()) {
+                    --first;
+                }
+                std::vector<ETCDParsedResponse> messages(std::make_move_iterator(first),
+                                                         std::make_move_iterator(watch->queue.end()));
+                messages.push_back(std::move(message));
+                watch->queue.erase(first, watch->queue.end());
+                message = ETCDParsedResponse::CoalesceEvents(std::move(messages));
+                break;
+            }
+            case ETCDWatchOptions::Overflow::Drop:
+                // the callback must know about the creation and the cancellation whatever happens
+                if (!message.isWatchCreated() && !message.isWatchCanceled()) {
+                    watch->dropped++;
+                    return;
+                }
+                break;
+            }
+        }
+        watch->queue.push_back(std::move(message));
+        isFull = watch->queue.size() >= limit &&
+                 watch->options.overflow == ETCDWatchOptions::Overflow::Block;
+        if (!watch->isDelivering) {
+            watch->isDelivering                          = true;
+            std::weak_ptr<ETCDWatchMultiplexer> weakSelf = shared_from_this();
+            boost::asio::post(executor,
+                              [weakSelf, watch, executor]() { Drain(weakSelf, watch, executor); });
+        }
+    }
+    if (isFull) {
+        // the stream isn't read until the callback catches up, so the backpressure reaches etcd through
+        // the connection, and the io thread goes on with the other connections
+        std::lock_guard<std::mutex> lg(mtx);
+        updateBlocking(streams[watch->stream], *watch);
+    }
+}
+
+void ETCDWatchMultiplexer::updateBlocking(Stream& stream, Watch& watch)
+{
+    std::lock_guard<std::mutex> lg(watch.queueMtx);
+    const bool isBlocking = !watch.cancelRequested && !isClosed &&
+                            watch.options.overflow == ETCDWatchOptions::Overflow::Block &&
+                            watch.queue.size() >= std::max<std::size_t>(watch.options.queueSize, 1);
+    if (isBlocking == watch.isBlockingStream) {
+        return;
+    }
+    watch.isBlockingStream = isBlocking;
+    if (isBlocking) {
+        if (stream.blockingWatches++ == 0 && stream.session) {
+            stream.session->pauseReading();
+        }
+    } else if (--stream.blockingWatches == 0 && stream.session) {
+        stream.session->resumeReading();
+    }
+}
+
+void ETCDWatchMultiplexer::Drain(const std::weak_ptr<ETCDWatchMultiplexer>& weakSelf,
+                                 const std::shared_ptr<Watch>&              watch,
+                                 const boost::asio::any_io_executor&        executor)
+{
+    // only the messages queued by now; the next ones wait for another handler, so that a busy watch
+    // doesn't keep the executor from the other watches
+    std::size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lg(watch->queueMtx);
+        count = watch->queue.size();
+    }
+    for (; count > 0; count--) {
+        ETCDParsedResponse message;
+        bool               isBlockingStream = false;
+        {
+            std::lock_guard<std::mutex> lg(watch->queueMtx);
+            // coalescing may have merged the queue meanwhile
+            if (watch->queue.empty()) {
+                break;
+            }
+            message = std::move(watch->queue.front());
+            watch->queue.pop_front();
+            isBlockingStream = watch->isBlockingStream;
+        }
+        if (isBlockingStream) {
+            if (auto self = weakSelf.lock()) {
+                std::lock_guard<std::mutex> lg(self->mtx);
+                self->updateBlocking(self->streams[watch->stream], *watch);
+            }
+        }
+        std::lock_guard<std::recursive_mutex> lg(watch->callbackMtx);
+        if (!watch->cancelRequested) {
+            watch->callback(std::move(message));
+        }
+    }
+
+    std::lock_guard<std::mutex> lg(watch->queueMtx);
+    if (watch->queue.empty()) {
+        watch->isDelivering = false;
+        return;
+    }
+    boost::asio::post(executor, [weakSelf, watch, executor]() { Drain(weakSelf, watch, executor); });
+}
+
+void ETCDWatchMultiplexer::onStreamEnd(std::size_t index, uint64_t sessionId,
+                                       boost::system::error_code ec)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    Stream&                     stream = streams[index];
+    if (isClosed || stream.sessionId != sessionId) {
+        return;
+    }
+    for (auto& w : stream.watches) {
+        w.second->isCreated = false;
+        w.second->isLive    = false;
+    }
+    stream.watches.clear();
+    stream.pendingCreations.clear();
+    stream.session.reset();
+    // a stream without watches is connected again by the next add()
+    if (stream.watchCount == 0) {
+        return;
+    }
+
+    if (stream.reconnectAttempts + 1 >= CREATION_ATTEMPTS) {
+        // wait() doesn't block for as long as etcd is unreachable
+        const ETCDError error(MakeETCDErrorCode(ETCDERROR_FAILED_TO_CONNECT), ec);
+        for (const auto& w : watchesById) {
+            if (w.second->stream == index) {
+                FailCreation(*w.second, error);
+            }
+        }
+    }
+
+    // full jitter between half the backoff and the backoff, so that the clients of a cluster that
+    // dropped don't all come back at once
+    static thread_local std::mt19937 generator{std::random_device()()};
+    const unsigned                   shift = std::min(stream.reconnectAttempts++, 16u);
+    const auto                       backoff =
+        std::min(maxReconnectDelay, std::chrono::milliseconds(minReconnectDelay.count() << shift));
+    std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(backoff.count() / 2,
+                                                                          backoff.count());
+
+    std::weak_ptr<ETCDWatchMultiplexer> weakSelf = shared_from_this();
+    stream.reconnectTimer = std::make_shared<boost::asio::steady_timer>(ioc_);
+    stream.reconnectTimer->expires_after(std::chrono::milliseconds(jitter(generator)));
+    stream.reconnectTimer->async_wait([weakSelf, index](boost::system::error_code ec) {
+        if (auto self = weakSelf.lock()) {
+            if (!ec) {
+                self->reconnect(index);
+            }
+        }
+    });
+}
+
+void ETCDWatchMultiplexer::reconnect(std::size_t index)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    Stream&                     stream = streams[index];
+    stream.reconnectTimer.reset();
+    if (isClosed) {
+        return;
+    }
+    startStream(index);
+    for (const auto& w : watchesById) {
+        if (w.second->stream == index) {
+            writeCreateRequest(stream, w.second);
+        }
+    }
+}
+
+void ETCDWatchMultiplexer::close()
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    isClosed = true;
+    const ETCDError error(ETCDERROR_WATCH_STREAM_CLOSED, "The watch stream was closed");
+    for (const auto& w : watchesById) {
+        FailCreation(*w.second, error);
+    }
+    for (Stream& stream : streams) {
+        if (stream.session) {
+            stream.session->cancel();
+        }
+        if (stream.reconnectTimer) {
+            stream.reconnectTimer->cancel();
+        }
+    }
+}
+
+std::size_t ETCDWatchMultiplexer::streamCount() const { return streams.size(); }
+
+void ETCDWatchMultiplexer::setReconnectDelays(std::chrono::milliseconds minDelay,
+                                              std::chrono::milliseconds maxDelay)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    minReconnectDelay = std::max(minDelay, std::chrono::milliseconds(1));
+    maxReconnectDelay = std::max(maxDelay, minReconnectDelay);
+}
+
+void ETCDWatchMultiplexer::setCallbackExecutor(boost::asio::any_io_executor executor)
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    callbackExecutor = std::move(executor);
+}
@@ -0,0 +1,153 @@
+#include "etcd-beast/ETCDWriteCoalescer.h"
+
+#include "etcd-beast/ETCDParsedResponse.h"
+#include "etcd-beast/ETCDRequestBody.h"
+
+namespace http = boost::beast::http; // from <boost/beast/http.hpp>
+
+ETCDWriteCoalescer::ETCDWriteCoalescer(boost::asio::io_context& ioc, HttpSessionPool& Pool,
+                                       const std::string& versionPrefix, std::chrono::microseconds Window,
+                                       std::size_t MaxBatchSize)
+    : pool(Pool), putTarget(versionPrefix + "/kv/put"), txnTarget(versionPrefix + "/kv/txn"),
+      window(Window), maxBatchSize(std::max<std::size_t>(MaxBatchSize, 1)), flushTimer(ioc)
+{
+}
+
+std::future<HttpSession::Result> ETCDWriteCoalescer::put(const std::string& key, std::string putBody)
+{
+    auto                             promise = std::make_shared<std::promise<HttpSession::Result>>();
+    std::future<HttpSession::Result> result  = promise->get_future();
+    put(key, std::move(putBody), [promise](boost::system::error_code ec, boost::system::error_code cause,
+                                           Response res) {
+        promise->set_value(HttpSession::Result{ec, cause, std::move(res)});
+    });
+    return result;
+}
+
+void ETCDWriteCoalescer::put(const std::string& key, std::string putBody,
+                             HttpSession::ResponseHandler handler)
+{
+    PendingPut p;
+    p.key     = key;
+    p.body    = std::move(putBody);
+    p.handler = std::move(handler);
+
+    std::vector<PendingPut> fullBatch;
+    std::vector<PendingPut> duplicateBatch;
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        if (batchKeys.count(key)) {
+            duplicateBatch = takeBatch();
+        }
+        batchKeys.insert(key);
+        batch.push_back(std::move(p));
+        if (batch.size() >= maxBatchSize) {
+            fullBatch = takeBatch();
+        } else if (batch.size() == 1) {
+            uint64_t thisBatch = batchNumber;
+            flushTimer.expires_after(window);
+            flushTimer.async_wait([this, thisBatch](boost::system::error_code ec) {
+                if (ec) {
+                    return;
+                }
+                std::vector<PendingPut> expiredBatch;
+                {
+                    std::lock_guard<std::mutex> lg(mtx);
+                    if (thisBatch != batchNumber) {
+                        return;
+                    }
+                    expiredBatch = takeBatch();
+                }
+                sendBatch(std::move(expiredBatch));
+            });
+        }
+    }
+    sendBatch(std::move(duplicateBatch));
+    sendBatch(std::move(fullBatch));
+}
+
+void ETCDWriteCoalescer::flush()
+{
+    std::vector<PendingPut> currentBatch;
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        currentBatch = takeBatch();
+        boost::system::error_code ec;
+        flushTimer.cancel(ec);
+    }
+    sendBatch(std::move(currentBatch));
+}
+
+std::vector<ETCDWriteCoalescer::PendingPut> ETCDWriteCoalescer::takeBatch()
+{
+    std::vector<PendingPut> result = std::move(batch);
+    batch.clear();
+    batchKeys.clear();
+    batchNumber++;
+    return result;
+}
+
+void ETCDWriteCoalescer::sendBatch(std::vector<PendingPut> puts)
+{
+    if (puts.empty()) {
+        return;
+    }
+    if (puts.size() == 1) {
+        sendIndividually(std::move(puts));
+        return;
+    }
+
+    ETCDRequestBody txn;
+    txn.raw(R"({"success": [)");
+    for (std::size_t i = 0; i < puts.size(); i++) {
+        if (i > 0) {
+            txn.raw(", ");
+        }
+        txn.raw(R"({"request_put": )").raw(puts[i].body).raw("}");
+    }
+    txn.raw("]}");
+
+    auto sharedPuts = std::make_shared<std::vector<PendingPut>>(std::move(puts));
+    // a txn of puts only can be applied twice, like the puts, so it stays retryable
+    pool.request(http::verb::post, txnTarget, txn.str(),
+                 [this, sharedPuts](boost::system::error_code ec, boost::system::error_code cause,
+                                    Response res) {
+                     if (ec) {
+                         for (const auto& p : *sharedPuts) {
+                             p.handler(ec, cause, Response());
+                         }
+                         return;
+                     }
+                     boost::system::error_code decodeEc;
+                     const ETCDParsedResponse  parsed(res.body(), decodeEc);
+                     if (res.result() != http::status::ok || decodeEc) {
+                         // let every put find out on its own whether it's the one that failed
+                         sendIndividually(std::move(*sharedPuts));
+                         return;
+                     }
+                     // every put gets what a single put would've returned
+                     Response single(res.base());
+                     single.body() = ETCDRequestBody()
+                                         .raw(R"({"header": {"cluster_id": ")")
+                                         .number(parsed.getClusterId())
+                                         .raw(R"(", "member_id": ")")
+                                         .number(parsed.getMemberId())
+                                         .raw(R"(", "revision": ")")
+                                         .number(parsed.getRevision())
+                                         .raw(R"(", "raft_term": ")")
+                                         .number(parsed.getRaftTerm())
+                                         .raw(R"("}})")
+                                         .str();
+                     single.prepare_payload();
+                     for (const auto& p : *sharedPuts) {
+                         p.handler(boost::system::error_code(), boost::system::error_code(), single);
+                     }
+                 });
+}
+
+void ETCDWriteCoalescer::sendIndividually(std::vector<PendingPut> puts)
+{
+    for (auto& p : puts) {
+        pool.request(http::verb::post, putTarget, std::move(p.body), std::move(p.handler));
+    }
+}
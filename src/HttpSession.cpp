@@ -10,9 +10,20 @@
 using tcp      = boost::asio::ip::tcp; // from <boost/asio/ip/tcp.hpp>
 namespace http = boost::beast::http;   // from <boost/beast/http.hpp>
 
-void HttpSession::cancel() { socket_.cancel(); }
+void HttpSession::cancel()
+{
+    // on the strand of the reads, so that a read handler running meanwhile doesn't start another read
+    // that nothing would cancel; the socket isn't open yet while the address is resolved
+    auto self = shared_from_this();
+    strand_.dispatch([self]() {
+        self->isCanceled = true;
+        boost::system::error_code ec;
+        self->resolver_.cancel();
+        self->socket_.cancel(ec);
+    });
+}
 
-std::shared_future<boost::beast::http::response<http::string_body>> HttpSession::getResponse()
+std::future<boost::beast::http::response<http::string_body>> HttpSession::getResponse()
 {
     return responsePromise.get_future();
 }
@@ -50,10 +61,10 @@ void HttpSession::run(http::verb verb, const std::string& host, const std::strin
 void HttpSession::runLongRunningRequest(http::verb verb, const std::string& host,
                                         const std::string& port, const std::string& target,
                                         const std::string& body, int version,
-                                        std::function<void(Json::Value)>          dataAvailableCallback,
+                                        std::function<void(boost::string_view)>   dataAvailableCallback,
                                         const std::map<std::string, std::string>& fields)
 {
-    dataAvailableCallback_ = dataAvailableCallback;
+    dataAvailableCallback_ = std::move(dataAvailableCallback);
     isLongRunningRequest   = true;
     req_.version(version);
     req_.method(verb);
@@ -75,13 +86,59 @@ void HttpSession::runLongRunningRequest(http::verb verb, const std::string& host
                             });
 }
 
+void HttpSession::runStreamingRequest(http::verb verb, const std::string& host, const std::string& port,
+                                      const std::string& target, int version,
+                                      std::function<void(boost::string_view)>   dataAvailableCallback,
+                                      const std::map<std::string, std::string>& fields)
+{
+    dataAvailableCallback_ = std::move(dataAvailableCallback);
+    isLongRunningRequest   = true;
+    isStreamingRequest     = true;
+    req_.version(version);
+    req_.method(verb);
+    req_.target(target);
+    req_.set(http::field::host, host);
+    req_.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req_.set(http::field::content_type, "application/json");
+    req_.chunked(true);
+    for (const auto& f : fields) {
+        req_.insert(f.first, f.second);
+    }
+
+    // Look up the domain name
+    auto self = shared_from_this();
+    resolver_.async_resolve(host, port,
+                            [self](boost::system::error_code ec, tcp::resolver::results_type results) {
+                                self->on_resolve(ec, results);
+                            });
+}
+
+void HttpSession::setStreamEndHandler(StreamEndHandler handler) { streamEndHandler_ = std::move(handler); }
+
+bool HttpSession::endStream(boost::system::error_code ec)
+{
+    if (!isLongRunningRequest || !streamEndHandler_) {
+        return false;
+    }
+    // a canceled request ends quietly
+    if (!isStreamEnded && !isCanceled && ec != boost::asio::error::operation_aborted) {
+        isStreamEnded = true;
+        streamEndHandler_(ec);
+    }
+    return true;
+}
+
 void HttpSession::on_resolve(boost::system::error_code ec, tcp::resolver::results_type results)
 {
+    if (!ec && isCanceled) {
+        ec = boost::asio::error::operation_aborted;
+    }
     if (ec) {
         auto ex =
             ETCDError(ETCDERROR_FAILED_TO_RESOLVE_ADDRESS, "Failed to resolve address: " + ec.message());
         responsePromise.set_exception(std::make_exception_ptr(ex));
-        throw ex;
+        endStream(ec);
+        return;
     }
 
     // Make the connection on the IP address we get from a lookup
@@ -95,14 +152,28 @@ void HttpSession::on_resolve(boost::system::error_code ec, tcp::resolver::result
 
 void HttpSession::on_connect(boost::system::error_code ec)
 {
+    if (!ec && isCanceled) {
+        ec = boost::asio::error::operation_aborted;
+    }
     if (ec) {
         auto ex = ETCDError(ETCDERROR_FAILED_TO_CONNECT, "Failed to connect: " + ec.message());
         responsePromise.set_exception(std::make_exception_ptr(ex));
-        throw ex;
+        endStream(ec);
+        return;
     }
 
     // Send the HTTP request to the remote host
     auto self = shared_from_this();
+    if (isStreamingRequest) {
+        // only the header is written here; the chunks of the body are the messages of write_message()
+        requestSerializer_.emplace(req_);
+        http::async_write_header(
+            socket_, *requestSerializer_,
+            strand_.wrap([self](boost::system::error_code ec, std::size_t bytes_transferred) {
+                self->on_write(ec, bytes_transferred);
+            }));
+        return;
+    }
     http::async_write(socket_, req_,
                       [self](boost::system::error_code ec, std::size_t bytes_transferred) {
                           self->on_write(ec, bytes_transferred);
@@ -115,17 +186,25 @@ void HttpSession::on_write(boost::system::error_code ec, std::size_t)
         auto ex = ETCDError(ETCDERROR_FAILED_TO_WRITE_SOCKET,
                             "Failed to write to socket with error: " + ec.message());
         responsePromise.set_exception(std::make_exception_ptr(ex));
-        throw ex;
+        endStream(ec);
+        return;
     }
 
+    auto writer = shared_from_this();
+    strand_.post([writer]() {
+        writer->isRequestWritten = true;
+        writer->writeNextMessage();
+    });
+
     if (isLongRunningRequest) {
-        if (!parser_.is_done()) {
+        if (!parser_.is_done() && !isCanceled) {
             // Receive the HTTP response header
             auto self = shared_from_this();
-            http::async_read_header(socket_, buffer_, parser_,
-                                    [self](boost::system::error_code ec, std::size_t bytes_transferred) {
-                                        self->on_read_long_running(ec, bytes_transferred);
-                                    });
+            http::async_read_header(
+                socket_, buffer_, parser_,
+                strand_.wrap([self](boost::system::error_code ec, std::size_t bytes_transferred) {
+                    self->on_read_long_running(ec, bytes_transferred);
+                }));
         }
     } else {
         // Receive the HTTP response
@@ -144,9 +223,9 @@ void HttpSession::on_read(boost::system::error_code ec, std::size_t)
         auto ex = ETCDError(ETCDERROR_FAILED_TO_READ_SOCKET,
                             "Failed to read from socket with error: " + ec.message());
         responsePromise.set_exception(std::make_exception_ptr(ex));
-        throw ex;
+        return;
     }
-    responsePromise.set_value(res_);
+    responsePromise.set_value(std::move(res_));
 }
 
 void HttpSession::on_read_long_running(boost::system::error_code ec, std::size_t)
@@ -155,67 +234,412 @@ void HttpSession::on_read_long_running(boost::system::error_code ec, std::size_t
         auto ex = ETCDError(ETCDERROR_FAILED_TO_READ_SOCKET_LONG_RUNNING,
                             "Failed to read from socket for a long running session with error: " +
                                 ec.message());
-        if (ec == boost::asio::error::operation_aborted ||
-            ec == boost::beast::http::error::partial_message // long running request never really ends,
-                                                             // so all messages are partial
-        ) {
-            return;
-        }
         if (!firstTimeSet) {
             firstTimeSet = true;
             responsePromise.set_exception(std::make_exception_ptr(ex));
         }
-        throw ex;
+        // the error is in the response future; it's not thrown from the handler, which would take the
+        // thread out of the io_context
+        endStream(ec);
+        return;
     }
 
-    jsonParser.pushData(parser_.get().body());
+    boost::system::error_code parseEc;
+    jsonParser.pushData(parser_.get().body(), parseEc);
+    if (parseEc) {
+        // a body that isn't a stream of json objects, like the error page of a restarting gateway: the
+        // stream ends, so that its owner connects again
+        if (!firstTimeSet) {
+            firstTimeSet = true;
+            auto ex = ETCDError(parseEc.value(),
+                                "Failed to parse a long running response: " + parseEc.message());
+            responsePromise.set_exception(std::make_exception_ptr(ex));
+        }
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+        endStream(parseEc);
+        return;
+    }
     if (!firstTimeSet) {
         firstTimeSet = true;
         responsePromise.set_value(parser_.get());
     }
     parser_.get().body().clear();
 
-    std::vector<Json::Value> parsedData = jsonParser.pullDataAndClear();
-    for (const auto& jsonValue : parsedData) {
-        dataAvailableCallback_(jsonValue);
+    // each complete message is handed out as it is in the stream, to be decoded once by the callback
+    for (boost::string_view message : jsonParser.pullObjects()) {
+        dataAvailableCallback_(message);
     }
 
-    if (!parser_.is_done()) {
-        auto self = shared_from_this();
-        boost::beast::http::async_read_some(
-            socket_, buffer_, parser_,
-            strand_.wrap([self](boost::system::error_code ec, std::size_t bytes_transferred) {
-                self->on_read_long_running(ec, bytes_transferred);
-            }));
+    if (parser_.is_done()) {
+        endStream(boost::beast::http::error::end_of_stream);
+    } else if (isReadPaused) {
+        isReadWaiting = true;
+    } else {
+        readLongRunning();
+    }
+}
+
+void HttpSession::readLongRunning()
+{
+    if (isCanceled) {
+        return;
     }
+    auto self = shared_from_this();
+    boost::beast::http::async_read_some(
+        socket_, buffer_, parser_,
+        strand_.wrap([self](boost::system::error_code ec, std::size_t bytes_transferred) {
+            self->on_read_long_running(ec, bytes_transferred);
+        }));
+}
+
+void HttpSession::pauseReading()
+{
+    // the read handlers run on the strand, and so do these; called from one of them, it's immediate
+    auto self = shared_from_this();
+    strand_.dispatch([self]() { self->isReadPaused = true; });
+}
+
+void HttpSession::resumeReading()
+{
+    auto self = shared_from_this();
+    strand_.dispatch([self]() {
+        self->isReadPaused = false;
+        if (self->isReadWaiting) {
+            self->isReadWaiting = false;
+            self->readLongRunning();
+        }
+    });
 }
 
 std::shared_future<void> HttpSession::write_message(const std::string& msg)
 {
-    auto s = shared_from_this();
+    std::shared_ptr<MessageData> messageData = std::make_shared<MessageData>();
+    messageData->message                     = msg;
+    std::shared_future<void> done            = messageData->donePromise.get_future();
+    auto                     self            = shared_from_this();
+    strand_.post([self, messageData]() {
+        self->messageQueue.push_back(messageData);
+        self->writeNextMessage();
+    });
+    return done;
+}
+
+void HttpSession::writeNextMessage()
+{
+    if (!isRequestWritten || isWritingMessage || messageQueue.empty()) {
+        return;
+    }
+    isWritingMessage                         = true;
+    std::shared_ptr<MessageData> messageData = std::move(messageQueue.front());
+    messageQueue.pop_front();
 
-    std::shared_ptr<CancelMessageData> cancelData = std::make_shared<CancelMessageData>();
-    cancelData->message                           = msg;
-    auto self                                     = shared_from_this();
-    boost::asio::async_write(
-        s->socket_, boost::asio::buffer(cancelData->message),
-        [self, cancelData](boost::system::error_code ec, std::size_t bytes_transferred) {
-            self->write_message_callback(ec, bytes_transferred, cancelData);
+    auto self    = shared_from_this();
+    auto handler = strand_.wrap(
+        [self, messageData](boost::system::error_code ec, std::size_t bytes_transferred) {
+            self->write_message_callback(ec, bytes_transferred, messageData);
         });
-    return cancelData->donePromise.get_future();
+    if (isStreamingRequest) {
+        boost::asio::async_write(socket_, http::make_chunk(boost::asio::buffer(messageData->message)),
+                                 std::move(handler));
+    } else {
+        boost::asio::async_write(socket_, boost::asio::buffer(messageData->message), std::move(handler));
+    }
 }
 
 void HttpSession::write_message_callback(boost::system::error_code ec, std::size_t /*bytes_transferred*/,
-                                         std::shared_ptr<CancelMessageData> cancelData)
+                                         std::shared_ptr<MessageData> messageData)
 {
+    isWritingMessage = false;
     if (ec) {
-        cancelData->donePromise.set_exception(std::make_exception_ptr(
-            ETCDError(ETCDERROR_CANCEL_WATCH_RETURNED_ERROR, "Error while canceling watch with call " +
-                                                                 cancelData->message +
+        messageData->donePromise.set_exception(std::make_exception_ptr(
+            ETCDError(ETCDERROR_CANCEL_WATCH_RETURNED_ERROR, "Error while writing message " +
+                                                                 messageData->message +
                                                                  " ; with error: " + ec.message())));
         return;
     }
-    cancelData->donePromise.set_value();
+    messageData->donePromise.set_value();
+    writeNextMessage();
+}
+
+void HttpSession::connect(const std::string& host, const std::string& port, unsigned pipelineDepth)
+{
+    host_          = host;
+    port_          = port;
+    pipelineDepth_ = std::max(pipelineDepth, 1u);
+    auto self      = shared_from_this();
+    strand_.post([self]() { self->startConnect(); });
+}
+
+std::future<HttpSession::Result> HttpSession::enqueueRequest(http::verb verb, const std::string& target,
+                                                             std::string body, int version,
+                                                             bool isIdempotent)
+{
+    auto                promise = std::make_shared<std::promise<Result>>();
+    std::future<Result> result  = promise->get_future();
+    enqueueRequest(verb, target, std::move(body), version,
+                   [promise](boost::system::error_code ec, boost::system::error_code cause,
+                             http::response<http::string_body> res) {
+                       promise->set_value(Result{ec, cause, std::move(res)});
+                   },
+                   isIdempotent);
+    return result;
+}
+
+void HttpSession::enqueueRequest(http::verb verb, const std::string& target, std::string body, int version,
+                                 ResponseHandler handler, bool isIdempotent)
+{
+    std::shared_ptr<QueuedRequest> request = std::make_shared<QueuedRequest>();
+    request->req.version(version);
+    request->req.method(verb);
+    request->req.target(target);
+    request->req.keep_alive(true);
+    request->req.set(http::field::host, host_);
+    request->req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    request->req.set(http::field::content_type, "application/json");
+    request->req.body() = std::move(body);
+    request->req.prepare_payload();
+    request->handler      = std::move(handler);
+    request->isIdempotent = isIdempotent;
+
+    outstandingRequests_++;
+    auto self = shared_from_this();
+    strand_.post([self, request]() {
+        self->requestQueue.push_back(request);
+        self->doNextRequest();
+    });
+}
+
+std::size_t HttpSession::outstandingRequests() const { return outstandingRequests_.load(); }
+
+std::chrono::steady_clock::time_point HttpSession::lastActivity() const
+{
+    return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(lastActivity_.load()));
+}
+
+void HttpSession::close()
+{
+    auto self = shared_from_this();
+    strand_.post([self]() {
+        self->isClosed = true;
+        self->closeSocket();
+        // the request wasn't sent
+        self->failQueuedRequests(MakeETCDErrorCode(ETCDERROR_FAILED_TO_CONNECT),
+                                 boost::asio::error::operation_aborted);
+    });
+}
+
+void HttpSession::startConnect()
+{
+    if (isClosed || connectionState != ConnectionState::Disconnected) {
+        return;
+    }
+    connectionState = ConnectionState::Connecting;
+    auto self       = shared_from_this();
+    resolver_.async_resolve(
+        host_, port_,
+        strand_.wrap([self](boost::system::error_code ec, tcp::resolver::results_type results) {
+            self->on_resolve_persistent(ec, results);
+        }));
+}
+
+void HttpSession::closeSocket()
+{
+    boost::system::error_code ec;
+    socket_.shutdown(tcp::socket::shutdown_both, ec);
+    socket_.close(ec);
+    buffer_.consume(buffer_.size());
+    responseParser_.reset();
+    // handlers of the operations that were pending on the closed socket are ignored
+    connectionId++;
+    connectionState        = ConnectionState::Disconnected;
+    connectionReused       = false;
+    answeredWhilePipelined = false;
+    isWriting              = false;
+    isReading              = false;
+}
+
+void HttpSession::touch() { lastActivity_ = std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+void HttpSession::failQueuedRequests(boost::system::error_code ec, boost::system::error_code cause)
+{
+    requestQueue.insert(requestQueue.begin(), inFlightRequests.begin(), inFlightRequests.end());
+    inFlightRequests.clear();
+    for (const auto& request : requestQueue) {
+        outstandingRequests_--;
+        request->handler(ec, cause, http::response<http::string_body>());
+    }
+    requestQueue.clear();
+}
+
+void HttpSession::doNextRequest()
+{
+    if (connectionState == ConnectionState::Disconnected) {
+        if (!requestQueue.empty()) {
+            startConnect();
+        }
+        return;
+    }
+    if (connectionState == ConnectionState::Connecting) {
+        return;
+    }
+
+    auto self = shared_from_this();
+    auto id   = connectionId;
+
+    // requests are written back-to-back, up to the pipeline depth, without waiting for the responses
+    if (!isWriting && !requestQueue.empty() && inFlightRequests.size() < pipelineDepth_) {
+        std::shared_ptr<QueuedRequest> request = requestQueue.front();
+        requestQueue.pop_front();
+        inFlightRequests.push_back(request);
+        request->isOnReusedConnection = connectionReused;
+        isWriting                     = true;
+        http::async_write(
+            socket_, request->req,
+            strand_.wrap([self, id, request](boost::system::error_code ec, std::size_t bytes_transferred) {
+                self->on_write_persistent(ec, bytes_transferred, id);
+            }));
+    }
+
+    // responses arrive in the order the requests were written
+    if (!isReading && !inFlightRequests.empty()) {
+        isReading = true;
+        responseParser_.emplace();
+        responseParser_->body_limit(std::numeric_limits<std::uint64_t>::max());
+        http::async_read(socket_, buffer_, *responseParser_,
+                         strand_.wrap([self, id](boost::system::error_code ec, std::size_t bytes_transferred) {
+                             self->on_read_persistent(ec, bytes_transferred, id);
+                         }));
+    }
+}
+
+void HttpSession::on_resolve_persistent(boost::system::error_code ec, tcp::resolver::results_type results)
+{
+    if (ec) {
+        connectionState = ConnectionState::Disconnected;
+        failQueuedRequests(MakeETCDErrorCode(ETCDERROR_FAILED_TO_RESOLVE_ADDRESS), ec);
+        return;
+    }
+
+    auto self = shared_from_this();
+    boost::asio::async_connect(
+        socket_, results.begin(), results.end(),
+        strand_.wrap([self](boost::system::error_code ec, boost::asio::ip::tcp::resolver::iterator) {
+            self->on_connect_persistent(ec);
+        }));
+}
+
+void HttpSession::on_connect_persistent(boost::system::error_code ec)
+{
+    if (ec) {
+        closeSocket();
+        failQueuedRequests(MakeETCDErrorCode(ETCDERROR_FAILED_TO_CONNECT), ec);
+        return;
+    }
+    if (isClosed) {
+        closeSocket();
+        return;
+    }
+
+    connectionState = ConnectionState::Connected;
+    touch();
+    doNextRequest();
+}
+
+void HttpSession::on_write_persistent(boost::system::error_code ec, std::size_t, uint64_t id)
+{
+    if (id != connectionId) {
+        return;
+    }
+    isWriting = false;
+    if (ec) {
+        handleConnectionError(ec, ETCDERROR_FAILED_TO_WRITE_SOCKET);
+        return;
+    }
+    doNextRequest();
+}
+
+void HttpSession::on_read_persistent(boost::system::error_code ec, std::size_t, uint64_t id)
+{
+    if (id != connectionId) {
+        return;
+    }
+    isReading = false;
+    if (ec) {
+        handleConnectionError(ec, ETCDERROR_FAILED_TO_READ_SOCKET);
+        return;
+    }
+
+    http::response<http::string_body> res = responseParser_->release();
+    responseParser_.reset();
+    std::shared_ptr<QueuedRequest> request = std::move(inFlightRequests.front());
+    inFlightRequests.pop_front();
+
+    connectionReused = true;
+    if (!inFlightRequests.empty()) {
+        answeredWhilePipelined = true;
+    }
+    touch();
+    std::deque<std::shared_ptr<QueuedRequest>> dropped;
+    if (!res.keep_alive()) {
+        // the requests written after this one will never be answered on this connection. The idempotent
+        // ones are sent again; the others fail, as nothing tells whether the server applied them
+        for (auto it = inFlightRequests.rbegin(); it != inFlightRequests.rend(); ++it) {
+            if ((*it)->isIdempotent) {
+                requestQueue.push_front(std::move(*it));
+            } else {
+                dropped.push_front(std::move(*it));
+            }
+        }
+        inFlightRequests.clear();
+        closeSocket();
+    }
+    outstandingRequests_--;
+    request->handler(boost::system::error_code(), boost::system::error_code(), std::move(res));
+    for (const auto& droppedRequest : dropped) {
+        outstandingRequests_--;
+        droppedRequest->handler(MakeETCDErrorCode(ETCDERROR_FAILED_TO_READ_SOCKET),
+                                http::error::end_of_stream, http::response<http::string_body>());
+    }
+
+    doNextRequest();
+}
+
+void HttpSession::handleConnectionError(boost::system::error_code ec, int errorCode)
+{
+    const bool wasPipelined = answeredWhilePipelined && inFlightRequests.size() > 1;
+    // only the oldest request in flight can have a partial response
+    const bool gotResponseByte = (responseParser_ && responseParser_->got_some()) || buffer_.size() > 0;
+    closeSocket();
+
+    // a kept-alive connection may be closed by the server at any time (e.g. while idle), which is only
+    // noticed when requests are sent. A request written after the connection was reused that got no
+    // response byte was likely never read by the server, and is retried once on a new connection if
+    // applying it twice does no harm; anything else may have been applied, so it's failed
+    const bool isStaleConnection =
+        ec == boost::asio::error::eof || ec == boost::asio::error::connection_reset ||
+        ec == boost::asio::error::broken_pipe || ec == http::error::end_of_stream;
+    if (isStaleConnection && wasPipelined) {
+        // the server answered some of the pipelined requests and then dropped the rest, so it's not
+        // trusted with pipelining anymore
+        pipelineDepth_ = 1;
+    }
+
+    const boost::system::error_code failure = MakeETCDErrorCode(errorCode);
+    while (!inFlightRequests.empty()) {
+        std::shared_ptr<QueuedRequest> request = std::move(inFlightRequests.back());
+        inFlightRequests.pop_back();
+        const bool hasResponseByte = gotResponseByte && inFlightRequests.empty();
+        if (!isClosed && isStaleConnection && !request->retried && request->isIdempotent &&
+            request->isOnReusedConnection && !hasResponseByte) {
+            request->retried = true;
+            requestQueue.push_front(std::move(request));
+        } else {
+            outstandingRequests_--;
+            request->handler(failure, ec, http::response<http::string_body>());
+        }
+    }
+    doNextRequest();
 }
 
 HttpSession::~HttpSession()
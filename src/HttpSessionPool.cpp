@@ -0,0 +1,121 @@
+#include "etcd-beast/HttpSessionPool.h"
+
+#include "etcd-beast/ETCDError.h"
+
+namespace http = boost::beast::http; // from <boost/beast/http.hpp>
+
+HttpSessionPool::HttpSessionPool(boost::asio::io_context& ioc, const std::string& host,
+                                 const std::string& port, const HttpSessionPoolConfig& config)
+    : ioc_(ioc), host_(host), port_(port), config_(config), evictionTimer(ioc)
+{
+    if (config_.maxSize == 0 || config_.minSize > config_.maxSize) {
+        throw ETCDError(ETCDERROR_INVALID_POOL_SIZE,
+                        "Invalid connection pool size; min: " + std::to_string(config_.minSize) +
+                            ", max: " + std::to_string(config_.maxSize));
+    }
+    if (config_.pipelineDepth == 0) {
+        throw ETCDError(ETCDERROR_INVALID_PIPELINE_DEPTH, "Pipeline depth must be at least 1");
+    }
+}
+
+HttpSessionPool::~HttpSessionPool() { shutdown(); }
+
+void HttpSessionPool::warmUp()
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    while (sessions.size() < config_.minSize) {
+        createSession();
+    }
+    scheduleEviction();
+}
+
+std::future<HttpSession::Result> HttpSessionPool::request(http::verb verb, const std::string& target,
+                                                         std::string body, bool isIdempotent)
+{
+    static const int httpVersion = 11; // http 1.1
+
+    std::lock_guard<std::mutex> lg(mtx);
+    return pickSession()->enqueueRequest(verb, target, std::move(body), httpVersion, isIdempotent);
+}
+
+void HttpSessionPool::request(http::verb verb, const std::string& target, std::string body,
+                              HttpSession::ResponseHandler handler, bool isIdempotent)
+{
+    static const int httpVersion = 11; // http 1.1
+
+    std::lock_guard<std::mutex> lg(mtx);
+    pickSession()->enqueueRequest(verb, target, std::move(body), httpVersion, std::move(handler),
+                                  isIdempotent);
+}
+
+std::size_t HttpSessionPool::size() const
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    return sessions.size();
+}
+
+void HttpSessionPool::shutdown()
+{
+    std::lock_guard<std::mutex> lg(mtx);
+    isShutdown = true;
+    boost::system::error_code ec;
+    evictionTimer.cancel(ec);
+}
+
+std::shared_ptr<HttpSession> HttpSessionPool::createSession()
+{
+    auto session = std::make_shared<HttpSession>(ioc_);
+    session->connect(host_, port_, config_.pipelineDepth);
+    sessions.push_back(session);
+    return session;
+}
+
+std::shared_ptr<HttpSession> HttpSessionPool::pickSession()
+{
+    std::shared_ptr<HttpSession> best;
+    for (const auto& session : sessions) {
+        if (!best || session->outstandingRequests() < best->outstandingRequests()) {
+            best = session;
+        }
+    }
+    if (best && best->outstandingRequests() == 0) {
+        return best;
+    }
+    // new connections are preferred over pipelining, since pipelined responses can't overtake each other
+    if (sessions.size() < config_.maxSize) {
+        return createSession();
+    }
+    return best;
+}
+
+void HttpSessionPool::scheduleEviction()
+{
+    if (isShutdown || config_.idleTimeout.count() <= 0) {
+        return;
+    }
+    evictionTimer.expires_after(config_.idleTimeout / 2);
+    evictionTimer.async_wait([this](boost::system::error_code ec) {
+        if (ec) {
+            return;
+        }
+        std::lock_guard<std::mutex> lg(mtx);
+        if (isShutdown) {
+            return;
+        }
+        evictIdleSessions();
+        scheduleEviction();
+    });
+}
+
+void HttpSessionPool::evictIdleSessions()
+{
+    const auto now = std::chrono::steady_clock::now();
+    for (auto it = sessions.begin(); it != sessions.end() && sessions.size() > config_.minSize;) {
+        if ((*it)->outstandingRequests() == 0 && now - (*it)->lastActivity() > config_.idleTimeout) {
+            (*it)->close();
+            it = sessions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
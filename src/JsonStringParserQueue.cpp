@@ -1,60 +1,153 @@
 #include "etcd-beast/JsonStringParserQueue.h"
 
 #include "etcd-beast/ETCDError.h"
+#include <algorithm>
 
-void JsonStringParserQueue::parseAndAppendJson(const std::string& jsonStr)
+JsonStringParserQueue::JsonStringParserQueue(std::size_t MemoryBudget) : memoryBudget(MemoryBudget) {}
+
+void JsonStringParserQueue::compact()
 {
-    Json::Reader r;
-    Json::Value  v;
-    if (!r.parse(jsonStr, v)) {
-        throw ETCDError(ETCDERROR_FAILED_TO_PARSE_JSON_FROM_QUEUE,
-                        "Failed to parse json string: " + jsonStr);
+    // the pulled bytes are dropped once they're half of the buffer, so that each byte is moved O(1) times
+    if (consumed == 0 || consumed < buffer.size() - consumed) {
+        return;
+    }
+    buffer.erase(0, consumed);
+    scanned -= consumed;
+    objectStart = objectStart >= consumed ? objectStart - consumed : 0;
+    for (auto& object : completeObjects) {
+        object.first -= consumed;
+        object.second -= consumed;
     }
-    parsedValuesQueue.push_back(std::move(v));
+    consumed = 0;
+}
+
+void JsonStringParserQueue::fail(int errorCode, std::string message, boost::system::error_code& ec)
+{
+    clear();
+    failureMessage = std::move(message);
+    ec             = MakeETCDErrorCode(errorCode);
 }
 
-void JsonStringParserQueue::pushData(const std::string& data)
+void JsonStringParserQueue::scan(boost::system::error_code& ec)
 {
-    dataQueue.insert(dataQueue.end(), data.cbegin(), data.cend());
-    while (charCount < dataQueue.size()) {
-        if (charCount > LARGEST_EXPECTED_JSON) {
-            throw ETCDError(ETCDERROR_HUGE_UNPARSED_FROM_QUEUE, "Huge unparsed json data");
+    const char*       data = buffer.data();
+    const std::size_t size = buffer.size();
+    std::size_t       i    = scanned;
+    while (i < size) {
+        if (inString) {
+            if (escaped) {
+                escaped = false;
+                i++;
+                continue;
+            }
+            while (i < size && data[i] != '"' && data[i] != '\\') {
+                i++;
+            }
+            if (i == size) {
+                break;
+            }
+            if (data[i] == '\\') {
+                escaped = true;
+            } else {
+                inString = false;
+            }
+            i++;
+            continue;
         }
-        if (dataQueue[charCount] == _openChar) {
+
+        const char c = data[i];
+        if (c == _openChar) {
+            if (bracketLevel == 0) {
+                objectStart = i;
+            }
             bracketLevel++;
-            charCount++;
-            continue;
-        } else if (dataQueue[charCount] == _closeChar) {
-            bracketLevel--;
-            if (bracketLevel < 0) {
-                throw ETCDError(ETCDERROR_INVALID_JSON_STR_CLOSURE,
-                                "Invalid bracket appeared in string: " +
-                                    std::string(dataQueue.cbegin(), dataQueue.cend()));
+        } else if (c == _closeChar) {
+            if (bracketLevel == 0) {
+                fail(ETCDERROR_INVALID_JSON_STR_CLOSURE,
+                     "Invalid bracket appeared in string: " +
+                         std::string(data + consumed, size - consumed),
+                     ec);
+                return;
             }
-            charCount++;
+            bracketLevel--;
             if (bracketLevel == 0) {
-                parseAndAppendJson(std::string(dataQueue.begin(), dataQueue.begin() + charCount));
-                dataQueue.erase(dataQueue.begin(), dataQueue.begin() + charCount);
-                charCount -= std::distance(dataQueue.begin(), dataQueue.begin() + charCount);
-                assert(charCount >= 0);
+                completeObjects.emplace_back(objectStart, i + 1);
             }
-            continue;
-        } else {
-            charCount++;
+        } else if (bracketLevel == 0) {
+            if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                fail(ETCDERROR_FAILED_TO_PARSE_JSON_FROM_QUEUE,
+                     "Unexpected data between json objects: " +
+                         std::string(data + i, std::min<std::size_t>(size - i, 64)),
+                     ec);
+                return;
+            }
+        } else if (c == '"') {
+            inString = true;
         }
+        i++;
+    }
+    scanned = i;
+}
+
+void JsonStringParserQueue::pushData(boost::string_view data)
+{
+    boost::system::error_code ec;
+    pushData(data, ec);
+    if (ec) {
+        throw ETCDError(ec.value(), failureMessage);
+    }
+}
+
+void JsonStringParserQueue::pushData(boost::string_view data, boost::system::error_code& ec)
+{
+    ec = boost::system::error_code();
+    compact();
+    if (buffer.size() - consumed + data.size() > memoryBudget) {
+        fail(ETCDERROR_HUGE_UNPARSED_FROM_QUEUE,
+             "Huge unparsed json data, more than " + std::to_string(memoryBudget) + " bytes", ec);
+        return;
     }
+    buffer.append(data.data(), data.size());
+    scan(ec);
+}
+
+std::vector<boost::string_view> JsonStringParserQueue::pullObjects()
+{
+    std::vector<boost::string_view> res;
+    res.reserve(completeObjects.size());
+    for (const auto& object : completeObjects) {
+        res.emplace_back(buffer.data() + object.first, object.second - object.first);
+    }
+    completeObjects.clear();
+    consumed = bracketLevel == 0 ? scanned : objectStart;
+    return res;
 }
 
 std::vector<Json::Value> JsonStringParserQueue::pullDataAndClear()
 {
-    std::vector<Json::Value> res = std::move(parsedValuesQueue);
+    std::vector<Json::Value> res;
+    Json::Reader             r;
+    for (boost::string_view object : pullObjects()) {
+        Json::Value v;
+        if (!r.parse(object.data(), object.data() + object.size(), v)) {
+            throw ETCDError(ETCDERROR_FAILED_TO_PARSE_JSON_FROM_QUEUE,
+                            "Failed to parse json string: " + std::string(object));
+        }
+        res.push_back(std::move(v));
+    }
     return res;
 }
 
 void JsonStringParserQueue::clear()
 {
-    dataQueue.clear();
-    parsedValuesQueue.clear();
-    charCount    = 0;
+    buffer.clear();
+    completeObjects.clear();
+    consumed     = 0;
+    scanned      = 0;
+    objectStart  = 0;
     bracketLevel = 0;
+    inString     = false;
+    escaped      = false;
 }
+
+void JsonStringParserQueue::setMemoryBudget(std::size_t MemoryBudget) { memoryBudget = MemoryBudget; }
@@ -0,0 +1,80 @@
+// Throughput benchmark of the base64 implementations of ETCDBase64 against boost::beast::detail::base64,
+// for sizes from short keys to large values.
+//
+// usage: etcd-beast-bench-base64 [megabytes per measurement = 256]
+
+#include "etcd-beast/ETCDBase64.h"
+
+#include <boost/beast/core/detail/base64.hpp>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+double MeasureMBps(std::size_t bytesPerCall, std::size_t totalBytes, const std::function<std::size_t()>& f)
+{
+    std::size_t calls = std::max<std::size_t>(1, totalBytes / bytesPerCall);
+    std::size_t check = 0;
+    auto        start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < calls; i++) {
+        check += f();
+    }
+    auto   end     = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (check == 0) {
+        std::printf("nothing was processed\n");
+    }
+    return static_cast<double>(calls * bytesPerCall) / seconds / (1024 * 1024);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    namespace beast64 = boost::beast::detail::base64;
+
+    std::size_t totalBytes = (argc > 1 ? std::stoul(argv[1]) : 256) * 1024 * 1024;
+    std::printf("active implementation: %s\n\n",
+                ETCDBase64::ImplementationName(ETCDBase64::ActiveImplementation()));
+    std::printf("%-8s %-7s %12s %12s\n", "size", "impl", "encode MB/s", "decode MB/s");
+
+    std::mt19937 gen(42);
+    for (std::size_t size : {16, 64, 256, 1024, 4096, 65536, 1048576}) {
+        std::string data(size, '\0');
+        for (char& c : data) {
+            c = static_cast<char>(gen());
+        }
+        std::string encoded(ETCDBase64::EncodedSize(size), '\0');
+        encoded.resize(beast64::encode(&encoded[0], data.data(), size));
+        std::string out(ETCDBase64::EncodedSize(size) + ETCDBase64::DecodedSize(encoded.size()), '\0');
+
+        double beastEncode = MeasureMBps(size, totalBytes, [&]() {
+            return beast64::encode(&out[0], data.data(), size);
+        });
+        double beastDecode = MeasureMBps(size, totalBytes, [&]() {
+            return beast64::decode(&out[0], encoded.data(), encoded.size()).first;
+        });
+        std::printf("%-8zu %-7s %12.0f %12.0f\n", size, "beast", beastEncode, beastDecode);
+
+        for (ETCDBase64::Implementation impl :
+             {ETCDBase64::Implementation::Scalar, ETCDBase64::Implementation::SSE41,
+              ETCDBase64::Implementation::AVX2}) {
+            if (!ETCDBase64::IsSupported(impl)) {
+                continue;
+            }
+            double encode = MeasureMBps(size, totalBytes, [&]() {
+                return ETCDBase64::Encode(&out[0], data.data(), size, impl);
+            });
+            double decode = MeasureMBps(size, totalBytes, [&]() {
+                return ETCDBase64::Decode(&out[0], encoded.data(), encoded.size(), impl).first;
+            });
+            std::printf("%-8zu %-7s %12.0f %12.0f\n", size, ETCDBase64::ImplementationName(impl), encode,
+                        decode);
+        }
+    }
+    return 0;
+}
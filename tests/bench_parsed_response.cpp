@@ -0,0 +1,162 @@
+// Microbenchmark of decoding a large range (getAll) response: the streaming ETCDResponseDecoder used by
+// ETCDParsedResponse against a jsoncpp tree into string entries, which is how responses were decoded
+// before. The map mode also builds the key map of the response, which is otherwise only built on use.
+//
+// usage: etcd-beast-bench-parsed-response [entries = 100000] [iterations = 10] [both|streaming|map|tree]
+// Run one decoder at a time to compare their peak memory (max rss).
+
+#include "etcd-beast/ETCDParsedResponse.h"
+
+#include <boost/beast/core/detail/base64.hpp>
+#include <chrono>
+#include <iostream>
+#include <jsoncpp/json/json.h>
+#include <string>
+#include <sys/resource.h>
+
+namespace {
+
+std::string ToBase64(const std::string& str)
+{
+    std::string result;
+    result.resize(boost::beast::detail::base64::encoded_size(str.size()));
+    result.resize(boost::beast::detail::base64::encode(&result[0], str.data(), str.size()));
+    return result;
+}
+
+std::string FromBase64(const std::string& str)
+{
+    std::string result;
+    result.resize(boost::beast::detail::base64::decoded_size(str.size()));
+    result.resize(boost::beast::detail::base64::decode(&result[0], str.data(), str.size()).first);
+    return result;
+}
+
+std::string MakeRangeResponse(int entries)
+{
+    std::string json = R"({"header":{"cluster_id":"14841639068965178418","member_id":"10276657743932975437",)"
+                       R"("revision":"1234567","raft_term":"7"},"kvs":[)";
+    for (int i = 0; i < entries; i++) {
+        if (i > 0) {
+            json += ",";
+        }
+        const std::string rev = std::to_string(1000 + i);
+        json += R"({"key":")" + ToBase64("/services/config/entry/" + std::to_string(i)) +
+                R"(","create_revision":")" + rev + R"(","mod_revision":")" + rev +
+                R"(","version":"1","value":")" +
+                ToBase64(R"({"host":"10.0.0.)" + std::to_string(i % 256) + R"(","port":8080,"weight":)" +
+                         std::to_string(i % 100) + "}") +
+                R"("})";
+    }
+    json += R"(],"count":")" + std::to_string(entries) + R"("})";
+    return json;
+}
+
+// the entries as they were before they pointed into the memory of the response
+struct TreeKVEntry
+{
+    std::string key;
+    std::string value;
+    std::string create_revision;
+    std::string mod_revision;
+    std::string version;
+};
+
+// the tree based decoding, with the same result as ETCDParsedResponse
+std::size_t DecodeWithTree(const std::string& json)
+{
+    Json::Value  v;
+    Json::Reader r;
+    if (!r.parse(json, v)) {
+        throw std::runtime_error("failed to parse");
+    }
+    uint64_t revision = std::stoull(v["header"]["revision"].asString());
+
+    std::vector<TreeKVEntry> kvEntriesVec;
+    const auto&              kvs = v["kvs"];
+    for (unsigned i = 0; i < kvs.size(); i++) {
+        TreeKVEntry kv;
+        kv.create_revision = kvs[i]["create_revision"].asString();
+        kv.mod_revision    = kvs[i]["mod_revision"].asString();
+        kv.version         = kvs[i]["version"].asString();
+        kv.key             = FromBase64(kvs[i]["key"].asString());
+        kv.value           = kvs[i].isMember("value") ? FromBase64(kvs[i]["value"].asString()) : "";
+        kvEntriesVec.push_back(kv);
+    }
+    std::unordered_map<std::string, TreeKVEntry> kvEntriesMap;
+    for (const auto& kv : kvEntriesVec) {
+        kvEntriesMap[kv.key] = kv;
+    }
+    return kvEntriesMap.size() + (revision == 0);
+}
+
+std::size_t DecodeStreaming(const std::string& json)
+{
+    ETCDParsedResponse r(json);
+    return r.getKVEntriesVec().size() + (r.getRevision() == 0);
+}
+
+std::size_t DecodeStreamingWithMap(const std::string& json)
+{
+    ETCDParsedResponse r(json);
+    return r.getKVEntriesMap().size() + (r.getRevision() == 0);
+}
+
+template <typename Decoder>
+double Measure(const std::string& json, int iterations, Decoder decoder)
+{
+    std::size_t check = 0;
+    auto        start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        check += decoder(json);
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (check == 0) {
+        std::cerr << "nothing was decoded" << std::endl;
+    }
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+long MaxRssKb()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int         entries    = argc > 1 ? std::stoi(argv[1]) : 100000;
+    int         iterations = argc > 2 ? std::stoi(argv[2]) : 10;
+    std::string mode       = argc > 3 ? argv[3] : "both";
+
+    const std::string json = MakeRangeResponse(entries);
+    std::cout << "range response with " << entries << " entries, " << json.size() / 1024 << " KiB" << std::endl;
+    long baseRss = MaxRssKb();
+
+    double treeMs      = 0;
+    double streamingMs = 0;
+    double mapMs       = 0;
+    if (mode == "both" || mode == "tree") {
+        treeMs = Measure(json, iterations, DecodeWithTree);
+        std::cout << "jsoncpp tree:      " << treeMs << " ms/response" << std::endl;
+    }
+    if (mode == "both" || mode == "streaming") {
+        streamingMs = Measure(json, iterations, DecodeStreaming);
+        std::cout << "streaming decoder: " << streamingMs << " ms/response" << std::endl;
+    }
+    if (mode == "both" || mode == "map") {
+        mapMs = Measure(json, iterations, DecodeStreamingWithMap);
+        std::cout << "streaming and map: " << mapMs << " ms/response" << std::endl;
+    }
+    if (mode == "both") {
+        std::cout << "speedup:           " << treeMs / streamingMs << "x, " << treeMs / mapMs << "x with the map"
+                  << std::endl;
+    } else {
+        std::cout << "peak memory above the response text: " << (MaxRssKb() - baseRss) / 1024 << " MiB"
+                  << std::endl;
+    }
+    return 0;
+}
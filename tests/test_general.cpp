@@ -1,10 +1,38 @@
 #include "gtest/gtest.h"
 
+#include "etcd-beast/ETCDBase64.h"
 #include "etcd-beast/ETCDClient.h"
 #include "etcd-beast/ETCDError.h"
 #include "etcd-beast/ETCDParsedResponse.h"
+#include "etcd-beast/ETCDRequestBody.h"
 #include "etcd-beast/JsonStringParserQueue.h"
 
+#include <boost/asio/use_future.hpp>
+#include <boost/beast/core/detail/base64.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <sstream>
+
+// counts the allocations of each thread, to check the allocations of the request body builder
+thread_local std::size_t AllocationCount__test = 0;
+
+void* operator new(std::size_t size)
+{
+    ++AllocationCount__test;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
 std::string GenerateRandomString__test(const int len)
 {
     static const char alphanum[] = "0123456789"
@@ -93,6 +121,80 @@ TEST(etcd_beast, set_get_many)
     EXPECT_EQ(rga2.getKVEntriesVec().size(), 0);
 }
 
+TEST(etcd_beast, set_get_many_pooled_concurrently)
+{
+    HttpSessionPoolConfig poolConfig;
+    poolConfig.minSize     = 2;
+    poolConfig.maxSize     = 4;
+    poolConfig.idleTimeout = std::chrono::milliseconds(200);
+    ETCDClient client("127.0.0.1", 2379, 4, poolConfig);
+    srand(time(nullptr));
+    int                                              numOfEntries = 1000;
+    std::vector<std::pair<std::string, std::string>> kvPairs;
+    std::vector<ETCDResponse>                        setResponses;
+    for (int i = 0; i < numOfEntries; i++) {
+        kvPairs.push_back(
+            std::make_pair(GenerateRandomString__test(10), GenerateRandomString__test(100)));
+        setResponses.push_back(client.set("/test/" + kvPairs.back().first, kvPairs.back().second));
+    }
+    for (auto& r : setResponses) {
+        EXPECT_NO_THROW(r.wait().getRevision());
+    }
+    std::vector<ETCDResponse> getResponses;
+    for (int i = 0; i < numOfEntries; i++) {
+        getResponses.push_back(client.get("/test/" + kvPairs[i].first));
+    }
+    for (int i = 0; i < numOfEntries; i++) {
+        ASSERT_EQ(getResponses[i].getKVEntriesVec().size(), 1) << getResponses[i].getJsonResponse();
+        EXPECT_EQ(getResponses[i].getKVEntriesVec().at(0).value, kvPairs[i].second);
+    }
+
+    // idle connections above the minimum are closed, and the remaining ones are still usable
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    ETCDResponse rd   = client.delAll("/test/").wait();
+    ETCDResponse rga2 = client.getAll("/test/").wait();
+    EXPECT_EQ(rga2.getKVEntriesVec().size(), 0);
+}
+
+TEST(etcd_beast, set_get_many_pipelined)
+{
+    HttpSessionPoolConfig poolConfig;
+    poolConfig.minSize       = 1;
+    poolConfig.maxSize       = 1;
+    poolConfig.pipelineDepth = 16;
+    ETCDClient client("127.0.0.1", 2379, 2, poolConfig);
+    srand(time(nullptr));
+    int                       numOfEntries = 1000;
+    std::vector<std::string>  values;
+    std::vector<ETCDResponse> responses;
+    for (int i = 0; i < numOfEntries; i++) {
+        values.push_back(GenerateRandomString__test(100));
+        responses.push_back(client.set("/test/" + std::to_string(i), values.back()));
+        responses.push_back(client.get("/test/" + std::to_string(i)));
+    }
+    // responses are matched to the requests in the order they were sent
+    for (int i = 0; i < numOfEntries; i++) {
+        EXPECT_NO_THROW(responses[2 * i].wait());
+        ASSERT_EQ(responses[2 * i + 1].getKVEntriesVec().size(), 1);
+        EXPECT_EQ(responses[2 * i + 1].getKVEntriesVec().at(0).key, "/test/" + std::to_string(i));
+        EXPECT_EQ(responses[2 * i + 1].getKVEntriesVec().at(0).value, values[i]);
+    }
+    ETCDResponse rd   = client.delAll("/test/").wait();
+    ETCDResponse rga2 = client.getAll("/test/").wait();
+    EXPECT_EQ(rga2.getKVEntriesVec().size(), 0);
+}
+
+TEST(etcd_beast, invalid_pool_size)
+{
+    HttpSessionPoolConfig poolConfig;
+    poolConfig.minSize = 5;
+    poolConfig.maxSize = 2;
+    EXPECT_THROW(ETCDClient("127.0.0.1", 2379, 1, poolConfig), ETCDError);
+    poolConfig.minSize       = 1;
+    poolConfig.pipelineDepth = 0;
+    EXPECT_THROW(ETCDClient("127.0.0.1", 2379, 1, poolConfig), ETCDError);
+}
+
 std::mutex mtx;
 int        revision = -1;
 
@@ -197,6 +299,412 @@ TEST(etcd_beast, watch)
     EXPECT_EQ(rga3.getKVEntriesMap().size(), 0);
 }
 
+TEST(etcd_beast, watch_multiplexed)
+{
+    ETCDClient client("127.0.0.1", 2379);
+    client.enableWatchMultiplexing(2);
+    ETCDResponse rd = client.delAll("/test/").wait();
+
+    const int                                numOfWatches = 50;
+    std::mutex                               receivedMtx;
+    std::vector<std::vector<std::string>>    received(numOfWatches);
+    std::vector<std::unique_ptr<ETCDWatch>> watches;
+    for (int i = 0; i < numOfWatches; i++) {
+        auto callback = [&received, &receivedMtx, i](ETCDParsedResponse r) {
+            std::lock_guard<std::mutex> lg(receivedMtx);
+            for (const auto& kv : r.getKVEntriesVec()) {
+                received[i].push_back(std::string(kv.key) + "=" + std::string(kv.value));
+            }
+        };
+        watches.emplace_back(new ETCDWatch(client.watch("/test/w" + std::to_string(i), callback)));
+    }
+    for (const auto& w : watches) {
+        w->wait();
+    }
+
+    auto waitForEvents = [&](int watchIndex, std::size_t count) {
+        for (int attempt = 0; attempt < 500; attempt++) {
+            {
+                std::lock_guard<std::mutex> lg(receivedMtx);
+                if (received[watchIndex].size() >= count) {
+                    return;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    };
+
+    // every watch only gets the events of its key
+    for (int i = 0; i < numOfWatches; i++) {
+        ETCDResponse rs = client.set("/test/w" + std::to_string(i), "a" + std::to_string(i)).wait();
+    }
+    for (int i = 0; i < numOfWatches; i++) {
+        waitForEvents(i, 1);
+        std::lock_guard<std::mutex> lg(receivedMtx);
+        ASSERT_EQ(received[i].size(), 1) << i;
+        EXPECT_EQ(received[i][0], "/test/w" + std::to_string(i) + "=a" + std::to_string(i));
+    }
+
+    // canceled watches get nothing more, while the others of their stream still do
+    for (int i = 1; i < numOfWatches; i += 2) {
+        watches[i]->cancel();
+    }
+    for (int i = 0; i < numOfWatches; i++) {
+        ETCDResponse rs = client.set("/test/w" + std::to_string(i), "b" + std::to_string(i)).wait();
+    }
+    for (int i = 0; i < numOfWatches; i += 2) {
+        waitForEvents(i, 2);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    {
+        std::lock_guard<std::mutex> lg(receivedMtx);
+        for (int i = 0; i < numOfWatches; i++) {
+            ASSERT_EQ(received[i].size(), i % 2 == 0 ? 2 : 1) << i;
+        }
+        EXPECT_EQ(received[0][1], "/test/w0=b0");
+    }
+
+    watches.clear();
+    ETCDResponse rd2 = client.delAll("/test/").wait();
+}
+
+TEST(etcd_beast, watch_prefix_with_options)
+{
+    for (bool multiplexed : {false, true}) {
+        ETCDClient client("127.0.0.1", 2379);
+        if (multiplexed) {
+            client.enableWatchMultiplexing();
+        }
+        ETCDResponse rd = client.delAll("/test/").wait();
+        ETCDResponse r0 = client.set("/test/p/a", "0").wait();
+
+        std::mutex                             eventsMtx;
+        std::vector<ETCDParsedResponse::Event> events;
+        std::vector<ETCDParsedResponse>        messages; // keeps the keys and values of the events alive
+        ETCDWatchOptions                       options;
+        options.prefix   = true;
+        options.prevKv   = true;
+        options.noDelete = true;
+        ETCDWatch w = client.watch("/test/p/", options, [&](ETCDParsedResponse r) {
+            std::lock_guard<std::mutex> lg(eventsMtx);
+            events.insert(events.end(), r.getEvents().begin(), r.getEvents().end());
+            messages.push_back(r);
+        });
+        w.wait();
+
+        ETCDResponse r1 = client.set("/test/p/a", "1").wait();
+        ETCDResponse r2 = client.set("/test/q", "x").wait(); // not in the prefix
+        ETCDResponse r3 = client.del("/test/p/a").wait();    // filtered out
+        ETCDResponse r4 = client.set("/test/p/b", "2").wait();
+        for (int attempt = 0; attempt < 500; attempt++) {
+            {
+                std::lock_guard<std::mutex> lg(eventsMtx);
+                if (events.size() >= 2) {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        std::lock_guard<std::mutex> lg(eventsMtx);
+        ASSERT_EQ(events.size(), 2) << multiplexed;
+        EXPECT_EQ(events[0].type, ETCDParsedResponse::Event::Type::Put);
+        EXPECT_EQ(events[0].kv.key, "/test/p/a");
+        EXPECT_EQ(events[0].kv.value, "1");
+        ASSERT_TRUE(events[0].hasPrevKv);
+        EXPECT_EQ(events[0].prevKv.value, "0");
+        EXPECT_EQ(events[1].kv.key, "/test/p/b");
+        EXPECT_FALSE(events[1].hasPrevKv);
+    }
+
+    // replay from a revision
+    ETCDClient   client("127.0.0.1", 2379);
+    ETCDResponse r1 = client.set("/test/r", "1").wait();
+    ETCDResponse r2 = client.set("/test/r", "2").wait();
+
+    std::mutex               valuesMtx;
+    std::vector<std::string> values;
+    ETCDWatchOptions         options;
+    options.startRevision = r1.getRevision();
+    ETCDWatch w = client.watch("/test/r", options, [&](ETCDParsedResponse r) {
+        std::lock_guard<std::mutex> lg(valuesMtx);
+        for (const auto& e : r.getEvents()) {
+            values.push_back(std::string(e.kv.value));
+        }
+    });
+    w.wait();
+    for (int attempt = 0; attempt < 500; attempt++) {
+        {
+            std::lock_guard<std::mutex> lg(valuesMtx);
+            if (values.size() >= 2) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::lock_guard<std::mutex> lg(valuesMtx);
+    EXPECT_EQ(values, (std::vector<std::string>{"1", "2"}));
+}
+
+TEST(etcd_beast, read_cache)
+{
+    for (bool multiplexed : {false, true}) {
+        ETCDClient writer("127.0.0.1", 2379);
+        ETCDResponse rd  = writer.delAll("/test/").wait();
+        ETCDResponse rs1 = writer.set("/test/c/a", "1").wait();
+        ETCDResponse rs2 = writer.set("/test/c/b", "2").wait();
+        ETCDResponse rs3 = writer.set("/test/d", "x").wait();
+
+        ETCDClient client("127.0.0.1", 2379);
+        if (multiplexed) {
+            client.enableWatchMultiplexing();
+        }
+        client.enableReadCache("/test/c/");
+
+        ETCDResponse rg = client.get("/test/c/a").wait();
+        EXPECT_TRUE(rg.isFromCache());
+        ASSERT_EQ(rg.getKVEntriesVec().size(), 1);
+        EXPECT_EQ(rg.getKVEntriesVec().at(0).value, "1");
+        EXPECT_EQ(rg.getKVEntriesVec().at(0).mod_revision, rs1.getRevision());
+        EXPECT_GE(rg.getRevision(), rs3.getRevision());
+        ETCDResponse rga = client.getAll("/test/c/").wait();
+        EXPECT_TRUE(rga.isFromCache());
+        ASSERT_EQ(rga.getKVEntriesVec().size(), 2);
+        EXPECT_EQ(rga.getKVEntriesMap().at("/test/c/b").value, "2");
+        EXPECT_TRUE(client.get("/test/c/none").wait().getKVEntriesVec().empty());
+        EXPECT_FALSE(client.get("/test/d").wait().isFromCache());
+        EXPECT_FALSE(client.getAll("/test/").wait().isFromCache());
+
+        // the writes of the client are always read back, from the server until the cache has them
+        for (int i = 0; i < 20; i++) {
+            ETCDResponse rs = client.set("/test/c/a", std::to_string(i)).wait();
+            ETCDResponse r  = client.get("/test/c/a").wait();
+            ASSERT_EQ(r.getKVEntriesVec().size(), 1);
+            EXPECT_EQ(r.getKVEntriesVec().at(0).value, std::to_string(i));
+        }
+
+        // the writes of others get to the cache through its watch
+        ETCDResponse rs4 = writer.set("/test/c/e", "5").wait();
+        ETCDResponse rd2 = writer.del("/test/c/b").wait();
+        bool         isUpToDate = false;
+        for (int attempt = 0; attempt < 500 && !isUpToDate; attempt++) {
+            ETCDResponse r = client.getAll("/test/c/").wait();
+            isUpToDate     = r.isFromCache() && r.getRevision() >= rd2.getRevision();
+            if (isUpToDate) {
+                ASSERT_EQ(r.getKVEntriesVec().size(), 2);
+                EXPECT_EQ(r.getKVEntriesVec().at(0).key, "/test/c/a");
+                EXPECT_EQ(r.getKVEntriesVec().at(1).value, "5");
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        EXPECT_TRUE(isUpToDate);
+
+        // asynchronous reads too
+        ETCDParsedResponse ra = client.get("/test/c/e", boost::asio::use_future).get();
+        ASSERT_EQ(ra.getKVEntriesVec().size(), 1);
+        EXPECT_EQ(ra.getKVEntriesVec().at(0).value, "5");
+
+        // a delete that found nothing leaves the cache answering, as no event of its prefix will come;
+        // the revision of its response is that of the last write, out of the prefix
+        ETCDResponse rs5 = writer.set("/test/d", "y").wait();
+        ETCDResponse rd3 = client.del("/test/c/none").wait();
+        EXPECT_EQ(rd3.getDeletedCount(), 0u);
+        EXPECT_TRUE(client.get("/test/c/a").wait().isFromCache());
+        ETCDParsedResponse rd4 = client.delAll("/test/c/none/", boost::asio::use_future).get();
+        EXPECT_EQ(rd4.getDeletedCount(), 0u);
+        EXPECT_TRUE(client.getAll("/test/c/").wait().isFromCache());
+        EXPECT_EQ(client.del("/test/c/e").wait().getDeletedCount(), 1u);
+    }
+}
+
+TEST(etcd_beast, get_all_paginated)
+{
+    ETCDClient   client("127.0.0.1", 2379);
+    ETCDResponse rd = client.delAll("/test/").wait();
+    ETCDResponse rs = client.set("/test/q", "after the prefix").wait();
+
+    std::vector<std::string> expected;
+    for (int i = 0; i < 25; i++) {
+        std::string key = "/test/p/" + std::to_string(100 + i);
+        ETCDResponse r  = client.set(key, std::to_string(i)).wait();
+        expected.push_back(key);
+    }
+
+    // a last page that is full, partial or the only one
+    for (std::size_t pageSize : {5, 10, 100}) {
+        ETCDRangeIterator        it = client.getAllPaginated("/test/p/", pageSize);
+        std::vector<std::string> keys;
+        std::size_t              pages = 0;
+        while (it.next()) {
+            pages++;
+            EXPECT_LE(it.getKVEntriesVec().size(), pageSize);
+            for (const ETCDParsedResponse::KVEntry& kv : it.getKVEntriesVec()) {
+                keys.push_back(std::string(kv.key));
+            }
+        }
+        EXPECT_EQ(keys, expected) << pageSize;
+        EXPECT_EQ(pages, (expected.size() + pageSize - 1) / pageSize);
+        EXPECT_GT(it.getRevision(), 0u);
+        EXPECT_TRUE(it.getKVEntriesVec().empty());
+    }
+
+    ETCDRangeIterator none = client.getAllPaginated("/test/none/", 10);
+    EXPECT_FALSE(none.next());
+    try {
+        client.getAllPaginated("/test/p/", 0);
+        FAIL() << "a page size of 0 must throw";
+    } catch (ETCDError& e) {
+        EXPECT_EQ(e.getErrorCode(), ETCDERROR_INVALID_PAGE_SIZE);
+    }
+}
+
+TEST(etcd_beast, get_with_range_options)
+{
+    ETCDClient   client("127.0.0.1", 2379);
+    ETCDResponse rd = client.delAll("/test/").wait();
+    ETCDResponse r1 = client.set("/test/o/a", "3").wait();
+    ETCDResponse r2 = client.set("/test/o/b", "1").wait();
+    ETCDResponse r3 = client.set("/test/o/c", "2").wait();
+    ETCDResponse r4 = client.set("/test/o/a", "4").wait();
+
+    ETCDRangeOptions limited;
+    limited.limit   = 2;
+    ETCDResponse rl = client.getAll("/test/o/", limited).wait();
+    ASSERT_EQ(rl.getKVEntriesVec().size(), 2u);
+    EXPECT_EQ(rl.getKVEntriesVec().at(0).key, "/test/o/a");
+    EXPECT_TRUE(rl.isMore());
+    EXPECT_EQ(rl.getCount(), 3u);
+
+    ETCDRangeOptions counted;
+    counted.countOnly = true;
+    ETCDResponse rc   = client.getAll("/test/o/", counted).wait();
+    EXPECT_TRUE(rc.getKVEntriesVec().empty());
+    EXPECT_EQ(rc.getCount(), 3u);
+    EXPECT_FALSE(rc.isMore());
+
+    ETCDRangeOptions keysOnly;
+    keysOnly.keysOnly = true;
+    ETCDResponse rk   = client.get("/test/o/b", keysOnly).wait();
+    ASSERT_EQ(rk.getKVEntriesVec().size(), 1u);
+    EXPECT_EQ(rk.getKVEntriesVec().at(0).key, "/test/o/b");
+    EXPECT_TRUE(rk.getKVEntriesVec().at(0).value.empty());
+
+    ETCDRangeOptions sorted;
+    sorted.sortOrder  = ETCDRangeOptions::SortOrder::Descend;
+    sorted.sortTarget = ETCDRangeOptions::SortTarget::Value;
+    ETCDResponse rs   = client.getAll("/test/o/", sorted).wait();
+    ASSERT_EQ(rs.getKVEntriesVec().size(), 3u);
+    EXPECT_EQ(rs.getKVEntriesVec().at(0).value, "4");
+    EXPECT_EQ(rs.getKVEntriesVec().at(2).value, "1");
+
+    // only the keys written after the first puts
+    ETCDRangeOptions modified;
+    modified.minModRevision = r3.getRevision();
+    modified.serializable   = true;
+    ETCDResponse rm         = client.getAll("/test/o/", modified).wait();
+    ASSERT_EQ(rm.getKVEntriesVec().size(), 2u);
+    EXPECT_EQ(rm.getKVEntriesVec().at(0).key, "/test/o/a");
+    EXPECT_EQ(rm.getKVEntriesVec().at(1).key, "/test/o/c");
+
+    // the options are also taken with a completion token
+    std::future<ETCDParsedResponse> f = client.getAll("/test/o/", limited, boost::asio::use_future);
+    ETCDParsedResponse              p = f.get();
+    EXPECT_EQ(p.getKVEntriesVec().size(), 2u);
+    EXPECT_TRUE(p.isMore());
+}
+
+TEST(etcd_beast, get_all_parallel)
+{
+    ETCDClient   client("127.0.0.1", 2379);
+    ETCDResponse rd = client.delAll("/test/").wait();
+    ETCDResponse rs = client.set("/test/r", "after the prefix").wait();
+
+    // keys with a long common part, and a few far from them
+    std::vector<std::string> expected;
+    for (int i = 0; i < 200; i++) {
+        expected.push_back("/test/s/key-" + std::to_string(10000 + i * 7));
+    }
+    expected.push_back("/test/s/z");
+    expected.push_back("/test/s/\xff\xff");
+    for (const std::string& key : expected) {
+        ETCDResponse r = client.set(key, key).wait();
+    }
+    std::sort(expected.begin(), expected.end());
+
+    for (unsigned shards : {1, 2, 4, 7, 32}) {
+        ETCDResponse             r = client.getAllParallel("/test/s/", shards);
+        std::vector<std::string> keys;
+        for (const ETCDParsedResponse::KVEntry& kv : r.getKVEntriesVec()) {
+            keys.push_back(std::string(kv.key));
+            EXPECT_EQ(kv.value, kv.key);
+        }
+        EXPECT_EQ(keys, expected) << shards;
+        EXPECT_EQ(r.getCount(), expected.size());
+        EXPECT_FALSE(r.isFromCache());
+        EXPECT_GT(r.getRevision(), 0u);
+    }
+
+    // the split points are picked in one round trip. A split by count-only requests needs at least one
+    // request per split point, one after the other, before the same concurrent reads of the ranges
+    const unsigned           timedShards = 32;
+    std::vector<std::string> bounds;
+    for (unsigned i = 0; i < timedShards; i++) {
+        bounds.push_back(expected[i * expected.size() / timedShards]);
+    }
+    bounds.push_back("/test/s0");
+    auto         start    = std::chrono::steady_clock::now();
+    ETCDResponse rp       = client.getAllParallel("/test/s/", timedShards);
+    const auto   parallel = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(rp.getKVEntriesVec().size(), expected.size());
+
+    ETCDRangeOptions counted;
+    counted.countOnly = true;
+    start             = std::chrono::steady_clock::now();
+    for (unsigned i = 1; i < timedShards; i++) {
+        counted.rangeEnd = bounds[i];
+        ETCDResponse rc  = client.get(bounds.front(), counted).wait();
+    }
+    const auto serialSplit = std::chrono::steady_clock::now() - start;
+
+    std::vector<std::future<ETCDParsedResponse>> reads;
+    ETCDRangeOptions                             ranged;
+    start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < timedShards; i++) {
+        ranged.rangeEnd = bounds[i + 1];
+        reads.push_back(client.get(bounds[i], ranged, boost::asio::use_future));
+    }
+    for (std::future<ETCDParsedResponse>& read : reads) {
+        read.get();
+    }
+    const auto rangeReads = std::chrono::steady_clock::now() - start;
+    auto       us         = [](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    };
+    EXPECT_LT(parallel, serialSplit + rangeReads)
+        << us(parallel) << "us in one round trip, " << us(serialSplit) << "us + " << us(rangeReads)
+        << "us with a serial split";
+
+    // with a shard per thread, the ranges are read on all the shards
+    ETCDExecutionConfig execution;
+    execution.sharded = true;
+    ETCDClient   sharded("127.0.0.1", 2379, 4, HttpSessionPoolConfig(), execution);
+    ETCDResponse rsh = sharded.getAllParallel("/test/s/", 7);
+    ASSERT_EQ(rsh.getKVEntriesVec().size(), expected.size());
+    for (std::size_t i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(rsh.getKVEntriesVec()[i].key, expected[i]);
+    }
+
+    EXPECT_TRUE(client.getAllParallel("/test/none/", 4).getKVEntriesVec().empty());
+    try {
+        client.getAllParallel("/test/s/", 0);
+        FAIL() << "0 shards must throw";
+    } catch (ETCDError& e) {
+        EXPECT_EQ(e.getErrorCode(), ETCDERROR_INVALID_SHARD_COUNT);
+    }
+}
+
 TEST(etcd_beast, set_get_range)
 {
     ETCDClient client("127.0.0.1", 2379);
@@ -230,6 +738,443 @@ TEST(etcd_beast, set_get_range)
     EXPECT_EQ(rga2.getKVEntriesMap().size(), 0);
 }
 
+TEST(etcd_beast, txn)
+{
+    ETCDClient client("127.0.0.1", 2379);
+    srand(time(nullptr));
+    ETCDResponse rd = client.delAll("/test/").wait();
+
+    // etcd limits the number of operations in a transaction with --max-txn-ops (128 by default)
+    int             numOfEntries = 100;
+    ETCDTransaction t            = client.txn();
+    for (int i = 0; i < numOfEntries; i++) {
+        t.put("/test/" + std::to_string(i), std::to_string(i));
+    }
+    EXPECT_EQ(t.operationsCount(), numOfEntries);
+    ETCDResponse rt = t.commit().wait();
+    EXPECT_TRUE(rt.isTxnSucceeded());
+    ASSERT_EQ(rt.getTxnResponses().size(), numOfEntries);
+    for (const auto& r : rt.getTxnResponses()) {
+        EXPECT_EQ(r.type, ETCDParsedResponse::TxnResponse::Type::Put);
+    }
+    ETCDResponse rga = client.getAll("/test/").wait();
+    EXPECT_EQ(rga.getKVEntriesVec().size(), numOfEntries);
+
+    // a failing compare runs the failure branch only
+    ETCDResponse rc = client.txn()
+                          .ifVersion("/test/0", ETCDTransaction::Compare::Equal, 0)
+                          .put("/test/0", "never")
+                          .onFailure()
+                          .get("/test/0")
+                          .del("/test/1")
+                          .getAll("/test/")
+                          .commit()
+                          .wait();
+    EXPECT_FALSE(rc.isTxnSucceeded());
+    ASSERT_EQ(rc.getTxnResponses().size(), 3);
+    EXPECT_EQ(rc.getTxnResponses().at(0).type, ETCDParsedResponse::TxnResponse::Type::Range);
+    ASSERT_EQ(rc.getTxnResponses().at(0).kvEntries.size(), 1);
+    EXPECT_EQ(rc.getTxnResponses().at(0).kvEntries.at(0).value, "0");
+    EXPECT_EQ(rc.getTxnResponses().at(1).type, ETCDParsedResponse::TxnResponse::Type::DeleteRange);
+    EXPECT_EQ(rc.getTxnResponses().at(1).deletedCount, 1);
+    EXPECT_EQ(rc.getTxnResponses().at(2).kvEntries.size(), numOfEntries - 1);
+
+    // a passing compare runs the success branch
+    ETCDResponse rs = client.txn()
+                          .ifValue("/test/0", ETCDTransaction::Compare::Equal, "0")
+                          .ifVersion("/test/1", ETCDTransaction::Compare::Equal, 0)
+                          .put("/test/0", "changed")
+                          .del("/test/2")
+                          .commit()
+                          .wait();
+    EXPECT_TRUE(rs.isTxnSucceeded());
+    ASSERT_EQ(rs.getTxnResponses().size(), 2);
+    EXPECT_EQ(rs.getTxnResponses().at(1).deletedCount, 1);
+    ETCDResponse rg = client.get("/test/0").wait();
+    ASSERT_EQ(rg.getKVEntriesVec().size(), 1);
+    EXPECT_EQ(rg.getKVEntriesVec().at(0).value, "changed");
+
+    ETCDResponse rd2  = client.delAll("/test/").wait();
+    ETCDResponse rga2 = client.getAll("/test/").wait();
+    EXPECT_EQ(rga2.getKVEntriesVec().size(), 0);
+    EXPECT_THROW(client.txn().put("", "abc"), ETCDError);
+}
+
+TEST(etcd_beast, set_coalesced)
+{
+    ETCDClient client("127.0.0.1", 2379);
+    client.enableWriteCoalescing(std::chrono::milliseconds(50), 128);
+    srand(time(nullptr));
+    ETCDResponse rd = client.delAll("/test/").wait();
+
+    int                       numOfEntries = 500;
+    std::vector<ETCDResponse> responses;
+    for (int i = 0; i < numOfEntries; i++) {
+        responses.push_back(client.set("/test/" + std::to_string(i % 400), std::to_string(i)));
+    }
+    // a put with a lease that doesn't exist fails on its own
+    ETCDResponse badLease = client.set("/test/bad", "bad", static_cast<uint64_t>(rand()) + 1);
+    std::set<uint64_t> revisions;
+    for (auto& r : responses) {
+        ASSERT_NO_THROW(r.wait());
+        revisions.insert(r.getRevision());
+    }
+    EXPECT_LT(revisions.size(), responses.size());
+    EXPECT_THROW(badLease.wait().getRevision(), ETCDError);
+
+    ETCDResponse rga = client.getAll("/test/").wait();
+    ASSERT_EQ(rga.getKVEntriesVec().size(), 400);
+    // unawaited sets of the same key may be applied in any order, like without coalescing
+    for (int i = 400; i < numOfEntries; i++) {
+        boost::string_view v = rga.getKVEntriesMap().at("/test/" + std::to_string(i % 400)).value;
+        EXPECT_TRUE(v == std::to_string(i) || v == std::to_string(i % 400)) << v;
+    }
+
+    ETCDResponse rd2  = client.delAll("/test/").wait();
+    ETCDResponse rga2 = client.getAll("/test/").wait();
+    EXPECT_EQ(rga2.getKVEntriesVec().size(), 0);
+}
+
+TEST(etcd_beast, wait_with_error_code)
+{
+    ETCDClient client("127.0.0.1", 2379);
+    srand(time(nullptr));
+
+    boost::system::error_code ec;
+    ETCDResponse              rs = client.set("/test/ec", "1").wait(ec);
+    EXPECT_FALSE(ec) << ec.message();
+    EXPECT_GT(rs.getRevision(), 0u);
+
+    // an error of etcd is an error code; the getters throw it with its message
+    ETCDResponse rr = client.leaseRevoke(static_cast<uint64_t>(rand()) + 1).wait(ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_ETCD_RETURNED_ERROR));
+    try {
+        rr.getRevision();
+        FAIL() << "the error must be thrown by the getters";
+    } catch (const ETCDError& e) {
+        EXPECT_NE(e.getErrorMessage().find("lease not found"), std::string::npos) << e.what();
+    }
+
+    // a request that can't be sent is an error code too
+    ETCDClient   unreachable("127.0.0.1", 1, 1);
+    ETCDResponse ru = unreachable.get("/test/ec").wait(ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_FAILED_TO_CONNECT));
+    // the thrown error has the reason of the socket, kept with the error code until it's thrown
+    const boost::system::error_code connectionRefused = boost::asio::error::connection_refused;
+    const std::string               refused           = "Failed to connect: " + connectionRefused.message();
+    try {
+        ru.getRevision();
+        FAIL() << "the failure must be thrown by the getters";
+    } catch (const ETCDError& e) {
+        EXPECT_EQ(e.getErrorMessage(), refused);
+    }
+    try {
+        unreachable.get("/test/ec").wait();
+        FAIL() << "an unreachable server must be an error";
+    } catch (const ETCDError& e) {
+        EXPECT_EQ(e.getErrorCode(), ETCDERROR_FAILED_TO_CONNECT);
+        EXPECT_EQ(e.getErrorMessage(), refused);
+    }
+    std::future<ETCDParsedResponse> fu = unreachable.get("/test/ec", boost::asio::use_future);
+    EXPECT_THROW(fu.get(), boost::system::system_error);
+
+    client.del("/test/ec").wait();
+}
+
+TEST(etcd_beast, set_get_completion_tokens)
+{
+    ETCDClient client("127.0.0.1", 2379);
+    srand(time(nullptr));
+    ETCDResponse rd = client.delAll("/test/").wait();
+
+    int                numOfEntries = 200;
+    std::atomic<int>   setsDone{0};
+    std::promise<void> allSet;
+    for (int i = 0; i < numOfEntries; i++) {
+        client.set("/test/" + std::to_string(i), std::to_string(i),
+                   [&](boost::system::error_code ec, ETCDParsedResponse r) {
+                       EXPECT_FALSE(ec) << ec.message();
+                       EXPECT_GT(r.getRevision(), 0u);
+                       if (++setsDone == numOfEntries) {
+                           allSet.set_value();
+                       }
+                   });
+    }
+    allSet.get_future().wait();
+
+    std::vector<std::future<ETCDParsedResponse>> gets;
+    for (int i = 0; i < numOfEntries; i++) {
+        gets.push_back(client.get("/test/" + std::to_string(i), boost::asio::use_future));
+    }
+    for (int i = 0; i < numOfEntries; i++) {
+        ETCDParsedResponse r = gets[i].get();
+        ASSERT_EQ(r.getKVEntriesVec().size(), 1);
+        EXPECT_EQ(r.getKVEntriesVec().at(0).value, std::to_string(i));
+    }
+
+    // failures arrive as error codes of the etcd category
+    std::future<ETCDParsedResponse> badLease =
+        client.set("/test/bad", "bad", static_cast<uint64_t>(rand()) + 1, boost::asio::use_future);
+    try {
+        badLease.get();
+        FAIL() << "a put with a nonexistent lease must fail";
+    } catch (boost::system::system_error& e) {
+        EXPECT_EQ(e.code().category(), ETCDErrorCategory());
+    }
+
+    ETCDParsedResponse rga = client.getAll("/test/", boost::asio::use_future).get();
+    EXPECT_EQ(rga.getKVEntriesVec().size(), numOfEntries);
+    ETCDParsedResponse rda = client.delAll("/test/", boost::asio::use_future).get();
+    EXPECT_EQ(client.getAll("/test/").wait().getKVEntriesVec().size(), 0);
+}
+
+TEST(etcd_beast, sharded_execution)
+{
+    ETCDExecutionConfig execution;
+    execution.sharded = true;
+    ETCDClient client("127.0.0.1", 2379, 4, HttpSessionPoolConfig(), execution);
+    ETCDResponse rd = client.delAll("/test/").wait();
+
+    std::promise<ETCDParsedResponse> watched;
+    bool                             isWatched = false;
+    ETCDWatch w = client.watch("/test/watched", [&](ETCDParsedResponse r) {
+        if (!isWatched && !r.getEvents().empty()) {
+            isWatched = true;
+            watched.set_value(r);
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // each thread sends its requests on its own shard
+    const int                numOfThreads = 8;
+    const int                numOfEntries = 50;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numOfThreads; t++) {
+        threads.push_back(std::thread([&client, t]() {
+            for (int i = 0; i < numOfEntries; i++) {
+                const std::string key = "/test/" + std::to_string(t) + "/" + std::to_string(i);
+                client.set(key, std::to_string(i)).wait();
+                ETCDResponse rg = client.get(key).wait();
+                ASSERT_EQ(rg.getKVEntriesVec().size(), 1);
+                EXPECT_EQ(rg.getKVEntriesVec().at(0).value, std::to_string(i));
+            }
+        }));
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(client.getAll("/test/").wait().getKVEntriesVec().size(), numOfThreads * numOfEntries);
+
+    ETCDParsedResponse ra = client.get("/test/0/0", boost::asio::use_future).get();
+    ASSERT_EQ(ra.getKVEntriesVec().size(), 1);
+
+    // a callback runs on the thread of its shard, and can still wait for a request
+    std::promise<std::string> nested;
+    bool                      isNested = false;
+    ETCDWatch                 wn       = client.watch("/test/nested", [&](ETCDParsedResponse r) {
+        if (!isNested && !r.getEvents().empty()) {
+            isNested        = true;
+            ETCDResponse rn = client.get("/test/0/1").wait();
+            nested.set_value(std::string(rn.getKVEntriesVec().at(0).value));
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    client.set("/test/nested", "1").wait();
+    std::future<std::string> nestedFuture = nested.get_future();
+    ASSERT_EQ(nestedFuture.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_EQ(nestedFuture.get(), "1");
+    wn.cancel();
+
+    // callbacks on all the shards wait for requests at the same time
+    const int                numOfCallbacks = 16;
+    std::atomic<int>         arrived{0};
+    std::atomic<int>         completed{0};
+    std::promise<void>       allCompleted;
+    std::vector<std::thread> senders;
+    for (int t = 0; t < numOfCallbacks; t++) {
+        senders.push_back(std::thread([&]() {
+            client.get("/test/0/2", [&](boost::system::error_code, ETCDParsedResponse) {
+                arrived++;
+                for (int attempt = 0; attempt < 50 && arrived < 4; attempt++) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+                ETCDResponse rb = client.get("/test/0/3").wait();
+                EXPECT_EQ(rb.getKVEntriesVec().at(0).value, "3");
+                if (++completed == numOfCallbacks) {
+                    allCompleted.set_value();
+                }
+            });
+        }));
+    }
+    for (std::thread& t : senders) {
+        t.join();
+    }
+    ASSERT_EQ(allCompleted.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+
+    client.set("/test/watched", "1").wait();
+    std::future<ETCDParsedResponse> watchedFuture = watched.get_future();
+    ASSERT_EQ(watchedFuture.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_EQ(watchedFuture.get().getEvents().at(0).kv.value, "1");
+    w.cancel();
+
+    client.delAll("/test/").wait();
+}
+
+TEST(etcd_beast, watch_callback_executor)
+{
+    // one io thread: a callback run on it would hold up the requests below
+    ETCDClient client("127.0.0.1", 2379, 1);
+    client.enableWatchCallbackThreads();
+    ETCDResponse rd = client.delAll("/test/").wait();
+
+    std::mutex                         valuesMtx;
+    std::map<std::string, std::string> coalesced;
+    std::size_t                        coalescedEvents = 0;
+    std::promise<void>                 release;
+    std::shared_future<void>           released = release.get_future().share();
+    ETCDWatchOptions                   coalesceOptions;
+    coalesceOptions.prefix    = true;
+    coalesceOptions.queueSize = 1;
+    coalesceOptions.overflow  = ETCDWatchOptions::Overflow::Coalesce;
+    ETCDWatch wc = client.watch("/test/c/", coalesceOptions, [&](ETCDParsedResponse r) {
+        released.wait();
+        std::lock_guard<std::mutex> lg(valuesMtx);
+        for (const ETCDParsedResponse::Event& event : r.getEvents()) {
+            coalesced[std::string(event.kv.key)] = std::string(event.kv.value);
+            coalescedEvents++;
+        }
+    });
+    std::vector<std::string> blocked; // every value, in order: the stream waits for the callback
+    ETCDWatchOptions         blockOptions;
+    blockOptions.queueSize = 1;
+    ETCDWatch wb = client.watch("/test/b", blockOptions, [&](ETCDParsedResponse r) {
+        released.wait();
+        std::lock_guard<std::mutex> lg(valuesMtx);
+        for (const ETCDParsedResponse::Event& event : r.getEvents()) {
+            blocked.push_back(std::string(event.kv.value));
+        }
+    });
+    std::atomic<int> slowCalls{0};
+    ETCDWatchOptions dropOptions;
+    dropOptions.queueSize = 1;
+    dropOptions.overflow  = ETCDWatchOptions::Overflow::Drop;
+    ETCDWatch wd = client.watch("/test/d", dropOptions, [&](ETCDParsedResponse r) {
+        if (!r.getEvents().empty()) {
+            slowCalls++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+    });
+    wc.wait();
+    wb.wait();
+    wd.wait();
+
+    const int numOfPuts = 10;
+    for (int i = 0; i < numOfPuts; i++) {
+        client.set("/test/c/" + std::to_string(i % 2), std::to_string(i)).wait();
+        client.set("/test/b", std::to_string(i)).wait();
+        client.set("/test/d", std::to_string(i)).wait();
+    }
+    // the callbacks are blocked and the stream of wb is paused, but the io thread goes on
+    const auto   start = std::chrono::steady_clock::now();
+    ETCDResponse rg    = client.get("/test/d").wait();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(150));
+    ASSERT_EQ(rg.getKVEntriesVec().size(), 1);
+    EXPECT_EQ(rg.getKVEntriesVec().at(0).value, std::to_string(numOfPuts - 1));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    release.set_value();
+    for (int attempt = 0; attempt < 500; attempt++) {
+        {
+            std::lock_guard<std::mutex> lg(valuesMtx);
+            if (coalesced["/test/c/0"] == "8" && coalesced["/test/c/1"] == "9" &&
+                blocked.size() == static_cast<std::size_t>(numOfPuts)) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    {
+        std::lock_guard<std::mutex> lg(valuesMtx);
+        EXPECT_EQ(coalesced["/test/c/0"], "8");
+        EXPECT_EQ(coalesced["/test/c/1"], "9");
+        EXPECT_LT(coalescedEvents, static_cast<std::size_t>(numOfPuts));
+        ASSERT_EQ(blocked.size(), static_cast<std::size_t>(numOfPuts));
+        for (int i = 0; i < numOfPuts; i++) {
+            EXPECT_EQ(blocked[i], std::to_string(i));
+        }
+    }
+
+    EXPECT_GT(wd.droppedCount(), 0u);
+    EXPECT_LT(slowCalls.load(), numOfPuts);
+    EXPECT_EQ(wc.droppedCount(), 0u);
+    EXPECT_EQ(wb.droppedCount(), 0u);
+    wc.cancel();
+    wb.cancel();
+    wd.cancel();
+
+    client.delAll("/test/").wait();
+}
+
+#if defined(ETCD_BEAST_TESTS_REQUIRE_COROUTINES) && !defined(ETCD_HAS_COROUTINES)
+#error "The tests are built as C++20, but the compiler doesn't support coroutines"
+#endif
+
+#ifdef ETCD_HAS_COROUTINES
+struct DetachedCoroutine__test
+{
+    struct promise_type
+    {
+        DetachedCoroutine__test get_return_object() { return {}; }
+        std::suspend_never      initial_suspend() noexcept { return {}; }
+        std::suspend_never      final_suspend() noexcept { return {}; }
+        void                    return_void() {}
+        void                    unhandled_exception() { std::terminate(); }
+    };
+};
+
+DetachedCoroutine__test SetGetCoroutine__test(ETCDClient& client, int i, std::thread::id callerThread,
+                                              std::atomic<int>& done, std::promise<void>& allDone,
+                                              int total)
+{
+    const std::string  key = "/test/" + std::to_string(i);
+    ETCDParsedResponse rs  = co_await client.set(key, std::to_string(i), ETCDUseAwaitable);
+    EXPECT_GT(rs.getRevision(), 0u);
+    // resumed on an io thread of the client
+    EXPECT_NE(std::this_thread::get_id(), callerThread);
+    ETCDParsedResponse rg = co_await client.get(key, ETCDUseAwaitable);
+    EXPECT_EQ(rg.getKVEntriesVec().size(), 1u);
+    EXPECT_EQ(rg.getKVEntriesVec().at(0).value, std::to_string(i));
+    try {
+        co_await client.set(key, "bad", static_cast<uint64_t>(rand()) + 1, ETCDUseAwaitable);
+        ADD_FAILURE() << "a put with a nonexistent lease must fail";
+    } catch (ETCDError& e) {
+        EXPECT_EQ(std::string(e.what()).rfind("Error: ", 0), 0u) << e.what();
+    }
+    if (++done == total) {
+        allDone.set_value();
+    }
+}
+
+TEST(etcd_beast, set_get_coroutines)
+{
+    ETCDClient client("127.0.0.1", 2379);
+    srand(time(nullptr));
+    ETCDResponse rd = client.delAll("/test/").wait();
+
+    int                numOfCoroutines = 1000;
+    std::atomic<int>   done{0};
+    std::promise<void> allDone;
+    for (int i = 0; i < numOfCoroutines; i++) {
+        SetGetCoroutine__test(client, i, std::this_thread::get_id(), done, allDone, numOfCoroutines);
+    }
+    allDone.get_future().wait();
+
+    ETCDResponse rga = client.getAll("/test/").wait();
+    EXPECT_EQ(rga.getKVEntriesVec().size(), numOfCoroutines);
+    ETCDResponse rda = client.delAll("/test/").wait();
+}
+#endif
+
 TEST(etcd_beast, lease)
 {
     ETCDClient client("127.0.0.1", 2379);
@@ -250,16 +1195,16 @@ TEST(etcd_beast, lease)
         EXPECT_EQ(rttl.getGrantedTTL(), ttl);
 
         ETCDResponse rr = client.leaseRevoke(leaseId).wait();
-        EXPECT_NO_THROW(rr.getKVEntriesVec().size());
-        EXPECT_NO_THROW(rr.getKVEntriesMap().size());
+        EXPECT_NO_THROW(static_cast<void>(rr.getKVEntriesVec()));
+        EXPECT_NO_THROW(static_cast<void>(rr.getKVEntriesMap()));
     }
 
     for (int i = 0; i < leaseCount; i++) {
         ETCDResponse rl = client.leaseGrant(10).wait();
         EXPECT_NO_THROW(rl.getLeaseId());
         ETCDResponse rr = client.leaseRevoke(rl.getLeaseId()).wait();
-        EXPECT_NO_THROW(rr.getKVEntriesVec().size());
-        EXPECT_NO_THROW(rr.getKVEntriesMap().size());
+        EXPECT_NO_THROW(static_cast<void>(rr.getKVEntriesVec()));
+        EXPECT_NO_THROW(static_cast<void>(rr.getKVEntriesMap()));
     }
 }
 
@@ -294,8 +1239,8 @@ TEST(etcd_beast, lease_with_set_get)
     EXPECT_EQ(rg.getKVEntriesMap().begin()->second.value, v);
 
     ETCDResponse rr = client.leaseRevoke(leaseId).wait();
-    EXPECT_NO_THROW(rr.getKVEntriesVec().size());
-    EXPECT_NO_THROW(rr.getKVEntriesMap().size());
+    EXPECT_NO_THROW(static_cast<void>(rr.getKVEntriesVec()));
+    EXPECT_NO_THROW(static_cast<void>(rr.getKVEntriesMap()));
 
     ETCDResponse rg2 = client.get(k).wait();
     ASSERT_EQ(rg2.getKVEntriesVec().size(), 0);
@@ -336,8 +1281,8 @@ TEST(etcd_beast, lease_with_set_get_many)
         EXPECT_EQ(rg.getKVEntriesMap().begin()->second.value, v);
 
         ETCDResponse rr = client.leaseRevoke(leaseId).wait();
-        EXPECT_NO_THROW(rr.getKVEntriesVec().size());
-        EXPECT_NO_THROW(rr.getKVEntriesMap().size());
+        EXPECT_NO_THROW(static_cast<void>(rr.getKVEntriesVec()));
+        EXPECT_NO_THROW(static_cast<void>(rr.getKVEntriesMap()));
 
         ETCDResponse rg2 = client.get(k).wait();
         ASSERT_EQ(rg2.getKVEntriesVec().size(), 0);
@@ -345,6 +1290,176 @@ TEST(etcd_beast, lease_with_set_get_many)
     }
 }
 
+TEST(etcd_beast, lease_keep_alive)
+{
+    ETCDClient client("127.0.0.1", 2379);
+
+    // kept past its TTL, with its key
+    ETCDResponse          rl = client.leaseGrant(2).wait();
+    const uint64_t        id = rl.getLeaseId();
+    std::atomic<uint64_t> expiredId{0};
+    ETCDResponse          rs = client.set("/test/kept", "alive", id).wait();
+    client.leaseKeepAlive(id, 2, [&expiredId](uint64_t leaseId) { expiredId = leaseId; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(3500));
+    ETCDResponse rttl = client.leaseTimeToLive(id).wait();
+    EXPECT_GT(rttl.getTTL(), 0u);
+    EXPECT_EQ(client.get("/test/kept").wait().getKVEntriesVec().size(), 1u);
+    EXPECT_EQ(expiredId.load(), 0u);
+
+    // revoked behind the back of the client: the next renewal finds it gone
+    const std::string revoke = R"({"ID": ")" + std::to_string(id) + R"("})";
+    ETCDResponse      rr     = client.customCommand("/v3alpha/kv/lease/revoke", revoke).wait();
+    for (int i = 0; i < 30 && expiredId.load() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    EXPECT_EQ(expiredId.load(), id);
+
+    // revoked by the client: it isn't kept anymore, so it doesn't expire
+    std::atomic_bool expired{false};
+    ETCDResponse     rl2 = client.leaseGrant(2).wait();
+    client.leaseKeepAlive(rl2.getLeaseId(), 2, [&expired](uint64_t) { expired = true; });
+    ETCDResponse rr2 = client.leaseRevoke(rl2.getLeaseId()).wait();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    EXPECT_FALSE(expired.load());
+
+    EXPECT_THROW(client.leaseKeepAlive(rl2.getLeaseId(), 1), ETCDError);
+}
+
+TEST(etcd_beast, lease_pool)
+{
+    ETCDClient client("127.0.0.1", 2379);
+    client.enableLeasePool(5, 4);
+    // the leases are granted in the background
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    // checked out leases are distinct, alive and refilled
+    std::set<uint64_t> ids;
+    for (int i = 0; i < 8; i++) {
+        uint64_t id = client.leaseCheckOut(5);
+        EXPECT_TRUE(ids.insert(id).second);
+        ETCDResponse rs = client.set("/test/pooled/" + std::to_string(i), "v", id).wait();
+        EXPECT_GT(client.leaseTimeToLive(id).wait().getTTL(), 0u);
+    }
+    for (uint64_t id : ids) {
+        ETCDResponse rr = client.leaseRevoke(id).wait();
+    }
+    EXPECT_TRUE(client.getAll("/test/pooled/").wait().getKVEntriesVec().empty());
+
+    // the shared lease is the same until it expires, then it's replaced
+    const uint64_t shared = client.leaseShared(5);
+    EXPECT_NE(shared, 0u);
+    EXPECT_EQ(client.leaseShared(5), shared);
+    EXPECT_EQ(ids.count(shared), 0u);
+    const std::string revoke = R"({"ID": ")" + std::to_string(shared) + R"("})";
+    ETCDResponse      rr     = client.customCommand("/v3alpha/kv/lease/revoke", revoke).wait();
+    uint64_t          next   = shared;
+    for (int i = 0; i < 30 && next == shared; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        next = client.leaseShared(5);
+    }
+    EXPECT_NE(next, shared);
+    EXPECT_GT(client.leaseTimeToLive(next).wait().getTTL(), 0u);
+
+    // a TTL without a bucket is granted in the request
+    uint64_t cold = client.leaseCheckOut(7);
+    EXPECT_EQ(client.leaseTimeToLive(cold).wait().getGrantedTTL(), 7u);
+    ETCDResponse rc = client.leaseRevoke(cold).wait();
+}
+
+// forwards the connections to a port of its own to etcd, once started; until then, they're refused
+class EtcdProxy__test
+{
+    using tcp = boost::asio::ip::tcp;
+
+    boost::asio::io_context ioc;
+    tcp::acceptor           acceptor;
+    uint16_t                port_ = 0;
+    std::thread             thread;
+
+    static void Pump(std::shared_ptr<tcp::socket> from, std::shared_ptr<tcp::socket> to,
+                     std::shared_ptr<std::array<char, 4096>> data)
+    {
+        from->async_read_some(boost::asio::buffer(*data), [from, to, data](boost::system::error_code ec,
+                                                                          std::size_t size) {
+            if (ec) {
+                to->shutdown(tcp::socket::shutdown_send, ec);
+                return;
+            }
+            boost::asio::async_write(*to, boost::asio::buffer(data->data(), size),
+                                     [from, to, data](boost::system::error_code ec, std::size_t) {
+                                         if (!ec) {
+                                             Pump(from, to, data);
+                                         }
+                                     });
+        });
+    }
+
+    void accept()
+    {
+        acceptor.async_accept([this](boost::system::error_code ec, tcp::socket socket) {
+            if (ec) {
+                return;
+            }
+            auto client = std::make_shared<tcp::socket>(std::move(socket));
+            auto server = std::make_shared<tcp::socket>(ioc);
+            server->connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), 2379), ec);
+            if (!ec) {
+                Pump(client, server, std::make_shared<std::array<char, 4096>>());
+                Pump(server, client, std::make_shared<std::array<char, 4096>>());
+            }
+            accept();
+        });
+    }
+
+public:
+    EtcdProxy__test() : acceptor(ioc)
+    {
+        tcp::acceptor probe(ioc, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        port_ = probe.local_endpoint().port();
+    }
+
+    ~EtcdProxy__test()
+    {
+        ioc.stop();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    uint16_t port() const { return port_; }
+
+    void start()
+    {
+        acceptor.open(tcp::v4());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+        acceptor.bind(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port_));
+        acceptor.listen();
+        accept();
+        thread = std::thread([this]() { ioc.run(); });
+    }
+};
+
+TEST(etcd_beast, lease_pool_refills_after_failed_grants)
+{
+    EtcdProxy__test proxy;
+    ETCDClient      client("127.0.0.1", proxy.port());
+    // the grants of the bucket fail while etcd is out of reach
+    client.enableLeasePool(5, 3);
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_EQ(client.leasePoolReadyCount(5), 0u);
+    EXPECT_THROW(client.leaseCheckOut(5), ETCDError);
+
+    // once it's back, a lease granted in the request refills the bucket
+    proxy.start();
+    const uint64_t id = client.leaseCheckOut(5);
+    EXPECT_NE(id, 0u);
+    for (int attempt = 0; attempt < 300 && client.leasePoolReadyCount(5) < 3; attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(client.leasePoolReadyCount(5), 3u);
+    ETCDResponse rr = client.leaseRevoke(id).wait();
+}
+
 TEST(etcd_beast, lease_with_set_get_die_out)
 {
     ETCDClient client("127.0.0.1", 2379);
@@ -469,4 +1584,1008 @@ TEST(etcd_client_helper__json_string_queue, basic)
     EXPECT_THROW(q.pushData(R"(})"), ETCDError);
     EXPECT_THROW(q.pushData(R"({}})"), ETCDError);
     EXPECT_THROW(q.pushData(R"({"Hello": "World!"}})"), ETCDError);
+
+    // the same errors as error codes; the queue is cleared and can be used again
+    boost::system::error_code ec;
+    q.pushData("upstream connect error", ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_FAILED_TO_PARSE_JSON_FROM_QUEUE));
+    q.pushData(R"({"a":1}})", ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_INVALID_JSON_STR_CLOSURE));
+    q.pushData(R"({"a":1})", ec);
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(q.pullObjects().size(), 1);
+}
+
+TEST(etcd_client_helper__json_string_queue, strings_and_sizes)
+{
+    JsonStringParserQueue q;
+
+    // braces and escaped quotes in strings, split anywhere
+    const std::string tricky = R"({"a":"}{\"}","b":{"c":"\\"},"d":"\\\"{"})";
+    for (std::size_t split = 0; split <= tricky.size(); split++) {
+        q.pushData(tricky.substr(0, split));
+        q.pushData(tricky.substr(split) + "\n");
+        std::vector<boost::string_view> objects = q.pullObjects();
+        ASSERT_EQ(objects.size(), 1) << split;
+        EXPECT_EQ(objects.at(0), tricky);
+    }
+    q.pushData(tricky);
+    std::vector<Json::Value> values = q.pullDataAndClear();
+    ASSERT_EQ(values.size(), 1);
+    EXPECT_EQ(values.at(0)["a"].asString(), "}{\"}");
+    EXPECT_EQ(values.at(0)["b"]["c"].asString(), "\\");
+    EXPECT_EQ(values.at(0)["d"].asString(), "\\\"{");
+
+    // objects much larger than the chunks, byte by byte and in one piece
+    const std::string large = R"({"value":")" + std::string(1 << 20, 'x') + R"("})";
+    for (std::size_t i = 0; i < large.size(); i += 1000) {
+        q.pushData(boost::string_view(large).substr(i, 1000));
+    }
+    EXPECT_EQ(q.pullObjects().size(), 1);
+    q.pushData(large + large);
+    EXPECT_EQ(q.pullDataAndClear().size(), 2);
+
+    // the memory budget limits what wasn't pulled
+    JsonStringParserQueue small(100);
+    small.pushData(R"({"a":")" + std::string(50, 'x'));
+    EXPECT_THROW(small.pushData(std::string(50, 'x') + R"("})"), ETCDError);
+    small.pushData(R"({"a":1})");
+    EXPECT_EQ(small.pullObjects().size(), 1);
+    EXPECT_THROW(small.pushData("x"), ETCDError);
+}
+
+TEST(etcd_client_helper__response, moves_body)
+{
+    // a large response body reaches ETCDResponse without being copied on the way
+    using Response = boost::beast::http::response<boost::beast::http::string_body>;
+    std::promise<HttpSession::Result> promise;
+    ETCDResponse                      pending(promise.get_future());
+
+    Response res;
+    res.body() = R"({"header":{"cluster_id":"1","member_id":"2","revision":"3","raft_term":"4"},"count":"0",)"
+                 R"("padding":")" +
+                 std::string(4 << 20, 'x') + R"("})";
+    const char* body = res.body().data();
+    promise.set_value(HttpSession::Result{boost::system::error_code(), boost::system::error_code(),
+                                          std::move(res)});
+
+    ETCDResponse r = std::move(pending).wait();
+    EXPECT_EQ(r.getJsonResponse().data(), body);
+    EXPECT_EQ(r.getRevision(), 3u);
+    EXPECT_EQ(r.kvCount(), 0u);
+}
+
+TEST(etcd_client_helper__response, failure_is_thrown_by_wait_only)
+{
+    // the failure of the request reaches the response as a value: the error code, and its cause
+    const boost::system::error_code   refused = boost::asio::error::connection_refused;
+    std::promise<HttpSession::Result> promise;
+    ETCDResponse                      failed(promise.get_future());
+    HttpSession::Result               result;
+    result.ec    = MakeETCDErrorCode(ETCDERROR_FAILED_TO_CONNECT);
+    result.cause = refused;
+    promise.set_value(std::move(result));
+
+    boost::system::error_code ec;
+    EXPECT_NO_THROW(failed.wait(ec));
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_FAILED_TO_CONNECT));
+    try {
+        failed.wait();
+        FAIL() << "the failure must be thrown by wait()";
+    } catch (const ETCDError& e) {
+        EXPECT_EQ(e.getErrorCode(), ETCDERROR_FAILED_TO_CONNECT);
+        EXPECT_EQ(e.getErrorMessage(), "Failed to connect: " + refused.message());
+    }
+}
+
+TEST(etcd_client_helper__parsed_response, decode)
+{
+    // a range response, with escapes, numbers that aren't strings, unknown members and an empty value
+    ETCDParsedResponse r(R"({"header":{"cluster_id":"14841639068965178418","member_id":"10276657743932975437",
+        "revision":"42","raft_term":"3","extra":{"a":[1,2,{"b":null}]}},
+        "kvs":[{"key":"L3Rlc3QvYQ==","create_revision":"5","mod_revision":"41","version":"2","value":"aGVsbG8="},
+               {"key":"L3Rlc3RcL2I=","create_revision":6,"mod_revision":"6","version":"1","lease":"0"}],
+        "count":"2","more":false})");
+    EXPECT_EQ(r.getClusterId(), 14841639068965178418u);
+    EXPECT_EQ(r.getMemberId(), 10276657743932975437u);
+    EXPECT_EQ(r.getRevision(), 42u);
+    EXPECT_EQ(r.getRaftTerm(), 3u);
+    ASSERT_EQ(r.getKVEntriesVec().size(), 2);
+    EXPECT_EQ(r.getKVEntriesVec().at(0).key, "/test/a");
+    EXPECT_EQ(r.getKVEntriesVec().at(0).value, "hello");
+    EXPECT_EQ(r.getKVEntriesVec().at(0).create_revision, 5u);
+    EXPECT_EQ(r.getKVEntriesVec().at(0).mod_revision, 41u);
+    EXPECT_EQ(r.getKVEntriesVec().at(0).version, 2u);
+    EXPECT_EQ(r.getKVEntriesVec().at(1).key, "/test\\/b");
+    EXPECT_EQ(r.getKVEntriesVec().at(1).value, "");
+    EXPECT_EQ(r.getKVEntriesVec().at(1).create_revision, 6u);
+    EXPECT_EQ(r.getKVEntriesMap().at("/test/a").value, "hello");
+    EXPECT_EQ(r.getCount(), 2u);
+    EXPECT_FALSE(r.isMore());
+
+    // escaped base64 characters
+    ETCDParsedResponse re(R"({"header":{"cluster_id":"1","member_id":"2","revision":"3","raft_term":"4"},
+        "kvs":[{"key":"\/\/8=","create_revision":"1","mod_revision":"1","version":"1"}]})");
+    ASSERT_EQ(re.getKVEntriesVec().size(), 1);
+    EXPECT_EQ(re.getKVEntriesVec().at(0).key, "\xff\xff");
+
+    // lease and watch responses
+    ETCDParsedResponse rl(
+        R"({"header":{"cluster_id":"1","member_id":"2","revision":"3","raft_term":"4"},"ID":"77","TTL":"-1",
+        "grantedTTL":"10"})");
+    EXPECT_EQ(rl.getLeaseId(), 77u);
+    EXPECT_EQ(rl.getTTL(), static_cast<uint64_t>(-1));
+    EXPECT_EQ(rl.getGrantedTTL(), 10u);
+    // the keep-alive answer for an expired lease leaves its TTL of 0 out
+    ETCDParsedResponse rk(
+        R"({"result":{"header":{"cluster_id":"1","member_id":"2","revision":"3","raft_term":"4"},"ID":"78"}})");
+    EXPECT_EQ(rk.getLeaseId(), 78u);
+    EXPECT_EQ(rk.getTTL(), 0u);
+    ETCDParsedResponse rw(R"({"header":{"cluster_id":"1","member_id":"2","revision":"3","raft_term":"4"},
+        "events":[{"kv":{"key":"YQ==","create_revision":"2","mod_revision":"2","version":"1","value":"Yg=="}},
+                  {"type":"DELETE","kv":{"key":"Yw==","mod_revision":"3"},
+                   "prev_kv":{"key":"Yw==","create_revision":"1","mod_revision":"1","version":"1","value":"ZA=="}}]})");
+    ASSERT_EQ(rw.getKVEntriesVec().size(), 2);
+    EXPECT_EQ(rw.getKVEntriesVec().at(0).value, "b");
+    EXPECT_EQ(rw.getKVEntriesVec().at(1).key, "c");
+    ASSERT_EQ(rw.getEvents().size(), 2);
+    EXPECT_EQ(rw.getEvents().at(0).type, ETCDParsedResponse::Event::Type::Put);
+    EXPECT_FALSE(rw.getEvents().at(0).hasPrevKv);
+    EXPECT_EQ(rw.getEvents().at(1).type, ETCDParsedResponse::Event::Type::Delete);
+    EXPECT_EQ(rw.getEvents().at(1).kv.mod_revision, 3u);
+    ASSERT_TRUE(rw.getEvents().at(1).hasPrevKv);
+    EXPECT_EQ(rw.getEvents().at(1).prevKv.value, "d");
+    EXPECT_TRUE(rl.getEvents().empty());
+
+    // a message of a watch stream, as it is in the stream
+    ETCDParsedResponse rs(R"({"result":{"header":{"cluster_id":"1","member_id":"2","revision":"9","raft_term":"4"},
+        "events":[{"kv":{"key":"YQ==","create_revision":"2","mod_revision":"9","version":"3","value":"Yg=="}}]}})");
+    EXPECT_EQ(rs.getRevision(), 9u);
+    ASSERT_EQ(rs.getKVEntriesVec().size(), 1);
+    EXPECT_EQ(rs.getKVEntriesVec().at(0).key, "a");
+    EXPECT_EQ(rs.getKVEntriesVec().at(0).mod_revision, 9u);
+
+    // transaction response
+    ETCDParsedResponse rt(R"({"header":{"cluster_id":"1","member_id":"2","revision":"3","raft_term":"4"},
+        "succeeded":true,"responses":[{"response_put":{"header":{"revision":"3"}}},
+        {"response_range":{"header":{},"kvs":[{"key":"YQ==","create_revision":"2","mod_revision":"2",
+        "version":"1","value":"Yg=="}],"count":"1"}},{"response_delete_range":{"header":{},"deleted":"4"}}]})");
+    EXPECT_TRUE(rt.isTxnSucceeded());
+    ASSERT_EQ(rt.getTxnResponses().size(), 3);
+    EXPECT_EQ(rt.getTxnResponses().at(0).type, ETCDParsedResponse::TxnResponse::Type::Put);
+    ASSERT_EQ(rt.getTxnResponses().at(1).kvEntries.size(), 1);
+    EXPECT_EQ(rt.getTxnResponses().at(1).kvEntries.at(0).value, "b");
+    EXPECT_EQ(rt.getTxnResponses().at(2).deletedCount, 4u);
+
+    // keys and values stay valid as long as a copy of the response lives
+    ETCDParsedResponse::KVEntry txnEntry;
+    {
+        ETCDParsedResponse copy = rt;
+        rt                      = ETCDParsedResponse();
+        txnEntry                = copy.getTxnResponses().at(1).kvEntries.at(0);
+        ETCDParsedResponse last = copy;
+        copy                    = ETCDParsedResponse();
+        EXPECT_EQ(last.getTxnResponses().at(1).kvEntries.at(0).key, "a");
+        EXPECT_EQ(txnEntry.value, "b");
+    }
+    EXPECT_TRUE(rt.getKVEntriesVec().empty());
+    EXPECT_TRUE(rt.getKVEntriesMap().empty());
+
+    // errors
+    try {
+        ETCDParsedResponse("{\"error\":\"etcdserver: requested lease not found\",\"code\":5}");
+        FAIL() << "an etcd error must throw";
+    } catch (ETCDError& e) {
+        EXPECT_EQ(e.getErrorCode(), ETCDERROR_ETCD_RETURNED_ERROR);
+        EXPECT_EQ(e.getEtcdErrorCode(), 5);
+    }
+    auto errorCodeOf = [](const std::string& json) -> long {
+        try {
+            ETCDParsedResponse p(json);
+        } catch (ETCDError& e) {
+            return e.getErrorCode();
+        }
+        return -1;
+    };
+    EXPECT_EQ(errorCodeOf(R"({"kvs":[]})"), ETCDERROR_INVALID_MSG_HEADER);
+    EXPECT_EQ(errorCodeOf(R"({"header":{"cluster_id":"1","member_id":"2","revision":"3"}})"),
+              ETCDERROR_INVALID_MSG_HEADER);
+    EXPECT_EQ(errorCodeOf(R"({"header":{"cluster_id":"1","member_id":"2","revision":"3","raft_term":"4"},
+        "kvs":[{"key":"YQ==","create_revision":"2","version":"1"}]})"),
+              ETCDERROR_INVALID_MSG_HEADER);
+    EXPECT_EQ(errorCodeOf(R"({"header":{"cluster_id":"1")"), ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE);
+    EXPECT_EQ(errorCodeOf(R"({"header":{"cluster_id":"x1"}})"), ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE);
+    EXPECT_EQ(errorCodeOf(R"({"header":{}}})"), ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE);
+    EXPECT_EQ(errorCodeOf(R"(["header"])"), ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE);
+    EXPECT_EQ(errorCodeOf(R"({"header":"\q"})"), ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE);
+}
+
+TEST(etcd_client_helper__parsed_response, decode_with_error_code)
+{
+    boost::system::error_code ec;
+    ETCDParsedResponse r(R"({"header":{"cluster_id":"1","member_id":"2","revision":"3","raft_term":"4"},
+        "kvs":[{"key":"YQ==","create_revision":"1","mod_revision":"1","version":"1","value":"Yg=="}]})",
+                         ec);
+    EXPECT_FALSE(ec);
+    ASSERT_EQ(r.getKVEntriesVec().size(), 1);
+    EXPECT_EQ(r.getKVEntriesVec().at(0).value, "b");
+
+    // the errors of etcd, incomplete headers and what isn't json are error codes, with an empty response
+    const std::string etcdError = R"({"error":"etcdserver: requested lease not found","code":5})";
+    ETCDParsedResponse failed(etcdError, ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_ETCD_RETURNED_ERROR));
+    EXPECT_EQ(failed.getRevision(), 0u);
+    ETCDParsedResponse(R"({"header":{"cluster_id":"1"}})", ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_INVALID_MSG_HEADER));
+    ETCDParsedResponse("<html>502 Bad Gateway</html>", ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE));
+    ETCDParsedResponse(R"({"header":)", ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE));
+    ETCDParsedResponse(R"({"header":{"revision":)", ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE));
+    // one more than the largest uint64
+    ETCDParsedResponse(R"({"header":{"revision":"18446744073709551616"}})", ec);
+    EXPECT_EQ(ec, MakeETCDErrorCode(ETCDERROR_FAILED_TO_PARSE_JSON_MESSAGE));
+    const std::string largestRevision =
+        R"({"header":{"cluster_id":"1","member_id":"2","revision":"18446744073709551615","raft_term":"4"}})";
+    ETCDParsedResponse largest(largestRevision, ec);
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(largest.getRevision(), std::numeric_limits<uint64_t>::max());
+
+    // the throwing decoder has the full message, with the json
+    try {
+        ETCDParsedResponse thrown(etcdError);
+        FAIL() << "an error of etcd must be thrown";
+    } catch (const ETCDError& e) {
+        EXPECT_EQ(e.getErrorCode(), ETCDERROR_ETCD_RETURNED_ERROR);
+        EXPECT_EQ(e.getEtcdErrorCode(), 5);
+        EXPECT_NE(e.getErrorMessage().find("requested lease not found"), std::string::npos);
+        EXPECT_NE(std::string(e.what()).find(etcdError), std::string::npos);
+    }
+    // an error that isn't from etcd says so
+    EXPECT_STREQ(ETCDError(ETCDERROR_WATCH_STREAM_CLOSED, "closed").what(), "Error: 33: closed");
+}
+
+TEST(etcd_client_helper__parsed_response, concat)
+{
+    std::vector<ETCDParsedResponse> parts;
+    parts.emplace_back(R"({"header":{"cluster_id":"1","member_id":"2","revision":"7","raft_term":"4"},
+        "kvs":[{"key":"L2E=","create_revision":"1","mod_revision":"1","version":"1","value":"MQ=="}],
+        "count":"1"})");
+    parts.emplace_back(
+        R"({"header":{"cluster_id":"1","member_id":"2","revision":"7","raft_term":"4"}})");
+    parts.emplace_back(R"({"header":{"cluster_id":"1","member_id":"2","revision":"7","raft_term":"4"},
+        "kvs":[{"key":"L2I=","create_revision":"2","mod_revision":"2","version":"1","value":"Mg=="},
+               {"key":"L2M=","create_revision":"3","mod_revision":"3","version":"1","value":"Mw=="}],
+        "count":"2"})");
+
+    // the entries point into the parts, which are kept alive by the result
+    ETCDParsedResponse r = ETCDParsedResponse::Concat(std::move(parts));
+    parts.clear();
+    ASSERT_EQ(r.getKVEntriesVec().size(), 3u);
+    EXPECT_EQ(r.getKVEntriesVec().at(0).key, "/a");
+    EXPECT_EQ(r.getKVEntriesVec().at(1).key, "/b");
+    EXPECT_EQ(r.getKVEntriesVec().at(2).value, "3");
+    EXPECT_EQ(r.getKVEntriesMap().at("/b").value, "2");
+    EXPECT_EQ(r.getCount(), 3u);
+    EXPECT_EQ(r.getRevision(), 7u);
+
+    EXPECT_TRUE(ETCDParsedResponse::Concat({}).getKVEntriesVec().empty());
+}
+
+TEST(etcd_client_helper__parsed_response, coalesce_events)
+{
+    std::vector<ETCDParsedResponse> messages;
+    messages.emplace_back(R"({"result":{"header":{"cluster_id":"1","member_id":"2","revision":"5","raft_term":"4"},
+        "events":[{"kv":{"key":"YQ==","create_revision":"5","mod_revision":"5","version":"1","value":"MQ=="}},
+                  {"kv":{"key":"Yg==","create_revision":"5","mod_revision":"5","version":"1","value":"MQ=="}}]}})");
+    messages.emplace_back(R"({"result":{"header":{"cluster_id":"1","member_id":"2","revision":"6","raft_term":"4"},
+        "events":[{"kv":{"key":"YQ==","create_revision":"5","mod_revision":"6","version":"2","value":"Mg=="}}]}})");
+    messages.emplace_back(R"({"result":{"header":{"cluster_id":"1","member_id":"2","revision":"7","raft_term":"4"},
+        "events":[{"type":"DELETE","kv":{"key":"Yg==","mod_revision":"7"}}]}})");
+
+    // the last event of each key, in the order of those events, with the header of the last message
+    ETCDParsedResponse r = ETCDParsedResponse::CoalesceEvents(std::move(messages));
+    messages.clear();
+    ASSERT_EQ(r.getEvents().size(), 2u);
+    EXPECT_EQ(r.getEvents().at(0).type, ETCDParsedResponse::Event::Type::Put);
+    EXPECT_EQ(r.getEvents().at(0).kv.key, "a");
+    EXPECT_EQ(r.getEvents().at(0).kv.value, "2");
+    EXPECT_EQ(r.getEvents().at(1).type, ETCDParsedResponse::Event::Type::Delete);
+    EXPECT_EQ(r.getEvents().at(1).kv.key, "b");
+    ASSERT_EQ(r.getKVEntriesVec().size(), 2u);
+    EXPECT_EQ(r.getKVEntriesVec().at(0).mod_revision, 6u);
+    EXPECT_EQ(r.getRevision(), 7u);
+
+    EXPECT_TRUE(ETCDParsedResponse::CoalesceEvents({}).getEvents().empty());
+}
+
+TEST(etcd_client_helper__base64, fuzz_against_beast)
+{
+    namespace beast64 = boost::beast::detail::base64;
+
+    unsigned seed = static_cast<unsigned>(time(nullptr));
+    SCOPED_TRACE("seed: " + std::to_string(seed));
+    std::mt19937 gen(seed);
+
+    const ETCDBase64::Implementation impls[] = {ETCDBase64::Implementation::Scalar,
+                                                ETCDBase64::Implementation::SSE41,
+                                                ETCDBase64::Implementation::AVX2};
+    for (ETCDBase64::Implementation impl : impls) {
+        if (!ETCDBase64::IsSupported(impl)) {
+            continue;
+        }
+        SCOPED_TRACE(ETCDBase64::ImplementationName(impl));
+        for (int iteration = 0; iteration < 20000; iteration++) {
+            std::size_t len = gen() % (iteration % 100 == 0 ? 4096 : 200);
+            std::string data(len, '\0');
+            for (char& c : data) {
+                c = static_cast<char>(gen());
+            }
+
+            std::string expected(beast64::encoded_size(len), '\0');
+            expected.resize(beast64::encode(&expected[0], data.data(), len));
+            std::string encoded(ETCDBase64::EncodedSize(len), '\0');
+            encoded.resize(ETCDBase64::Encode(&encoded[0], data.data(), len, impl));
+            ASSERT_EQ(encoded, expected);
+
+            // corrupt some of the inputs: characters out of the alphabet, padding in the middle, no padding
+            std::string input = encoded;
+            switch (gen() % 4) {
+            case 1:
+                if (!input.empty()) {
+                    input[gen() % input.size()] = static_cast<char>(gen());
+                }
+                break;
+            case 2:
+                input.insert(input.begin() + (input.empty() ? 0 : gen() % input.size()), '=');
+                break;
+            case 3:
+                input.resize(input.size() - std::min<std::size_t>(input.size(), gen() % 4));
+                break;
+            default:
+                break;
+            }
+
+            std::string expectedDecoded(input.size() / 4 * 3 + 3, '\0');
+            auto        expectedSizes = beast64::decode(&expectedDecoded[0], input.data(), input.size());
+            expectedDecoded.resize(expectedSizes.first);
+            std::string decoded(ETCDBase64::DecodedSize(input.size()), '\0');
+            auto        sizes = ETCDBase64::Decode(&decoded[0], input.data(), input.size(), impl);
+            decoded.resize(sizes.first);
+            ASSERT_EQ(sizes, expectedSizes) << input;
+            ASSERT_EQ(decoded, expectedDecoded) << input;
+            if (input == encoded) {
+                ASSERT_EQ(decoded, data);
+            }
+        }
+    }
+}
+
+TEST(etcd_client_helper__request_body, build)
+{
+    // like the bodies of ETCDClient::set and ETCDClient::getAll
+    auto buildPut = [](const std::string& key, const std::string& value) {
+        ETCDRequestBody body;
+        body.raw(R"({"key": ")").base64(key).raw(R"(", "value": ")").base64(value);
+        body.raw(R"(", "lease": ")").number(1234567890123u).raw(R"("})");
+        return body.str();
+    };
+    auto buildRange = [](const std::string& prefix) {
+        ETCDRequestBody body;
+        body.raw(R"({"key": ")").base64(prefix).raw(R"(", "range_end": ")").base64RangeEnd(prefix).raw(R"("})");
+        return body.str();
+    };
+
+    EXPECT_EQ(buildPut("/a", "b"), R"({"key": "L2E=", "value": "Yg==", "lease": "1234567890123"})");
+    EXPECT_EQ(buildRange("/a"), R"({"key": "L2E=", "range_end": "L2I="})");
+    EXPECT_EQ(ETCDRequestBody().number(0).raw(",").number(18446744073709551615u).str(), "0,18446744073709551615");
+
+    // once the buffer of the thread has grown, a body allocates once, whatever its size
+    buildPut(std::string(1 << 16, 'k'), std::string(1 << 18, 'v'));
+    for (std::size_t size : {1, 100, 10000, 1 << 16}) {
+        std::string key(size, 'k');
+        std::string value(size * 4, 'v');
+        std::size_t before = AllocationCount__test;
+        std::string put    = buildPut(key, value);
+        EXPECT_EQ(AllocationCount__test - before, 1u) << size;
+        before            = AllocationCount__test;
+        std::string range = buildRange(key);
+        EXPECT_EQ(AllocationCount__test - before, 1u) << size;
+    }
+
+    // a body built while another one is being built on the same thread doesn't share its buffer
+    ETCDRequestBody outer;
+    outer.raw("outer");
+    EXPECT_EQ(ETCDRequestBody().raw("inner").str(), "inner");
+    EXPECT_EQ(outer.raw("!").str(), "outer!");
+
+    // prefix range ends, as in etcd's clientv3.GetPrefixRangeEnd
+    auto rangeEnd = [](const std::string& prefix) { return ETCDRequestBody().base64RangeEnd(prefix).str(); };
+    EXPECT_EQ(rangeEnd("abc"), ETCDBase64::Encode("abd"));
+    EXPECT_EQ(rangeEnd("ab\xff"), ETCDBase64::Encode("ac"));
+    EXPECT_EQ(rangeEnd("a\xfe\xff\xff"), ETCDBase64::Encode("a\xff"));
+    EXPECT_EQ(rangeEnd(std::string("\0a", 2)), ETCDBase64::Encode(std::string("\0b", 2)));
+    EXPECT_EQ(rangeEnd("\xff\xff"), ETCDBase64::Encode(std::string(1, '\0')));
+    EXPECT_EQ(rangeEnd(""), ETCDBase64::Encode(std::string(1, '\0')));
+}
+
+TEST(etcd_client_helper__watch_multiplexer, create_request)
+{
+    ETCDWatchOptions options;
+    EXPECT_EQ(ETCDWatchMultiplexer::CreateRequest("/a", options), R"({"create_request": {"key": "L2E="}})");
+    options.prefix         = true;
+    options.startRevision  = 12;
+    options.prevKv         = true;
+    options.progressNotify = true;
+    options.noPut          = true;
+    options.noDelete       = true;
+    EXPECT_EQ(ETCDWatchMultiplexer::CreateRequest("/a", options),
+              R"({"create_request": {"key": "L2E=", "range_end": "L2I=", "start_revision": "12", )"
+              R"("prev_kv": true, "progress_notify": true, "filters": ["NOPUT", "NODELETE"]}})");
+    options          = ETCDWatchOptions();
+    options.rangeEnd = "/c";
+    options.noDelete = true;
+    EXPECT_EQ(ETCDWatchMultiplexer::CreateRequest("/a", options),
+              R"({"create_request": {"key": "L2E=", "range_end": "L2M=", "filters": ["NODELETE"]}})");
+}
+
+// a watch server for the tests of the multiplexer: serve() accepts a stream, reads its request up to the
+// first create request and answers it, then holds the stream a while before dropping it
+class FakeWatchServer__test
+{
+    boost::asio::io_context        ioc;
+    boost::asio::ip::tcp::acceptor acceptor;
+
+public:
+    FakeWatchServer__test()
+        : acceptor(ioc, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+    {
+    }
+
+    uint16_t port() const { return acceptor.local_endpoint().port(); }
+
+    /**
+     * @brief Message the json of a message of watch 0 at revision, with fields after the watch id
+     */
+    static std::string Message(uint64_t revision, const std::string& fields)
+    {
+        return R"({"result":{"header":{"cluster_id":"1","member_id":"2","revision":")" +
+               std::to_string(revision) + R"(","raft_term":"3"},"watch_id":"0",)" + fields + "}}";
+    }
+
+    /**
+     * @brief Stream a 200 response with the messages as the chunks of its body
+     */
+    static std::string Stream(const std::vector<std::string>& messages)
+    {
+        std::ostringstream os;
+        os << "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\n\r\n";
+        for (const std::string& json : messages) {
+            os << std::hex << json.size() << "\r\n" << json << "\r\n";
+        }
+        return os.str();
+    }
+
+    /**
+     * @brief serve answers the next stream with response, written as it is
+     * @return the request of the stream
+     */
+    std::string serve(const std::string&        response,
+                      std::chrono::milliseconds hold = std::chrono::milliseconds(50))
+    {
+        boost::asio::ip::tcp::socket socket(ioc);
+        acceptor.accept(socket);
+        std::string request;
+        char        data[4096];
+        while (request.find("}}\r\n", request.find("\r\n\r\n")) == std::string::npos) {
+            request.append(data, socket.read_some(boost::asio::buffer(data)));
+        }
+        boost::asio::write(socket, boost::asio::buffer(response));
+        std::this_thread::sleep_for(hold);
+        return request;
+    }
+};
+
+TEST(etcd_client_helper__watch_multiplexer, resumes_after_drop)
+{
+    // a watch server that drops the stream after each message, and records the create requests
+    FakeWatchServer__test    fakeServer;
+    std::vector<std::string> createRequests;
+    auto                     serveOnce = [&](const std::string& fields) {
+        const std::string request = fakeServer.serve(FakeWatchServer__test::Stream(
+            {FakeWatchServer__test::Message(7, R"("created":true)"),
+             FakeWatchServer__test::Message(7, fields)}));
+        createRequests.push_back(request.substr(request.find("{\"create_request\"")));
+    };
+    std::thread server([&]() {
+        serveOnce(R"("events":[{"kv":{"key":"YQ==","create_revision":"5","mod_revision":"9","version":"2",)"
+                  R"("value":"MQ=="}}])");
+        serveOnce(R"("events":[{"kv":{"key":"YQ==","create_revision":"5","mod_revision":"10","version":"3",)"
+                  R"("value":"Mg=="}}])");
+        // the revision to resume from was compacted meanwhile
+        serveOnce(R"("canceled":true,"compact_revision":"20")");
+    });
+
+    boost::asio::io_context                                                  ioc;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work(ioc.get_executor());
+    std::thread                                                              client([&ioc]() { ioc.run(); });
+    {
+        std::mutex               multiplexerMtx;
+        std::vector<std::string> values;
+        unsigned                 creations       = 0;
+        uint64_t                 compactRevision = 0;
+        auto                     multiplexer     = std::make_shared<ETCDWatchMultiplexer>(
+            ioc, "127.0.0.1", std::to_string(fakeServer.port()), "/v3alpha/watch", 1);
+        multiplexer->setReconnectDelays(std::chrono::milliseconds(10), std::chrono::milliseconds(20));
+        std::shared_future<void> created;
+        multiplexer->add("a", ETCDWatchOptions(), [&](ETCDParsedResponse r) {
+            std::lock_guard<std::mutex> lg(multiplexerMtx);
+            creations += r.isWatchCreated() ? 1 : 0;
+            compactRevision = r.isWatchCanceled() ? r.getCompactRevision() : compactRevision;
+            for (const auto& e : r.getEvents()) {
+                values.push_back(std::string(e.kv.value));
+            }
+        }, created);
+        created.get();
+        server.join();
+        for (int attempt = 0; attempt < 500; attempt++) {
+            {
+                std::lock_guard<std::mutex> lg(multiplexerMtx);
+                if (compactRevision != 0) {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        multiplexer->close();
+
+        std::lock_guard<std::mutex> lg(multiplexerMtx);
+        EXPECT_EQ(values, (std::vector<std::string>{"1", "2"}));
+        // the watch is created again after the last event it got, and the new creation isn't given out
+        EXPECT_EQ(creations, 1u);
+        ASSERT_EQ(createRequests.size(), 3);
+        EXPECT_EQ(createRequests[0].find("start_revision"), std::string::npos);
+        EXPECT_NE(createRequests[1].find(R"("start_revision": "10")"), std::string::npos) << createRequests[1];
+        EXPECT_NE(createRequests[2].find(R"("start_revision": "11")"), std::string::npos) << createRequests[2];
+        // a compacted watch isn't resumed, the callback is told to read the keys again
+        EXPECT_EQ(compactRevision, 20u);
+    }
+    work.reset();
+    ioc.stop();
+    client.join();
+}
+
+TEST(etcd_client_helper__watch_multiplexer, reconnects_after_non_json_body)
+{
+    // a gateway that answers the first stream with a text error page, then a watch server
+    FakeWatchServer__test fakeServer;
+    std::thread           server([&]() {
+        fakeServer.serve("HTTP/1.1 503 Service Unavailable\r\nContent-Type: text/plain\r\n"
+                         "Content-Length: 22\r\n\r\nupstream connect error");
+        const std::string events = R"("events":[{"kv":{"key":"YQ==","create_revision":"5",)"
+                                   R"("mod_revision":"9","version":"2","value":"MQ=="}}])";
+        fakeServer.serve(FakeWatchServer__test::Stream(
+            {FakeWatchServer__test::Message(7, R"("created":true)"),
+             FakeWatchServer__test::Message(7, events)}));
+    });
+
+    boost::asio::io_context                                                  ioc;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work(ioc.get_executor());
+    // an error thrown out of a handler would end the thread of the client
+    std::thread client([&ioc]() { ioc.run(); });
+    {
+        std::mutex               multiplexerMtx;
+        std::vector<std::string> values;
+        auto                     multiplexer = std::make_shared<ETCDWatchMultiplexer>(
+            ioc, "127.0.0.1", std::to_string(fakeServer.port()), "/v3alpha/watch", 1);
+        multiplexer->setReconnectDelays(std::chrono::milliseconds(10), std::chrono::milliseconds(20));
+        std::shared_future<void> created;
+        multiplexer->add("a", ETCDWatchOptions(), [&](ETCDParsedResponse r) {
+            std::lock_guard<std::mutex> lg(multiplexerMtx);
+            for (const auto& e : r.getEvents()) {
+                values.push_back(std::string(e.kv.value));
+            }
+        }, created);
+        ASSERT_EQ(created.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+        server.join();
+        for (int attempt = 0; attempt < 500; attempt++) {
+            {
+                std::lock_guard<std::mutex> lg(multiplexerMtx);
+                if (!values.empty()) {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        multiplexer->close();
+
+        std::lock_guard<std::mutex> lg(multiplexerMtx);
+        EXPECT_EQ(values, (std::vector<std::string>{"1"}));
+    }
+    work.reset();
+    ioc.stop();
+    client.join();
+}
+
+TEST(etcd_client_helper__watch_multiplexer, coalesces_only_events)
+{
+    // the creation and three changes of "a", in one go
+    FakeWatchServer__test    fakeServer;
+    std::vector<std::string> sent{FakeWatchServer__test::Message(7, R"("created":true)")};
+    for (int i = 1; i <= 3; i++) {
+        sent.push_back(FakeWatchServer__test::Message(
+            7 + i, R"("events":[{"kv":{"key":"YQ==","create_revision":"5","mod_revision":")" +
+                       std::to_string(7 + i) + R"(","version":"2","value":")" +
+                       ETCDBase64::Encode(std::to_string(i)) + R"("}}])"));
+    }
+    std::thread server([&]() {
+        fakeServer.serve(FakeWatchServer__test::Stream(sent), std::chrono::milliseconds(300));
+    });
+
+    boost::asio::io_context                                                  ioc;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work(ioc.get_executor());
+    std::thread                                                              client([&ioc]() { ioc.run(); });
+    // the callbacks run once all the messages are queued
+    boost::asio::io_context callbacks;
+    {
+        std::vector<ETCDParsedResponse> messages;
+        auto                            multiplexer = std::make_shared<ETCDWatchMultiplexer>(
+            ioc, "127.0.0.1", std::to_string(fakeServer.port()), "/v3alpha/watch", 1);
+        multiplexer->setCallbackExecutor(callbacks.get_executor());
+        ETCDWatchOptions options;
+        options.queueSize = 1;
+        options.overflow  = ETCDWatchOptions::Overflow::Coalesce;
+        std::shared_future<void> created;
+        multiplexer->add("a", options, [&](ETCDParsedResponse r) { messages.push_back(r); }, created);
+        // the changes are written with the creation, they're all queued shortly after it
+        ASSERT_EQ(created.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        callbacks.run();
+        multiplexer->close();
+
+        // the creation isn't merged with the events that follow it
+        ASSERT_EQ(messages.size(), 2u);
+        EXPECT_TRUE(messages[0].isWatchCreated());
+        EXPECT_TRUE(messages[0].getEvents().empty());
+        EXPECT_FALSE(messages[1].isWatchCreated());
+        ASSERT_EQ(messages[1].getEvents().size(), 1u);
+        EXPECT_EQ(messages[1].getEvents().at(0).kv.value, "3");
+        EXPECT_EQ(messages[1].getRevision(), 10u);
+    }
+    server.join();
+    work.reset();
+    ioc.stop();
+    client.join();
+}
+
+TEST(etcd_client_helper__watch_multiplexer, own_stream_uses_version_prefix)
+{
+    FakeWatchServer__test fakeServer;
+    std::string           request;
+    std::thread           server([&]() {
+        request = fakeServer.serve(FakeWatchServer__test::Stream(
+            {FakeWatchServer__test::Message(7, R"("created":true)")}));
+    });
+    {
+        // no connection is opened ahead of time, the server accepts only the stream
+        HttpSessionPoolConfig poolConfig;
+        poolConfig.minSize = 0;
+        ETCDClient client("127.0.0.1", fakeServer.port(), 1, poolConfig);
+        client.setVersionUrlPrefix("/v3");
+        ETCDWatch w = client.watch("a", [](ETCDParsedResponse) {});
+        w.wait();
+        server.join();
+        w.cancel();
+    }
+    EXPECT_EQ(request.rfind("POST /v3/watch ", 0), 0u) << request;
+}
+
+TEST(etcd_client_helper__watch_multiplexer, rejected_creation_fails)
+{
+    // the gateway answers a create request etcd rejected with an error instead of a watch response
+    FakeWatchServer__test   fakeServer;
+    boost::asio::io_context ioc;
+    auto                    multiplexer = std::make_shared<ETCDWatchMultiplexer>(
+        ioc, "127.0.0.1", std::to_string(fakeServer.port()), "/v3/watch", 1);
+    std::atomic<int>         messages{0};
+    std::shared_future<void> rejected;
+    std::shared_future<void> created;
+    ETCDWatchOptions         options;
+    options.startRevision = 2;
+    multiplexer->add("a", options, [&](ETCDParsedResponse) { messages++; }, rejected);
+    multiplexer->add("b", ETCDWatchOptions(), [&](ETCDParsedResponse) { messages++; }, created);
+    std::thread server([&]() {
+        fakeServer.serve(FakeWatchServer__test::Stream(
+            {R"({"error":{"grpc_code":11,"http_code":400,"message":"etcdserver: mvcc: required revision )"
+             R"(has been compacted","http_status":"Bad Request"}})",
+             FakeWatchServer__test::Message(7, R"("created":true)")}));
+    });
+    std::thread client([&ioc]() { ioc.run(); });
+
+    ASSERT_EQ(rejected.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    try {
+        rejected.get();
+        ADD_FAILURE() << "the rejected creation succeeded";
+    } catch (const ETCDError& e) {
+        EXPECT_EQ(e.getErrorCode(), ETCDERROR_ETCD_RETURNED_ERROR);
+        EXPECT_NE(std::string(e.what()).find("required revision has been compacted"), std::string::npos);
+    }
+    // the next creation goes to the next watch
+    ASSERT_EQ(created.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_NO_THROW(created.get());
+    server.join();
+    multiplexer->close();
+    client.join();
+    // the callback of the creation is posted on the io thread, which runs it before it stops
+    EXPECT_EQ(messages.load(), 1);
+}
+
+TEST(etcd_client_helper__watch_multiplexer, wait_fails_without_creation)
+{
+    // a port nothing listens on
+    uint16_t port = 0;
+    {
+        boost::asio::io_context        ioc;
+        boost::asio::ip::tcp::acceptor acceptor(
+            ioc, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        port = acceptor.local_endpoint().port();
+    }
+    auto waitError = [](ETCDWatch& w) {
+        std::future<long> code = std::async(std::launch::async, [&w]() -> long {
+            try {
+                w.wait();
+            } catch (const ETCDError& e) {
+                return e.getErrorCode();
+            }
+            return 0;
+        });
+        EXPECT_EQ(code.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+        return code.get();
+    };
+
+    ETCDClient client("127.0.0.1", port);
+    // the stream fails to connect
+    ETCDWatch own = client.watch("a", [](ETCDParsedResponse) {});
+    EXPECT_EQ(waitError(own), ETCDERROR_FAILED_TO_CONNECT);
+    EXPECT_FALSE(own.isLive());
+    // the watch is canceled or its multiplexer closed before its creation
+    client.enableWatchMultiplexing();
+    ETCDWatch canceled = client.watch("a", [](ETCDParsedResponse) {});
+    canceled.cancel();
+    EXPECT_EQ(waitError(canceled), ETCDERROR_WATCH_STREAM_CLOSED);
+    boost::asio::io_context ioc;
+    auto                    multiplexer =
+        std::make_shared<ETCDWatchMultiplexer>(ioc, "127.0.0.1", std::to_string(port), "/v3/watch", 1);
+    ETCDWatch closed(multiplexer, "a", ETCDWatchOptions(), [](ETCDParsedResponse) {});
+    multiplexer->close();
+    EXPECT_EQ(waitError(closed), ETCDERROR_WATCH_STREAM_CLOSED);
+}
+
+TEST(etcd_client_helper__io_shards, current_shard)
+{
+    ETCDIoShards shards(3, 1);
+    ASSERT_EQ(shards.size(), 3u);
+
+    // a thread of a shard is on its shard
+    for (std::size_t i = 0; i < shards.size(); i++) {
+        std::promise<std::size_t> index;
+        boost::asio::post(shards.at(i), [&]() { index.set_value(shards.currentIndex()); });
+        EXPECT_EQ(index.get_future().get(), i);
+        std::promise<bool> isShardThread;
+        boost::asio::post(shards.at(i), [&]() { isShardThread.set_value(shards.isShardThread()); });
+        EXPECT_TRUE(isShardThread.get_future().get());
+    }
+
+    // another thread keeps its shard
+    const std::size_t index = shards.currentIndex();
+    EXPECT_LT(index, shards.size());
+    EXPECT_EQ(shards.currentIndex(), index);
+    EXPECT_EQ(&shards.current(), &shards.at(index));
+    EXPECT_FALSE(shards.isShardThread());
+    shards.stop();
+}
+
+// a keep-alive http server for the tests of HttpSession: it takes the connections one at a time, and the
+// test decides which requests it answers before dropping a connection
+class FakeHttpServer__test
+{
+    boost::asio::io_context                       ioc;
+    boost::asio::ip::tcp::acceptor                acceptor;
+    std::unique_ptr<boost::asio::ip::tcp::socket> socket;
+    std::string                                   pending;
+
+public:
+    FakeHttpServer__test()
+        : acceptor(ioc, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+    {
+    }
+
+    uint16_t port() const { return acceptor.local_endpoint().port(); }
+
+    static std::string Response(const std::string& body, bool isKeepAlive = true)
+    {
+        return "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: " +
+               std::string(isKeepAlive ? "keep-alive" : "close") +
+               "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    }
+
+    void accept()
+    {
+        socket = std::make_unique<boost::asio::ip::tcp::socket>(ioc);
+        pending.clear();
+        acceptor.accept(*socket);
+    }
+
+    /**
+     * @brief RequestSize the size of the request at the start of data, or 0 if it isn't all there yet
+     */
+    static std::size_t RequestSize(const std::string& data)
+    {
+        static const std::string lengthField = "Content-Length: ";
+
+        const std::size_t headerEnd = data.find("\r\n\r\n");
+        if (headerEnd == std::string::npos) {
+            return 0;
+        }
+        const std::size_t size =
+            headerEnd + 4 + std::stoul(data.substr(data.find(lengthField) + lengthField.size()));
+        return data.size() < size ? 0 : size;
+    }
+
+    /**
+     * @brief readTarget reads the next request of the connection
+     * @return its target
+     */
+    std::string readTarget()
+    {
+        char data[4096];
+        while (RequestSize(pending) == 0) {
+            pending.append(data, socket->read_some(boost::asio::buffer(data)));
+        }
+        const std::string request = pending.substr(0, RequestSize(pending));
+        pending.erase(0, request.size());
+        const std::size_t targetStart = request.find(' ') + 1;
+        return request.substr(targetStart, request.find(' ', targetStart) - targetStart);
+    }
+
+    void write(const std::string& response)
+    {
+        boost::asio::write(*socket, boost::asio::buffer(response));
+    }
+
+    void drop()
+    {
+        boost::system::error_code ec;
+        socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        socket->close(ec);
+    }
+};
+
+TEST(etcd_client_helper__http_session, retries_only_idempotent_requests)
+{
+    boost::asio::io_context                                                  ioc;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work(ioc.get_executor());
+    std::thread client([&ioc]() { ioc.run(); });
+
+    // the connection goes stale after its first request: the next request is read and dropped unanswered
+    auto staleAfterFirstRequest = [&ioc](const std::string& partialResponse, bool isIdempotent) {
+        FakeHttpServer__test     fakeServer;
+        std::vector<std::string> targets;
+        std::thread              server([&]() {
+            fakeServer.accept();
+            targets.push_back(fakeServer.readTarget());
+            fakeServer.write(FakeHttpServer__test::Response(R"({"n":1})"));
+            targets.push_back(fakeServer.readTarget());
+            if (!partialResponse.empty()) {
+                fakeServer.write(partialResponse);
+            }
+            fakeServer.drop();
+            if (isIdempotent && partialResponse.empty()) {
+                fakeServer.accept();
+                targets.push_back(fakeServer.readTarget());
+                fakeServer.write(FakeHttpServer__test::Response(R"({"n":2})"));
+            }
+        });
+        auto session = std::make_shared<HttpSession>(ioc);
+        session->connect("127.0.0.1", std::to_string(fakeServer.port()));
+        const auto post = boost::beast::http::verb::post;
+        EXPECT_EQ(session->enqueueRequest(post, "/first", "{}", 11).get().res.body(), R"({"n":1})");
+        HttpSession::Result second =
+            session->enqueueRequest(post, "/second", "{}", 11, isIdempotent).get();
+        server.join();
+        session->close();
+        return std::make_pair(second, targets);
+    };
+
+    // sent again on a new connection
+    auto retried = staleAfterFirstRequest("", true);
+    EXPECT_FALSE(retried.first.ec) << retried.first.ec.message();
+    EXPECT_EQ(retried.first.res.body(), R"({"n":2})");
+    EXPECT_EQ(retried.second, (std::vector<std::string>{"/first", "/second", "/second"}));
+
+    // a txn or a lease grant may have been applied
+    auto notIdempotent = staleAfterFirstRequest("", false);
+    EXPECT_EQ(notIdempotent.first.ec.value(), ETCDERROR_FAILED_TO_READ_SOCKET);
+    EXPECT_EQ(notIdempotent.second, (std::vector<std::string>{"/first", "/second"}));
+
+    // the server started to answer, so it read the request
+    auto partlyAnswered = staleAfterFirstRequest("HTTP/1.1 200 OK\r\n", true);
+    EXPECT_EQ(partlyAnswered.first.ec.value(), ETCDERROR_FAILED_TO_READ_SOCKET);
+    EXPECT_EQ(partlyAnswered.second, (std::vector<std::string>{"/first", "/second"}));
+
+    work.reset();
+    ioc.stop();
+    client.join();
+}
+
+TEST(etcd_client_helper__http_session, pipelined_requests_are_retried_only_if_idempotent)
+{
+    boost::asio::io_context                                                  ioc;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work(ioc.get_executor());
+    std::thread client([&ioc]() { ioc.run(); });
+
+    // three requests are pipelined behind a first one; the second of them isn't idempotent
+    auto pipelinedBehindFirst = [&ioc](bool isFirstAnsweredAlone, bool isKeepAlive) {
+        FakeHttpServer__test     fakeServer;
+        std::vector<std::string> targets;
+        std::thread              server([&]() {
+            fakeServer.accept();
+            targets.push_back(fakeServer.readTarget());
+            if (isFirstAnsweredAlone) {
+                fakeServer.write(FakeHttpServer__test::Response(R"({"n":1})"));
+            }
+            for (int i = 0; i < 3; i++) {
+                targets.push_back(fakeServer.readTarget());
+            }
+            if (!isFirstAnsweredAlone) {
+                fakeServer.write(FakeHttpServer__test::Response(R"({"n":1})", isKeepAlive));
+            }
+            fakeServer.drop();
+            fakeServer.accept();
+            for (int i = 0; i < 2; i++) {
+                targets.push_back(fakeServer.readTarget());
+                fakeServer.write(FakeHttpServer__test::Response(R"({"n":2})"));
+            }
+        });
+        auto session = std::make_shared<HttpSession>(ioc);
+        session->connect("127.0.0.1", std::to_string(fakeServer.port()), 4);
+        const auto                       post  = boost::beast::http::verb::post;
+        std::future<HttpSession::Result> first = session->enqueueRequest(post, "/first", "{}", 11);
+        if (isFirstAnsweredAlone) {
+            EXPECT_EQ(first.get().res.body(), R"({"n":1})");
+        }
+        std::vector<std::future<HttpSession::Result>> pipelined;
+        pipelined.push_back(session->enqueueRequest(post, "/a", "{}", 11));
+        pipelined.push_back(session->enqueueRequest(post, "/txn", "{}", 11, false));
+        pipelined.push_back(session->enqueueRequest(post, "/c", "{}", 11));
+        if (!isFirstAnsweredAlone) {
+            EXPECT_EQ(first.get().res.body(), R"({"n":1})");
+        }
+        std::vector<HttpSession::Result> results;
+        for (auto& f : pipelined) {
+            results.push_back(f.get());
+        }
+        server.join();
+        session->close();
+        return std::make_pair(results, targets);
+    };
+
+    // the connection was reused when they were written, and dropped them all unanswered
+    auto dropped = pipelinedBehindFirst(true, true);
+    EXPECT_EQ(dropped.first[0].res.body(), R"({"n":2})");
+    EXPECT_EQ(dropped.first[1].ec.value(), ETCDERROR_FAILED_TO_READ_SOCKET);
+    EXPECT_EQ(dropped.first[2].res.body(), R"({"n":2})");
+    EXPECT_EQ(dropped.second, (std::vector<std::string>{"/first", "/a", "/txn", "/c", "/a", "/c"}));
+
+    // the response of the first one closes the connection
+    auto closed = pipelinedBehindFirst(false, false);
+    EXPECT_EQ(closed.first[0].res.body(), R"({"n":2})");
+    EXPECT_EQ(closed.first[1].ec.value(), ETCDERROR_FAILED_TO_READ_SOCKET);
+    EXPECT_EQ(closed.first[2].res.body(), R"({"n":2})");
+    EXPECT_EQ(closed.second, (std::vector<std::string>{"/first", "/a", "/txn", "/c", "/a", "/c"}));
+
+    work.reset();
+    ioc.stop();
+    client.join();
 }